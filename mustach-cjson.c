@@ -11,24 +11,189 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <locale.h>
 
 #include "mustach.h"
 #include "mustach-wrap.h"
 #include "mustach-cjson.h"
 
+#if !defined(CJSON_INDEX_THRESHOLD)
+# define CJSON_INDEX_THRESHOLD 16 /* count of keys searched linearly */
+#endif
+
+#if !defined(CJSON_INDEX_CACHE)
+# define CJSON_INDEX_CACHE 64 /* count of indexes kept during a render */
+#endif
+
+#if !defined(SEL_MEMO_SIZE)
+# define SEL_MEMO_SIZE 16 /* count of names whose searches are remembered */
+#endif
+
+/* index of the keys of an object having many keys */
+struct index {
+	const cJSON *object; /* the indexed object */
+	unsigned mask;       /* count of slots minus one */
+	cJSON *items[];      /* the slots of items by hash of their key */
+};
+
 struct expl {
 	cJSON null;
 	cJSON *root;
 	cJSON *selection;
 	int depth;
+	uint64_t stamp;
 	struct {
 		cJSON *cont;
 		cJSON *obj;
 		cJSON *next;
 		int is_objiter;
+		uint64_t stamp;
 	} stack[MUSTACH_MAX_DEPTH];
+
+	/* indexes of the objects having many keys, by address of object */
+	struct index *indexes[CJSON_INDEX_CACHE];
+
+	/* remembered searches, by hash of name (see mustach_wrap_memo) */
+	struct mustach_wrap_memo memo[SEL_MEMO_SIZE];
+
+	/* scratch area for formatting numbers */
+	char number[32];
 };
 
+/*
+ * formats the number 'item' in 'buffer' of 'size' exactly as
+ * cJSON_PrintUnformatted does. Returns the start of the text.
+ */
+static const char *format_number(char *buffer, size_t size, const cJSON *item, size_t *length)
+{
+	double d = item->valuedouble, test, m;
+	unsigned u;
+	char *p, point;
+
+	/* NaN and infinity */
+	if ((d * 0) != 0) {
+		*length = 4;
+		return "null";
+	}
+
+	/* integers */
+	if (d == (double)item->valueint) {
+		u = item->valueint < 0 ? 0 - (unsigned)item->valueint : (unsigned)item->valueint;
+		p = &buffer[size];
+		*--p = 0;
+		do {
+			*--p = (char)('0' + u % 10);
+		} while ((u /= 10) != 0);
+		if (item->valueint < 0)
+			*--p = '-';
+		*length = (size_t)(&buffer[size - 1] - p);
+		return p;
+	}
+
+	/* 15 digits if enough for reading back the value, or else 17 */
+	*length = (size_t)snprintf(buffer, size, "%1.15g", d);
+	test = strtod(buffer, NULL);
+	m = d < 0 ? -d : d;
+	if (test < 0 ? -test > m : test > m)
+		m = test < 0 ? -test : test;
+	if (!((test > d ? test - d : d - test) <= m * DBL_EPSILON))
+		*length = (size_t)snprintf(buffer, size, "%1.17g", d);
+
+	/* use the dot as decimal point */
+	point = *localeconv()->decimal_point;
+	if (point != '.')
+		for (p = buffer ; *p ; p++)
+			if (*p == point)
+				*p = '.';
+	return buffer;
+}
+
+/*
+ * get the index of 'object' from the indexes of 'e', making it if needed.
+ * The indexes are cached by address of objects, an index replaced by
+ * an other one gives its memory to it.
+ */
+static struct index *index_get(struct expl *e, const cJSON *object)
+{
+	uintptr_t h = (uintptr_t)object;
+	struct index *index, **pindex;
+	cJSON *item, **slot;
+	unsigned mask, i;
+
+	/* search */
+	pindex = &e->indexes[(h ^ (h >> 7) ^ (h >> 17)) % CJSON_INDEX_CACHE];
+	index = *pindex;
+	if (index != NULL && index->object == object)
+		return index;
+
+	/* compute the count of slots for using at most 2/3 of them */
+	for (mask = 0, item = object->child ; item != NULL ; item = item->next)
+		mask++;
+	mask += mask >> 1;
+	mask |= mask >> 1;
+	mask |= mask >> 2;
+	mask |= mask >> 4;
+	mask |= mask >> 8;
+	mask |= mask >> 16;
+
+	/* allocate or reuse the index */
+	if (index == NULL || index->mask < mask) {
+		free(index);
+		*pindex = index = malloc(sizeof *index + (1 + (size_t)mask) * sizeof *index->items);
+		if (index == NULL)
+			return NULL;
+		index->mask = mask;
+	}
+	index->object = object;
+	memset(index->items, 0, (1 + (size_t)index->mask) * sizeof *index->items);
+
+	/* fill it, the first item of a key hides the next ones as linear search does */
+	mask = index->mask;
+	for (item = object->child ; item != NULL ; item = item->next)
+		if (item->string != NULL) {
+			i = mustach_wrap_hash(item->string, strlen(item->string));
+			while (*(slot = &index->items[i & mask]) != NULL
+			    && strcmp((*slot)->string, item->string))
+				i++;
+			if (*slot == NULL)
+				*slot = item;
+		}
+	return index;
+}
+
+/*
+ * get the item of key 'atom' in 'object'. Only the first keys are
+ * searched linearly, the index of the object is used for the others.
+ */
+static cJSON *getitem(struct expl *e, const cJSON *object, const struct mustach_wrap_atom *atom)
+{
+	const char *name = atom->name;
+	struct index *index;
+	cJSON *item;
+	unsigned i, n;
+
+	if (object == NULL)
+		return NULL;
+
+	/* linear search of small objects */
+	for (n = CJSON_INDEX_THRESHOLD, item = object->child ; item != NULL && n ; n--, item = item->next)
+		if (item->string != NULL && !strcmp(name, item->string))
+			return item;
+	if (item == NULL)
+		return NULL;
+
+	/* search using the index for big objects */
+	index = index_get(e, object);
+	if (index == NULL)
+		return cJSON_GetObjectItemCaseSensitive(object, name);
+	i = atom->hash;
+	while ((item = index->items[i & index->mask]) != NULL && strcmp(name, item->string))
+		i++;
+	return item;
+}
+
 static int start(void *closure)
 {
 	struct expl *e = closure;
@@ -38,68 +203,108 @@ static int start(void *closure)
 	e->selection = &e->null;
 	e->stack[0].cont = NULL;
 	e->stack[0].obj = e->root;
+	e->stack[0].is_objiter = 0;
+	e->stack[0].stamp = 0;
+	e->stamp = 0;
+	memset(e->indexes, 0, sizeof e->indexes);
+	memset(e->memo, 0, sizeof e->memo);
 	return MUSTACH_OK;
 }
 
-static int compare(void *closure, const char *value)
+static void stop(void *closure, int status)
+{
+	struct expl *e = closure;
+	unsigned i;
+
+	(void)status;
+	for (i = 0 ; i < CJSON_INDEX_CACHE ; i++)
+		free(e->indexes[i]);
+}
+
+static int compare(void *closure, const struct mustach_wrap_value *value)
 {
 	struct expl *e = closure;
 	cJSON *o = e->selection;
 	double d;
 
 	if (cJSON_IsNumber(o)) {
-		d = o->valuedouble - atof(value);
+		d = o->valuedouble - value->real;
 		return d < 0 ? -1 : d > 0 ? 1 : 0;
 	} else if (cJSON_IsString(o)) {
-		return strcmp(o->valuestring, value);
+		return strcmp(o->valuestring, value->string);
 	} else if (cJSON_IsTrue(o)) {
-		return strcmp("true", value);
+		return strcmp("true", value->string);
 	} else if (cJSON_IsFalse(o)) {
-		return strcmp("false", value);
+		return strcmp("false", value->string);
 	} else if (cJSON_IsNull(o)) {
-		return strcmp("null", value);
+		return strcmp("null", value->string);
 	} else {
 		return 1;
 	}
 }
 
-static int sel(void *closure, const char *name)
+static int sel_atom(void *closure, const struct mustach_wrap_atom *atom)
 {
 	struct expl *e = closure;
 	cJSON *o;
+	struct mustach_wrap_memo *m;
 	int i, r;
 
-	if (name == NULL) {
-		o = e->stack[e->depth].obj;
-		r = 1;
-	} else {
-		i = e->depth;
-		while (i >= 0 && !(o = cJSON_GetObjectItemCaseSensitive(e->stack[i].obj, name)))
-			i--;
-		if (i >= 0)
-			r = 1;
-		else {
-			o = &e->null;
-			r = 0;
+	m = mustach_wrap_memo_get(e->memo, SEL_MEMO_SIZE, atom);
+	for (i = e->depth ; i >= 0 ; i--) {
+		if (mustach_wrap_memo_hit(m, i, e->stack[i].stamp)) {
+			i = m->depth;
+			o = (cJSON*)m->value;
+			break;
 		}
+		if ((o = getitem(e, e->stack[i].obj, atom)) != NULL)
+			break;
 	}
+	if (i >= 0)
+		r = 1;
+	else {
+		o = &e->null;
+		r = 0;
+	}
+	mustach_wrap_memo_set(m, e->stamp, i, o, 0);
 	e->selection = o;
 	return r;
 }
 
-static int subsel(void *closure, const char *name)
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	struct mustach_wrap_atom atom;
+
+	if (name != NULL) {
+		mustach_wrap_make_atom(&atom, name);
+		return sel_atom(closure, &atom);
+	}
+	e->selection = e->stack[e->depth].obj;
+	return 1;
+}
+
+static int subsel_atom(void *closure, const struct mustach_wrap_atom *atom)
 {
 	struct expl *e = closure;
 	cJSON *o;
 	int r;
 
-	o = cJSON_GetObjectItemCaseSensitive(e->selection, name);
+	o = getitem(e, e->selection, atom);
 	r = o != NULL;
 	if (r)
 		e->selection = o;
 	return r;
 }
 
+static int subsel(void *closure, const char *name)
+{
+	struct mustach_wrap_atom atom;
+
+	mustach_wrap_make_atom(&atom, name);
+	return subsel_atom(closure, &atom);
+}
+
 static int enter(void *closure, int objiter)
 {
 	struct expl *e = closure;
@@ -131,6 +336,7 @@ static int enter(void *closure, int objiter)
 		e->stack[e->depth].next = NULL;
 	} else
 		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 
 not_entering:
@@ -152,6 +358,7 @@ static int next(void *closure)
 
 	e->stack[e->depth].obj = o;
 	e->stack[e->depth].next = o->next;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 }
 
@@ -171,69 +378,258 @@ static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 	struct expl *e = closure;
 	const char *s;
 
+	/* cJSON doesn't record lengths of strings, they are measured once here */
 	if (key) {
 		s = e->stack[e->depth].is_objiter
 			? e->stack[e->depth].obj->string
 			: "";
+		sbuf->length = strlen(s);
 	}
-	else if (cJSON_IsString(e->selection))
+	else if (cJSON_IsString(e->selection)) {
 		s = e->selection->valuestring;
+		sbuf->length = strlen(s);
+	}
 	else if (cJSON_IsNull(e->selection))
 		s = "";
+	else if (cJSON_IsTrue(e->selection)) {
+		s = "true";
+		sbuf->length = 4;
+	}
+	else if (cJSON_IsFalse(e->selection)) {
+		s = "false";
+		sbuf->length = 5;
+	}
+	else if (cJSON_IsNumber(e->selection))
+		s = format_number(e->number, sizeof e->number, e->selection, &sbuf->length);
 	else {
 		s = cJSON_PrintUnformatted(e->selection);
 		if (s == NULL)
 			return MUSTACH_ERROR_SYSTEM;
+		sbuf->length = strlen(s);
 		sbuf->freecb = free;
 	}
 	sbuf->value = s;
 	return 1;
 }
 
+static size_t items(void *closure)
+{
+	struct expl *e = closure;
+	cJSON *o;
+	size_t count;
+
+	for (count = 1, o = e->stack[e->depth].next ; o != NULL ; o = o->next)
+		count++;
+	return count;
+}
+
+static void *make_clone(void *closure, size_t index)
+{
+	struct expl *e = closure, *c;
+
+	c = malloc(sizeof *c);
+	if (c != NULL) {
+		*c = *e;
+		memset(c->indexes, 0, sizeof c->indexes);
+		while (index--) {
+			c->stack[c->depth].obj = c->stack[c->depth].next;
+			c->stack[c->depth].next = c->stack[c->depth].obj->next;
+		}
+		c->stack[c->depth].stamp = ++c->stamp;
+	}
+	return c;
+}
+
+static void free_clone(void *clone)
+{
+	stop(clone, MUSTACH_OK);
+	free(clone);
+}
+
 const struct mustach_wrap_itf mustach_cJSON_wrap_itf = {
 	.start = start,
-	.stop = NULL,
-	.compare = compare,
+	.stop = stop,
+	.compare = NULL,
 	.sel = sel,
 	.subsel = subsel,
 	.enter = enter,
 	.next = next,
 	.leave = leave,
-	.get = get
+	.get = get,
+	.compare_value = compare,
+	.sel_atom = sel_atom,
+	.subsel_atom = subsel_atom,
+	.items = items,
+	.clone = make_clone,
+	.unclone = free_clone
 };
 
 int mustach_cJSON_file(const char *template, size_t length, cJSON *root, int flags, FILE *file)
+{
+	return mustach_cJSON_file_partial(template, length, root, flags, NULL, NULL, file);
+}
+
+int mustach_cJSON_file_partial(const char *template, size_t length, cJSON *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_file(template, length, &mustach_cJSON_wrap_itf, &e, flags, file);
+	return mustach_wrap_file_partial(template, length, &mustach_cJSON_wrap_itf, &e, flags, partialcb, partialclosure, file);
 }
 
 int mustach_cJSON_fd(const char *template, size_t length, cJSON *root, int flags, int fd)
+{
+	return mustach_cJSON_fd_partial(template, length, root, flags, NULL, NULL, fd);
+}
+
+int mustach_cJSON_fd_partial(const char *template, size_t length, cJSON *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_fd(template, length, &mustach_cJSON_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd_partial(template, length, &mustach_cJSON_wrap_itf, &e, flags, partialcb, partialclosure, fd);
 }
 
 int mustach_cJSON_mem(const char *template, size_t length, cJSON *root, int flags, char **result, size_t *size)
+{
+	return mustach_cJSON_mem_partial(template, length, root, flags, NULL, NULL, result, size);
+}
+
+int mustach_cJSON_mem_partial(const char *template, size_t length, cJSON *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_mem(template, length, &mustach_cJSON_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem_partial(template, length, &mustach_cJSON_wrap_itf, &e, flags, partialcb, partialclosure, result, size);
 }
 
 int mustach_cJSON_write(const char *template, size_t length, cJSON *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_cJSON_write_partial(template, length, root, flags, NULL, NULL, writecb, closure);
+}
+
+int mustach_cJSON_write_partial(const char *template, size_t length, cJSON *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_write(template, length, &mustach_cJSON_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write_partial(template, length, &mustach_cJSON_wrap_itf, &e, flags, partialcb, partialclosure, writecb, closure);
 }
 
 int mustach_cJSON_emit(const char *template, size_t length, cJSON *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_cJSON_emit_partial(template, length, root, flags, NULL, NULL, emitcb, closure);
+}
+
+int mustach_cJSON_emit_partial(const char *template, size_t length, cJSON *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_emit_partial(template, length, &mustach_cJSON_wrap_itf, &e, flags, partialcb, partialclosure, emitcb, closure);
+}
+
+int mustach_cJSON_compiled_file(const struct mustach_compiled *compiled, cJSON *root, FILE *file)
+{
+	return mustach_cJSON_compiled_file_partial(compiled, root, NULL, NULL, file);
+}
+
+int mustach_cJSON_compiled_file_partial(const struct mustach_compiled *compiled, cJSON *root, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_file_partial(compiled, &mustach_cJSON_wrap_itf, &e, partialcb, partialclosure, file);
+}
+
+int mustach_cJSON_compiled_fd(const struct mustach_compiled *compiled, cJSON *root, int fd)
+{
+	return mustach_cJSON_compiled_fd_partial(compiled, root, NULL, NULL, fd);
+}
+
+int mustach_cJSON_compiled_fd_partial(const struct mustach_compiled *compiled, cJSON *root, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_fd_partial(compiled, &mustach_cJSON_wrap_itf, &e, partialcb, partialclosure, fd);
+}
+
+int mustach_cJSON_compiled_mem(const struct mustach_compiled *compiled, cJSON *root, char **result, size_t *size)
+{
+	return mustach_cJSON_compiled_mem_partial(compiled, root, NULL, NULL, result, size);
+}
+
+int mustach_cJSON_compiled_mem_partial(const struct mustach_compiled *compiled, cJSON *root, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_emit(template, length, &mustach_cJSON_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_compiled_mem_partial(compiled, &mustach_cJSON_wrap_itf, &e, partialcb, partialclosure, result, size);
 }
 
+int mustach_cJSON_compiled_write(const struct mustach_compiled *compiled, cJSON *root, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_cJSON_compiled_write_partial(compiled, root, NULL, NULL, writecb, closure);
+}
+
+int mustach_cJSON_compiled_write_partial(const struct mustach_compiled *compiled, cJSON *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_write_partial(compiled, &mustach_cJSON_wrap_itf, &e, partialcb, partialclosure, writecb, closure);
+}
+
+int mustach_cJSON_compiled_emit(const struct mustach_compiled *compiled, cJSON *root, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_cJSON_compiled_emit_partial(compiled, root, NULL, NULL, emitcb, closure);
+}
+
+int mustach_cJSON_compiled_emit_partial(const struct mustach_compiled *compiled, cJSON *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_emit_partial(compiled, &mustach_cJSON_wrap_itf, &e, partialcb, partialclosure, emitcb, closure);
+}
+
+/* closure of the threads of batches */
+struct batch {
+	struct expl e; /* first, the closure of the interface */
+	cJSON *const *roots;
+};
+
+/* sets the root of the render of 'index' */
+static int batch_set(void *closure, size_t index)
+{
+	struct batch *b = closure;
+	b->e.root = b->roots[index];
+	return MUSTACH_OK;
+}
+
+int mustach_cJSON_batch(const struct mustach_compiled *compiled, cJSON *const *roots, size_t count, int threads, struct mustach_batch_output *outputs)
+{
+	return mustach_cJSON_batch_partial(compiled, roots, count, threads, NULL, NULL, outputs);
+}
+
+int mustach_cJSON_batch_partial(const struct mustach_compiled *compiled, cJSON *const *roots, size_t count, int threads, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs)
+{
+	struct batch *batch;
+	int i, rc;
+
+	if (threads < 1 || count == 0)
+		threads = 1;
+	else if ((size_t)threads > count)
+		threads = (int)count;
+	batch = malloc((size_t)threads * sizeof *batch);
+	if (batch == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	for (i = 0 ; i < threads ; i++)
+		batch[i].roots = roots;
+	rc = mustach_wrap_batch_partial(compiled, &mustach_cJSON_wrap_itf, batch, sizeof *batch, threads, batch_set, count, partialcb, partialclosure, outputs);
+	free(batch);
+	return rc;
+}
+
+int mustach_cJSON_render_start(const struct mustach_compiled *compiled, cJSON *root, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	return mustach_cJSON_render_start_partial(compiled, root, NULL, NULL, sinkcb, sinkclosure, result);
+}
+
+int mustach_cJSON_render_start_partial(const struct mustach_compiled *compiled, cJSON *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_render_start_partial(compiled, &mustach_cJSON_wrap_itf, &e, sizeof e, partialcb, partialclosure, sinkcb, sinkclosure, result);
+}
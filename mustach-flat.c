@@ -0,0 +1,2599 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <locale.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mustach.h"
+#include "mustach-wrap.h"
+#include "mustach-flat.h"
+
+#if !defined(FLAT_INDEX_THRESHOLD)
+# define FLAT_INDEX_THRESHOLD 8 /* count of members of objects searched linearly */
+#endif
+
+#if !defined(FLAT_MAX_DEPTH)
+# define FLAT_MAX_DEPTH 2048 /* maximum nesting of arrays and objects */
+#endif
+
+#if !defined(FLAT_STREAM_BUFFER_SIZE)
+# define FLAT_STREAM_BUFFER_SIZE 65536 /* initial size of the input buffer of streams */
+#endif
+
+#if !defined(FLAT_LAZY_SPAN)
+# define FLAT_LAZY_SPAN 4096 /* minimal length of the arrays and objects indexed in lazy documents */
+#endif
+
+#if !defined(FLAT_ARENA_SIZE)
+# define FLAT_ARENA_SIZE 65536 /* size of the chunks of memory of the renders of lazy documents */
+#endif
+
+#if !defined(SEL_MEMO_SIZE)
+# define SEL_MEMO_SIZE 16 /* count of names whose searches are remembered */
+#endif
+
+
+/* no value, used for missing values, behaves as null */
+#define NOVALUE UINT32_MAX
+
+/* no key, for values that are not members of objects */
+#define NOKEY UINT32_MAX
+
+/* selections of streamed documents not yet read (their document is NULL) */
+#define STREAM_ROOT    (UINT32_MAX - 1) /* the root object being read */
+#define STREAM_PENDING (UINT32_MAX - 2) /* the array at the position of the input */
+
+/* selection of a value not read because of an error, its document is NULL */
+#define READ_FAILED    (UINT32_MAX - 3)
+
+/* identification of packed documents */
+#define FLAT_MAGIC   "MUSTFLAT"
+#define FLAT_ORDER   0x01020304u
+#define FLAT_VERSION 1u
+
+enum type {
+	Null,
+	False,
+	True,
+	Integer,
+	Real,
+	String,
+	Array,
+	Object,
+	Lazy    /* value of a lazy document not yet parsed */
+};
+
+/*
+ * A json value. The items of an array or of an object are
+ * the 'count' consecutive values starting at index 'first'.
+ * The strings and numbers refer their text in the pool.
+ * The lazy values refer their text in the source.
+ */
+struct value {
+	uint32_t type;  /* the type of the value */
+	uint32_t key;   /* atom of the key for members of objects */
+	union {
+		struct {
+			uint32_t first;  /* index of the first item */
+			uint32_t count;  /* count of items */
+		} items;
+		struct {
+			uint32_t offset; /* offset of the text in the pool */
+			uint32_t length; /* length of the text */
+		} text;
+		uint64_t extent;     /* length of the text of lazy values */
+	};
+	union {
+		int64_t integer;
+		double real;
+		uint64_t position;   /* offset of the text of lazy values in the source */
+	};
+};
+
+/* an interned key */
+struct key {
+	uint32_t offset; /* offset of the text in the pool */
+	uint32_t length; /* length of the text */
+	uint32_t hash;   /* hash of the text */
+};
+
+/*
+ * Header of packed documents. It is followed by the arrays of values,
+ * keys, keymap, members and by the pool. The packed documents are
+ * the same in memory and in files, where they can be used directly
+ * by mapping them in memory.
+ */
+struct packed {
+	char magic[8];       /* FLAT_MAGIC */
+	uint32_t order;      /* FLAT_ORDER in the byte order of the writer */
+	uint32_t version;    /* FLAT_VERSION */
+	uint32_t nvalues;    /* count of values */
+	uint32_t nkeys;      /* count of keys */
+	uint32_t keymask;    /* count of slots of keymap minus one */
+	uint32_t nslots;     /* count of slots of members or 0 when none */
+	uint64_t npool;      /* size of the pool */
+};
+
+/* an array or an object of the source of lazy documents: its text ranges from begin to end */
+struct span {
+	uint64_t begin;
+	uint64_t end;
+};
+
+/*
+ * The source of a lazy document: the mapped json text and the
+ * spans of its big arrays and objects, sorted, for skipping them
+ * without reading their text.
+ */
+struct source {
+	const char *text;    /* the mapped text */
+	size_t size;         /* size of the text */
+	struct span *spans;  /* the arrays and objects of FLAT_LAZY_SPAN or more */
+	size_t nspans;       /* count of spans */
+	struct value root;   /* the root value, not yet parsed */
+};
+
+/*
+ * A document: its packed data and pointers to its arrays.
+ * The root is the last value.
+ */
+struct mustach_flat {
+	const struct value *values; /* the values */
+	const struct key *keys;     /* the keys by atom */
+	const uint32_t *keymap;     /* atom + 1 of keys by hash */
+	const uint32_t *members;    /* index + 1 of members of big objects by hash */
+	const char *pool;           /* the texts */
+	uint32_t nvalues;           /* count of values */
+	uint32_t keymask;           /* count of slots of keymap minus one */
+	uint32_t membermask;        /* count of slots of members minus one */
+	const struct packed *packed;/* the packed data */
+	size_t size;                /* size of the packed data */
+	int mapped;                 /* is the packed data a mapped file? */
+	struct stream *stream;      /* the input of streamed documents or NULL */
+	const struct source *source;/* the source of the lazy values or NULL */
+	int lazy;                   /* is it a lazy document, owning its source? */
+	struct mustach_flat **parsed;/* for documents of renders, their lazy values parsed, by index */
+};
+
+/* size of the packed data of header 'h' */
+static size_t packed_size(const struct packed *h)
+{
+	return sizeof *h
+	     + (size_t)h->nvalues * sizeof(struct value)
+	     + (size_t)h->nkeys * sizeof(struct key)
+	     + ((size_t)h->keymask + 1) * sizeof(uint32_t)
+	     + (size_t)h->nslots * sizeof(uint32_t)
+	     + (size_t)h->npool;
+}
+
+/* set the pointers of 'flat' to the arrays of the packed data 'h' */
+static void attach(struct mustach_flat *flat, const struct packed *h)
+{
+	flat->packed = h;
+	flat->size = packed_size(h);
+	flat->values = (const struct value*)&h[1];
+	flat->keys = (const struct key*)&flat->values[h->nvalues];
+	flat->keymap = (const uint32_t*)&flat->keys[h->nkeys];
+	flat->members = &flat->keymap[h->keymask + 1];
+	flat->pool = (const char*)&flat->members[h->nslots];
+	flat->nvalues = h->nvalues;
+	flat->keymask = h->keymask;
+	flat->membermask = h->nslots ? h->nslots - 1 : 0;
+}
+
+/* slot for the member of 'atom' of hash 'hash' in the object at 'index' */
+static inline uint32_t hash_member(uint32_t index, uint32_t hash)
+{
+	return hash ^ (index * 0x9E3779B1u);
+}
+
+/* returns the atom of the key 'name' or NOKEY if no value has such key */
+static uint32_t find_key(const struct mustach_flat *flat, const struct mustach_wrap_atom *name)
+{
+	uint32_t i = name->hash, atom;
+	const struct key *key;
+
+	while ((atom = flat->keymap[i & flat->keymask]) != 0) {
+		key = &flat->keys[atom - 1];
+		if (key->length == name->length && !memcmp(&flat->pool[key->offset], name->name, name->length))
+			return atom - 1;
+		i++;
+	}
+	return NOKEY;
+}
+
+/* returns the index of the member of key 'atom' in the value at 'index' or NOVALUE */
+static uint32_t find_member(const struct mustach_flat *flat, uint32_t index, uint32_t atom)
+{
+	const struct value *v;
+	uint32_t i, n, m;
+
+	if (index == NOVALUE || atom == NOKEY)
+		return NOVALUE;
+	v = &flat->values[index];
+	if (v->type != Object)
+		return NOVALUE;
+
+	/* linear search of small objects */
+	n = v->items.count;
+	if (n <= FLAT_INDEX_THRESHOLD) {
+		for (i = v->items.first, n += i ; i < n ; i++)
+			if (flat->values[i].key == atom)
+				return i;
+		return NOVALUE;
+	}
+
+	/* search using the hash for big objects */
+	i = hash_member(index, flat->keys[atom].hash);
+	while ((m = flat->members[i & flat->membermask]) != 0) {
+		m--;
+		if (flat->values[m].key == atom && m - v->items.first < n)
+			return m;
+		i++;
+	}
+	return NOVALUE;
+}
+
+/* index of the root value of the document 'flat' */
+static inline uint32_t root_of(const struct mustach_flat *flat)
+{
+	return flat->nvalues - 1;
+}
+
+/******************************************************************************/
+/*** PARSING                                                                ***/
+/******************************************************************************/
+
+/* an array or an object being parsed */
+struct open {
+	uint32_t type;  /* Array or Object */
+	uint32_t key;   /* atom of its key */
+	size_t base;    /* index of its first item in the stack */
+};
+
+/* state of the parser */
+struct parser {
+	const char *text;     /* start of the text */
+	const char *pos;      /* current position */
+	const char *end;      /* end of the text */
+	const struct source *source; /* source of lazy parsing or NULL */
+
+	struct value *stack;  /* values of arrays and objects being parsed */
+	size_t nstack, astack;
+
+	struct value *values; /* values of the document */
+	size_t nvalues, avalues;
+
+	struct key *keys;     /* interned keys */
+	size_t nkeys, akeys;
+
+	uint32_t *keymap;     /* atom + 1 of keys by hash */
+	size_t keymask;
+
+	struct open *opens;   /* arrays and objects being parsed */
+	size_t nopens, aopens;
+
+	char *pool;           /* texts */
+	size_t npool, apool;
+
+	struct {
+		uint32_t stamp;   /* stamp of the object having the key */
+		uint32_t pos;     /* position of the key in the object */
+	} *seen;              /* for detecting duplicated keys, by atom */
+	size_t aseen;
+	uint32_t stamp;       /* stamp of the last closed object */
+
+	size_t nmembers;      /* count of members of big objects */
+};
+
+/* grows the array '*ptr' of '*alloc' elements of 'size' for holding 'count' elements */
+static int grow(void *ptr, size_t *alloc, size_t count, size_t size)
+{
+	size_t n = *alloc;
+	void *p;
+
+	if (n == 0)
+		n = 16;
+	while (n < count)
+		n *= 2;
+	if (n > UINT32_MAX || n > SIZE_MAX / size) {
+		errno = EFBIG;
+		return -1;
+	}
+	p = realloc(*(void**)ptr, n * size);
+	if (p == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	*(void**)ptr = p;
+	*alloc = n;
+	return 0;
+}
+
+/* ensure that the array '*ptr' of '*alloc' elements of 'size' can hold 'count' elements */
+static inline int reserve(void *ptr, size_t *alloc, size_t count, size_t size)
+{
+	return count <= *alloc ? 0 : grow(ptr, alloc, count, size);
+}
+
+/* a chunk of memory of an arena */
+struct chunk {
+	struct chunk *next;   /* the previous chunk */
+	size_t size;          /* size of the data */
+	char data[];
+};
+
+/* memory allocated by chunks and released at once */
+struct arena {
+	struct chunk *chunks; /* the chunks, the first is the current one */
+	size_t used;          /* size used in the current chunk */
+};
+
+/* allocates 'size' bytes aligned for doubles in the 'arena' */
+static void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct chunk *c = arena->chunks;
+	size_t n;
+
+	size = (size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+	if (c != NULL && c->size - arena->used >= size) {
+		arena->used += size;
+		return &c->data[arena->used - size];
+	}
+	n = size > FLAT_ARENA_SIZE / 4 ? size : FLAT_ARENA_SIZE;
+	c = malloc(sizeof *c + n);
+	if (c == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	c->size = n;
+	if (n != size || arena->chunks == NULL) {
+		/* new current chunk */
+		c->next = arena->chunks;
+		arena->chunks = c;
+		arena->used = size;
+	}
+	else {
+		/* big allocations keep the current chunk */
+		c->next = arena->chunks->next;
+		arena->chunks->next = c;
+	}
+	return c->data;
+}
+
+/* releases the memory of the 'arena' */
+static void arena_free(struct arena *arena)
+{
+	struct chunk *c;
+
+	while ((c = arena->chunks) != NULL) {
+		arena->chunks = c->next;
+		free(c);
+	}
+	arena->used = 0;
+}
+
+static inline int is_space(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline void skip_spaces(struct parser *p)
+{
+	while (p->pos != p->end && is_space(*p->pos))
+		p->pos++;
+}
+
+static int syntax_error(struct parser *p)
+{
+	(void)p;
+	errno = EINVAL;
+	return -1;
+}
+
+/* appends 'length' bytes of 'text' to the pool */
+static int pool_append(struct parser *p, const char *text, size_t length)
+{
+	if (reserve(&p->pool, &p->apool, p->npool + length + 1, 1) < 0)
+		return -1;
+	memcpy(&p->pool[p->npool], text, length);
+	p->npool += length;
+	return 0;
+}
+
+/* read 4 hexadecimal digits at 'text' */
+static int hex4(const char *text, unsigned *result)
+{
+	unsigned r = 0, i;
+	char c;
+
+	for (i = 0 ; i < 4 ; i++) {
+		c = text[i];
+		if (c >= '0' && c <= '9')
+			r = (r << 4) | (unsigned)(c - '0');
+		else if (c >= 'a' && c <= 'f')
+			r = (r << 4) | (unsigned)(c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			r = (r << 4) | (unsigned)(c - 'A' + 10);
+		else
+			return 0;
+	}
+	*result = r;
+	return 1;
+}
+
+/* parses the string at current position in the pool, its text starts at 'offset' */
+static int parse_string(struct parser *p, size_t *offset, size_t *length)
+{
+	const char *s = p->pos + 1, *run;
+	unsigned u, l;
+	char utf8[4];
+	size_t n;
+	char c;
+
+	*offset = p->npool;
+	for (;;) {
+		/* copy the run of plain characters */
+		for (run = s ; s != p->end && *s != '"' && *s != '\\' && (unsigned char)*s >= ' ' ; s++);
+		if (s != run && pool_append(p, run, (size_t)(s - run)) < 0)
+			return -1;
+		if (s == p->end || *s != '\\')
+			break;
+
+		/* escaped character */
+		if (++s == p->end)
+			break;
+		c = *s++;
+		switch (c) {
+		case '"': case '\\': case '/': break;
+		case 'b': c = '\b'; break;
+		case 'f': c = '\f'; break;
+		case 'n': c = '\n'; break;
+		case 'r': c = '\r'; break;
+		case 't': c = '\t'; break;
+		case 'u':
+			if (p->end - s < 4 || !hex4(s, &u))
+				goto error;
+			s += 4;
+			if (u >= 0xd800 && u < 0xdc00) {
+				/* surrogate pair */
+				if (p->end - s < 6 || s[0] != '\\' || s[1] != 'u' || !hex4(&s[2], &l)
+				 || l < 0xdc00 || l >= 0xe000)
+					goto error;
+				s += 6;
+				u = 0x10000 + ((u - 0xd800) << 10) + (l - 0xdc00);
+			}
+			else if (u >= 0xdc00 && u < 0xe000)
+				goto error;
+			if (u < 0x80) {
+				utf8[0] = (char)u;
+				n = 1;
+			}
+			else if (u < 0x800) {
+				utf8[0] = (char)(0xc0 | (u >> 6));
+				utf8[1] = (char)(0x80 | (u & 0x3f));
+				n = 2;
+			}
+			else if (u < 0x10000) {
+				utf8[0] = (char)(0xe0 | (u >> 12));
+				utf8[1] = (char)(0x80 | ((u >> 6) & 0x3f));
+				utf8[2] = (char)(0x80 | (u & 0x3f));
+				n = 3;
+			}
+			else {
+				utf8[0] = (char)(0xf0 | (u >> 18));
+				utf8[1] = (char)(0x80 | ((u >> 12) & 0x3f));
+				utf8[2] = (char)(0x80 | ((u >> 6) & 0x3f));
+				utf8[3] = (char)(0x80 | (u & 0x3f));
+				n = 4;
+			}
+			if (pool_append(p, utf8, n) < 0)
+				return -1;
+			continue;
+		default:
+			goto error;
+		}
+		if (pool_append(p, &c, 1) < 0)
+			return -1;
+	}
+	if (s == p->end || *s != '"')
+		goto error;
+	p->pos = s + 1;
+	*length = p->npool - *offset;
+	if (reserve(&p->pool, &p->apool, p->npool + 1, 1) < 0)
+		return -1;
+	p->pool[p->npool++] = 0;
+	return 0;
+
+error:
+	p->pos = s;
+	return syntax_error(p);
+}
+
+/* parses the key at current position and returns its atom in 'atom' */
+static int parse_key(struct parser *p, uint32_t *atom)
+{
+	size_t offset, length, i;
+	uint32_t hash, a;
+	struct key *key;
+	uint32_t *keymap;
+
+	if (p->pos == p->end || *p->pos != '"')
+		return syntax_error(p);
+	if (parse_string(p, &offset, &length) < 0)
+		return -1;
+
+	/* search the key */
+	hash = mustach_wrap_hash(&p->pool[offset], length);
+	for (i = hash ; (a = p->keymap[i & p->keymask]) != 0 ; i++) {
+		key = &p->keys[a - 1];
+		if (key->length == length && !memcmp(&p->pool[key->offset], &p->pool[offset], length)) {
+			/* known key, forget its copy */
+			p->npool = offset;
+			*atom = a - 1;
+			return 0;
+		}
+	}
+
+	/* record the new key */
+	if (reserve(&p->keys, &p->akeys, p->nkeys + 1, sizeof *p->keys) < 0)
+		return -1;
+	key = &p->keys[p->nkeys];
+	key->offset = (uint32_t)offset;
+	key->length = (uint32_t)length;
+	key->hash = hash;
+	*atom = (uint32_t)p->nkeys++;
+	p->keymap[i & p->keymask] = *atom + 1;
+
+	/* keep the keymap at most half full */
+	if (2 * p->nkeys > p->keymask) {
+		keymap = calloc(2 * (p->keymask + 1), sizeof *keymap);
+		if (keymap == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		p->keymask = 2 * p->keymask + 1;
+		for (a = 0 ; a < p->nkeys ; a++) {
+			for (i = p->keys[a].hash ; keymap[i & p->keymask] != 0 ; i++);
+			keymap[i & p->keymask] = a + 1;
+		}
+		free(p->keymap);
+		p->keymap = keymap;
+	}
+	return 0;
+}
+
+/* parses the number at current position in 'value' */
+static int parse_number(struct parser *p, struct value *value)
+{
+	const char *s = p->pos, *start = s, *point;
+	int integer = 1, negative = 0;
+	uint64_t u = 0;
+	size_t offset, length;
+	char *text, *dot;
+
+	if (s != p->end && *s == '-') {
+		negative = 1;
+		s++;
+	}
+	if (s == p->end || *s < '0' || *s > '9')
+		goto error;
+	if (*s == '0')
+		s++;
+	else
+		for ( ; s != p->end && *s >= '0' && *s <= '9' ; s++) {
+			if (u > (UINT64_MAX - 9) / 10)
+				integer = 0;
+			u = u * 10 + (uint64_t)(*s - '0');
+		}
+	if (s != p->end && *s == '.') {
+		integer = 0;
+		if (++s == p->end || *s < '0' || *s > '9')
+			goto error;
+		while (s != p->end && *s >= '0' && *s <= '9')
+			s++;
+	}
+	if (s != p->end && (*s == 'e' || *s == 'E')) {
+		integer = 0;
+		if (++s != p->end && (*s == '+' || *s == '-'))
+			s++;
+		if (s == p->end || *s < '0' || *s > '9')
+			goto error;
+		while (s != p->end && *s >= '0' && *s <= '9')
+			s++;
+	}
+	p->pos = s;
+
+	/* record the text */
+	offset = p->npool;
+	length = (size_t)(s - start);
+	if (pool_append(p, start, length) < 0)
+		return -1;
+	p->pool[p->npool++] = 0;
+	value->text.offset = (uint32_t)offset;
+	value->text.length = (uint32_t)length;
+
+	/* compute the value */
+	if (integer && u <= (uint64_t)INT64_MAX + (uint64_t)negative) {
+		value->type = Integer;
+		value->integer = negative ? (int64_t)(0 - u) : (int64_t)u;
+	}
+	else {
+		value->type = Real;
+		text = &p->pool[offset];
+		point = localeconv()->decimal_point;
+		dot = *point != '.' && point[1] == 0 ? strchr(text, '.') : NULL;
+		if (dot != NULL)
+			*dot = *point;
+		value->real = strtod(text, NULL);
+		if (dot != NULL)
+			*dot = '.';
+	}
+	return 0;
+
+error:
+	p->pos = s;
+	return syntax_error(p);
+}
+
+/* parses the literal 'word' of 'length' at current position */
+static int parse_word(struct parser *p, const char *word, size_t length)
+{
+	if ((size_t)(p->end - p->pos) < length || memcmp(p->pos, word, length))
+		return syntax_error(p);
+	p->pos += length;
+	return 0;
+}
+
+/* skips the array or object at current position of lazy parsing, recorded in 'value' */
+static int parse_lazy(struct parser *p, struct value *value)
+{
+	const struct source *src = p->source;
+	const char *s = p->pos;
+	uint64_t begin = (uint64_t)(s - src->text);
+	size_t low = 0, high = src->nspans, mid;
+	unsigned depth = 0;
+	char c;
+
+	/* big arrays and objects are skipped using their span */
+	while (low < high) {
+		mid = (low + high) >> 1;
+		if (src->spans[mid].begin < begin)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < src->nspans && src->spans[low].begin == begin)
+		s = &src->text[src->spans[low].end];
+	else {
+		/* the small ones are scanned, their syntax is checked when parsed */
+		do {
+			if (s == p->end)
+				return syntax_error(p);
+			c = *s++;
+			if (c == '[' || c == '{')
+				depth++;
+			else if (c == ']' || c == '}')
+				depth--;
+			else if (c == '"') {
+				while (s != p->end && *s != '"')
+					if (*s++ == '\\' && s != p->end)
+						s++;
+				if (s == p->end)
+					return syntax_error(p);
+				s++;
+			}
+		} while (depth);
+	}
+	p->pos = s;
+	value->type = Lazy;
+	value->extent = (uint64_t)(s - src->text) - begin;
+	value->position = begin;
+	return 0;
+}
+
+/* closes the array or object lastly opened */
+static int close_open(struct parser *p)
+{
+	struct open *open = &p->opens[--p->nopens];
+	struct value *items = &p->stack[open->base], *value;
+	size_t i, j, count = p->nstack - open->base, aseen;
+	uint32_t atom;
+
+	/* for objects, the last value of a key replaces the previous ones */
+	if (open->type == Object && count > 1) {
+		aseen = p->aseen;
+		if (reserve(&p->seen, &p->aseen, p->nkeys, sizeof *p->seen) < 0)
+			return -1;
+		if (++p->stamp == 0) {
+			aseen = 0;
+			p->stamp = 1;
+		}
+		memset(&p->seen[aseen], 0, (p->aseen - aseen) * sizeof *p->seen);
+		for (i = j = 0 ; i < count ; i++) {
+			atom = items[i].key;
+			if (p->seen[atom].stamp == p->stamp)
+				items[p->seen[atom].pos] = items[i];
+			else {
+				p->seen[atom].stamp = p->stamp;
+				p->seen[atom].pos = (uint32_t)j;
+				items[j++] = items[i];
+			}
+		}
+		count = j;
+	}
+	if (open->type == Object && count > FLAT_INDEX_THRESHOLD)
+		p->nmembers += count;
+
+	/* move the items to the values */
+	if (reserve(&p->values, &p->avalues, p->nvalues + count + 1, sizeof *p->values) < 0)
+		return -1;
+	memcpy(&p->values[p->nvalues], items, count * sizeof *items);
+
+	/* replace the items by the closed value */
+	p->nstack = open->base + 1;
+	value = &p->stack[open->base];
+	value->type = open->type;
+	value->key = open->key;
+	value->items.first = (uint32_t)p->nvalues;
+	value->items.count = (uint32_t)count;
+	value->integer = 0;
+	p->nvalues += count;
+	return 0;
+}
+
+/* parses the text of the parser */
+static int parse(struct parser *p)
+{
+	struct value *value;
+	struct open *open;
+	uint32_t key = NOKEY;
+	char c;
+
+	if (p->keymap != NULL)
+		memset(p->keymap, 0, (p->keymask + 1) * sizeof *p->keymap);
+	else {
+		p->keymap = calloc(16, sizeof *p->keymap);
+		if (p->keymap == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		p->keymask = 15;
+	}
+
+	for (;;) {
+		/* parse a value */
+		skip_spaces(p);
+		if (p->pos == p->end)
+			return syntax_error(p);
+		c = *p->pos;
+		if ((c == '[' || c == '{') && (p->source == NULL || p->nopens == 0)) {
+			/* open an array or an object */
+			if (p->nopens >= FLAT_MAX_DEPTH)
+				return syntax_error(p);
+			if (reserve(&p->opens, &p->aopens, p->nopens + 1, sizeof *p->opens) < 0)
+				return -1;
+			open = &p->opens[p->nopens++];
+			open->type = c == '[' ? Array : Object;
+			open->key = key;
+			open->base = p->nstack;
+			p->pos++;
+			skip_spaces(p);
+			if (p->pos != p->end && *p->pos == (c == '[' ? ']' : '}')) {
+				p->pos++;
+				if (reserve(&p->stack, &p->astack, p->nstack + 1, sizeof *p->stack) < 0)
+					return -1;
+				if (close_open(p) < 0)
+					return -1;
+			}
+			else {
+				if (open->type == Object) {
+					if (parse_key(p, &key) < 0)
+						return -1;
+					skip_spaces(p);
+					if (p->pos == p->end || *p->pos != ':')
+						return syntax_error(p);
+					p->pos++;
+				}
+				else
+					key = NOKEY;
+				continue;
+			}
+		}
+		else {
+			/* scalar value */
+			if (reserve(&p->stack, &p->astack, p->nstack + 1, sizeof *p->stack) < 0)
+				return -1;
+			value = &p->stack[p->nstack];
+			value->key = key;
+			value->integer = 0;
+			value->text.offset = 0;
+			value->text.length = 0;
+			switch (c) {
+			case '"':
+				{
+					size_t offset, length;
+					if (parse_string(p, &offset, &length) < 0)
+						return -1;
+					value->type = String;
+					value->text.offset = (uint32_t)offset;
+					value->text.length = (uint32_t)length;
+				}
+				break;
+			case 't':
+				value->type = True;
+				if (parse_word(p, "true", 4) < 0)
+					return -1;
+				break;
+			case 'f':
+				value->type = False;
+				if (parse_word(p, "false", 5) < 0)
+					return -1;
+				break;
+			case 'n':
+				value->type = Null;
+				if (parse_word(p, "null", 4) < 0)
+					return -1;
+				break;
+			case '[':
+			case '{':
+				if (parse_lazy(p, value) < 0)
+					return -1;
+				break;
+			default:
+				if (parse_number(p, value) < 0)
+					return -1;
+				break;
+			}
+			p->nstack++;
+		}
+
+		/* after a value, close or continue the arrays and objects */
+		for (;;) {
+			if (p->nopens == 0) {
+				/* end of the root */
+				skip_spaces(p);
+				if (p->pos != p->end)
+					return syntax_error(p);
+				if (reserve(&p->values, &p->avalues, p->nvalues + 1, sizeof *p->values) < 0)
+					return -1;
+				p->values[p->nvalues++] = p->stack[0];
+				return 0;
+			}
+			open = &p->opens[p->nopens - 1];
+			skip_spaces(p);
+			if (p->pos == p->end)
+				return syntax_error(p);
+			c = *p->pos++;
+			if (c == ',')
+				break;
+			if (c != (open->type == Array ? ']' : '}'))
+				return syntax_error(p);
+			if (close_open(p) < 0)
+				return -1;
+		}
+
+		/* next item */
+		if (open->type == Object) {
+			skip_spaces(p);
+			if (parse_key(p, &key) < 0)
+				return -1;
+			skip_spaces(p);
+			if (p->pos == p->end || *p->pos != ':')
+				return syntax_error(p);
+			p->pos++;
+		}
+		else
+			key = NOKEY;
+	}
+}
+
+/* makes the document of the successful parser 'p' in one block, allocated in 'arena' if not NULL */
+static struct mustach_flat *make_flat(struct parser *p, struct arena *arena)
+{
+	struct mustach_flat *flat;
+	struct packed *h;
+	size_t soffset, membermask, i, j, n;
+	struct value *values;
+	struct key *keys;
+	uint32_t *keymap, *members, hash;
+	char *pool;
+
+	/* compute the count of slots for using at most 2/3 of them */
+	membermask = p->nmembers + (p->nmembers >> 1);
+	for (i = 1 ; i < 8 * sizeof membermask ; i <<= 1)
+		membermask |= membermask >> i;
+
+	/* allocate the document followed by its packed data */
+	soffset = (sizeof *flat + sizeof(double) - 1) & ~(sizeof(double) - 1);
+	h = &(struct packed){
+		.magic = FLAT_MAGIC,
+		.order = FLAT_ORDER,
+		.version = FLAT_VERSION,
+		.nvalues = (uint32_t)p->nvalues,
+		.nkeys = (uint32_t)p->nkeys,
+		.keymask = (uint32_t)p->keymask,
+		.nslots = p->nmembers ? (uint32_t)membermask + 1 : 0,
+		.npool = p->npool
+	};
+	flat = arena != NULL ? arena_alloc(arena, soffset + packed_size(h)) : malloc(soffset + packed_size(h));
+	if (flat == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy((char*)flat + soffset, h, sizeof *h);
+	attach(flat, (struct packed*)((char*)flat + soffset));
+	flat->mapped = 0;
+	flat->stream = NULL;
+	flat->source = p->source;
+	flat->lazy = 0;
+	flat->parsed = NULL;
+
+	/* fill it */
+	values = (struct value*)flat->values;
+	keys = (struct key*)flat->keys;
+	keymap = (uint32_t*)flat->keymap;
+	members = (uint32_t*)flat->members;
+	pool = (char*)flat->pool;
+	memcpy(values, p->values, p->nvalues * sizeof *values);
+	if (p->nkeys)
+		memcpy(keys, p->keys, p->nkeys * sizeof *keys);
+	memcpy(keymap, p->keymap, (p->keymask + 1) * sizeof *keymap);
+	if (p->npool)
+		memcpy(pool, p->pool, p->npool);
+
+	/* index the members of big objects */
+	if (p->nmembers) {
+		memset(members, 0, (membermask + 1) * sizeof *members);
+		for (i = 0 ; i < p->nvalues ; i++)
+			if (values[i].type == Object && values[i].items.count > FLAT_INDEX_THRESHOLD)
+				for (j = values[i].items.first, n = j + values[i].items.count ; j < n ; j++) {
+					for (hash = hash_member((uint32_t)i, keys[values[j].key].hash) ; members[hash & membermask] != 0 ; hash++);
+					members[hash & membermask] = (uint32_t)j + 1;
+				}
+	}
+	return flat;
+}
+
+/*
+ * prepares the parser 'p' for parsing the 'text' of 'length', keeping its
+ * arrays. For lazy parsing, the text is in 'source' and its nested arrays
+ * and objects are not parsed.
+ */
+static void parser_reset(struct parser *p, const char *text, size_t length, const struct source *source)
+{
+	p->text = p->pos = text;
+	p->end = &text[length];
+	p->source = source;
+	p->nstack = 0;
+	p->nvalues = 0;
+	p->nkeys = 0;
+	p->nopens = 0;
+	p->npool = 0;
+	p->nmembers = 0;
+
+	/* the keymap restarts small, it is copied in the document */
+	if (p->keymask > 15) {
+		free(p->keymap);
+		p->keymap = NULL;
+	}
+}
+
+/* releases the arrays of the parser 'p' */
+static void parser_release(struct parser *p)
+{
+	free(p->stack);
+	free(p->values);
+	free(p->keys);
+	free(p->keymap);
+	free(p->opens);
+	free(p->pool);
+	free(p->seen);
+}
+
+/* parses the 'text' of 'length' in 'result', lazily when 'source' isn't NULL */
+static int parse_flat(const char *text, size_t length, const struct source *source, struct mustach_flat **result, size_t *errpos)
+{
+	struct parser p;
+	int rc;
+
+	memset(&p, 0, sizeof p);
+	parser_reset(&p, text, length, source);
+	rc = parse(&p);
+	if (rc == 0) {
+		*result = make_flat(&p, NULL);
+		if (*result == NULL)
+			rc = -1;
+	}
+	else if (errpos != NULL)
+		*errpos = (size_t)(p.pos - p.text);
+	parser_release(&p);
+	return rc;
+}
+
+int mustach_flat_parse(const char *text, size_t length, struct mustach_flat **result, size_t *errpos)
+{
+	if (length == 0)
+		length = strlen(text);
+	return parse_flat(text, length, NULL, result, errpos);
+}
+
+int mustach_flat_save(const struct mustach_flat *flat, const char *filename)
+{
+	FILE *file;
+	int rc;
+
+	if (flat->stream != NULL || flat->lazy) {
+		errno = EINVAL;
+		return -1;
+	}
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		return -1;
+	rc = fwrite(flat->packed, flat->size, 1, file) == 1 ? 0 : -1;
+	if (fclose(file) != 0)
+		rc = -1;
+	return rc;
+}
+
+int mustach_flat_map(const char *filename, struct mustach_flat **result)
+{
+	struct mustach_flat *flat;
+	const struct packed *h;
+	struct stat st;
+	void *map;
+	int fd;
+
+	/* map the file */
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (!S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof *h) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	/* check it, only its header is read */
+	h = map;
+	if (memcmp(h->magic, FLAT_MAGIC, sizeof h->magic)
+	 || h->order != FLAT_ORDER
+	 || h->version != FLAT_VERSION
+	 || h->nvalues == 0
+	 || (h->keymask & (h->keymask + 1)) != 0
+	 || (h->nslots & (h->nslots - 1)) != 0
+	 || h->npool > (uint64_t)st.st_size
+	 || packed_size(h) != (size_t)st.st_size) {
+		munmap(map, (size_t)st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* make the document */
+	flat = malloc(sizeof *flat);
+	if (flat == NULL) {
+		munmap(map, (size_t)st.st_size);
+		errno = ENOMEM;
+		return -1;
+	}
+	attach(flat, h);
+	flat->mapped = 1;
+	flat->stream = NULL;
+	flat->source = NULL;
+	flat->lazy = 0;
+	flat->parsed = NULL;
+	*result = flat;
+	return 0;
+}
+
+static void stream_free(struct stream *s);
+static void source_free(const struct source *src);
+
+void mustach_flat_free(struct mustach_flat *flat)
+{
+	if (flat != NULL) {
+		if (flat->mapped)
+			munmap((void*)flat->packed, flat->size);
+		stream_free(flat->stream);
+		if (flat->lazy)
+			source_free(flat->source);
+	}
+	free(flat);
+}
+
+/******************************************************************************/
+/*** JSON TEXTS                                                             ***/
+/******************************************************************************/
+
+/* text of serialized arrays and objects, recycled after use */
+struct serial {
+	size_t size;
+	char text[];
+};
+
+/* appends 'text' of 'length' to the 'serial' having 'used' bytes */
+static int append(struct serial **serial, size_t *used, const char *text, size_t length)
+{
+	struct serial *s = *serial;
+	size_t size = s == NULL ? 256 : s->size;
+
+	if (s == NULL || *used + length >= size) {
+		while (*used + length >= size)
+			size *= 2;
+		s = realloc(s, sizeof *s + size);
+		if (s == NULL)
+			return -1;
+		s->size = size;
+		*serial = s;
+	}
+	memcpy(&s->text[*used], text, length);
+	*used += length;
+	return 0;
+}
+
+/* appends the json string of 'text' of 'length' to the 'serial' having 'used' bytes */
+static int append_string(struct serial **serial, size_t *used, const char *text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6];
+	size_t run, escl;
+	unsigned char c;
+
+	if (append(serial, used, "\"", 1) < 0)
+		return -1;
+	while (length) {
+		/* copy the run of characters not escaped */
+		for (run = 0 ; run < length ; run++) {
+			c = (unsigned char)text[run];
+			if (c < ' ' || c == '"' || c == '\\' || c == '/')
+				break;
+		}
+		if (run && append(serial, used, text, run) < 0)
+			return -1;
+		if (run == length)
+			break;
+
+		/* escape the character */
+		c = (unsigned char)text[run];
+		esc[0] = '\\';
+		escl = 2;
+		switch (c) {
+		case '\b': esc[1] = 'b'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		case '\f': esc[1] = 'f'; break;
+		case '"':
+		case '\\':
+		case '/': esc[1] = (char)c; break;
+		default:
+			memcpy(&esc[1], "u00", 3);
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 15];
+			escl = 6;
+			break;
+		}
+		if (append(serial, used, esc, escl) < 0)
+			return -1;
+		text += run + 1;
+		length -= run + 1;
+	}
+	return append(serial, used, "\"", 1);
+}
+
+/* appends the json text of the value at 'index' of 'flat' to the 'serial' having 'used' bytes */
+static int append_json(struct serial **serial, size_t *used, const struct mustach_flat *flat, uint32_t index)
+{
+	const struct value *v = &flat->values[index];
+	const struct key *key;
+	struct mustach_flat *sub;
+	uint32_t i, n;
+	int rc;
+
+	switch (v->type) {
+	case False:
+		return append(serial, used, "false", 5);
+	case True:
+		return append(serial, used, "true", 4);
+	case Integer:
+	case Real:
+		return append(serial, used, &flat->pool[v->text.offset], v->text.length);
+	case String:
+		return append_string(serial, used, &flat->pool[v->text.offset], v->text.length);
+	case Array:
+		if (append(serial, used, "[", 1) < 0)
+			return -1;
+		for (i = v->items.first, n = i + v->items.count ; i < n ; i++)
+			if ((i != v->items.first && append(serial, used, ",", 1) < 0)
+			 || append_json(serial, used, flat, i) < 0)
+				return -1;
+		return append(serial, used, "]", 1);
+	case Object:
+		if (append(serial, used, "{", 1) < 0)
+			return -1;
+		for (i = v->items.first, n = i + v->items.count ; i < n ; i++) {
+			key = &flat->keys[flat->values[i].key];
+			if ((i != v->items.first && append(serial, used, ",", 1) < 0)
+			 || append_string(serial, used, &flat->pool[key->offset], key->length) < 0
+			 || append(serial, used, ":", 1) < 0
+			 || append_json(serial, used, flat, i) < 0)
+				return -1;
+		}
+		return append(serial, used, "}", 1);
+	case Lazy:
+		/* the text of lazy values is fully parsed for its serialization */
+		if (parse_flat(&flat->source->text[v->position], (size_t)v->extent, NULL, &sub, NULL) < 0)
+			return -1;
+		rc = append_json(serial, used, sub, root_of(sub));
+		mustach_flat_free(sub);
+		return rc;
+	default:
+		return append(serial, used, "null", 4);
+	}
+}
+
+/******************************************************************************/
+/*** STREAMING                                                              ***/
+/******************************************************************************/
+
+/* position of the input of a streamed document */
+enum state {
+	Members,  /* in the root object, before its next member */
+	Pending,  /* at the start of the array of the last member or of the root */
+	Items,    /* in the array being streamed, before its next item */
+	Done      /* after the root */
+};
+
+/* a member of the root object of a streamed document */
+struct member {
+	struct mustach_flat *key;  /* the key, as a string document */
+	struct mustach_flat *doc;  /* the value or NULL when pending */
+	const char *name;          /* text of the key */
+	size_t length;             /* length of the key */
+};
+
+/*
+ * The input of a streamed document. The members of the root object
+ * are read when searched and kept in memory, except the arrays that
+ * are rendered while read, one item at a time.
+ */
+struct stream {
+	int fd;                    /* the input */
+	int eof;                   /* is the end of the input reached? */
+	int error;                 /* errno of the first error or 0 */
+	int array;                 /* is the root an array? */
+	int first;                 /* is the next member or item the first? */
+	enum state state;          /* position in the input */
+	char *buffer;              /* the input */
+	size_t size;               /* size of the buffer */
+	size_t begin;              /* start of the input not consumed */
+	size_t end;                /* end of the input read */
+	struct member *members;    /* members of the root object read */
+	size_t nmembers, amembers;
+	struct mustach_flat *item; /* the current item of the streamed array */
+	struct mustach_flat *root; /* the root, when fully read */
+};
+
+/* records the error 'code' of the stream 's' and returns -1 */
+static int stream_error(struct stream *s, int code)
+{
+	if (s->error == 0)
+		s->error = code;
+	s->state = Done;
+	errno = code;
+	return -1;
+}
+
+/* reads more input, returns 1 when read, 0 at end of input, -1 on error */
+static int stream_read(struct stream *s)
+{
+	ssize_t rc;
+
+	if (s->eof)
+		return 0;
+	if (s->begin) {
+		memmove(s->buffer, &s->buffer[s->begin], s->end - s->begin);
+		s->end -= s->begin;
+		s->begin = 0;
+	}
+	if (s->end == s->size && grow(&s->buffer, &s->size, s->size + 1, 1) < 0)
+		return stream_error(s, errno);
+	do
+		rc = read(s->fd, &s->buffer[s->end], s->size - s->end);
+	while (rc < 0 && errno == EINTR);
+	if (rc < 0)
+		return stream_error(s, errno);
+	if (rc == 0) {
+		s->eof = 1;
+		return 0;
+	}
+	s->end += (size_t)rc;
+	return 1;
+}
+
+/* skips spaces and gives the next character in 'c' or EOF, returns 0 or -1 on error */
+static int stream_peek(struct stream *s, int *c)
+{
+	char x;
+	int rc;
+
+	for (;;) {
+		while (s->begin < s->end) {
+			x = s->buffer[s->begin];
+			if (x != ' ' && x != '\t' && x != '\n' && x != '\r') {
+				*c = (unsigned char)x;
+				return 0;
+			}
+			s->begin++;
+		}
+		rc = stream_read(s);
+		if (rc <= 0) {
+			*c = EOF;
+			return rc;
+		}
+	}
+}
+
+/* consumes the character 'c' expected next, returns 0 or -1 on error */
+static int stream_expect(struct stream *s, int c)
+{
+	int x;
+
+	if (stream_peek(s, &x) < 0)
+		return -1;
+	if (x != c)
+		return stream_error(s, EINVAL);
+	s->begin++;
+	return 0;
+}
+
+/* reads the next json value in 'result', returns 0 or -1 on error */
+static int stream_value(struct stream *s, struct mustach_flat **result)
+{
+	size_t i;
+	int c, depth, instring, escaped, rc;
+
+	if (stream_peek(s, &c) < 0)
+		return -1;
+
+	/* search the end of the value, reading more input when needed */
+	depth = instring = escaped = 0;
+	for (i = 0 ; ; i++) {
+		if (s->begin + i == s->end) {
+			rc = stream_read(s);
+			if (rc < 0)
+				return -1;
+			if (rc == 0) {
+				if (depth || instring)
+					return stream_error(s, EINVAL);
+				break;
+			}
+		}
+		c = s->buffer[s->begin + i];
+		if (instring) {
+			if (escaped)
+				escaped = 0;
+			else if (c == '\\')
+				escaped = 1;
+			else if (c == '"' && (instring = 0, depth == 0)) {
+				i++;
+				break;
+			}
+		}
+		else if (c == '"')
+			instring = 1;
+		else if (c == '[' || c == '{')
+			depth++;
+		else if (c == ']' || c == '}') {
+			if (depth == 0)
+				break;
+			if (--depth == 0) {
+				i++;
+				break;
+			}
+		}
+		else if (depth == 0 && (c == ',' || c == ':' || c == ' ' || c == '\t' || c == '\n' || c == '\r'))
+			break;
+	}
+
+	/* parse it */
+	if (i == 0 || mustach_flat_parse(&s->buffer[s->begin], i, result, NULL) < 0)
+		return stream_error(s, i == 0 ? EINVAL : errno);
+	s->begin += i;
+	return 0;
+}
+
+/* checks that nothing follows the root, returns 0 or -1 on error */
+static int stream_done(struct stream *s)
+{
+	int c;
+
+	if (stream_peek(s, &c) < 0)
+		return -1;
+	if (c != EOF)
+		return stream_error(s, EINVAL);
+	s->state = Done;
+	return 0;
+}
+
+/* reads the next member of the root object, returns 1 when read, 0 at its end, -1 on error */
+static int stream_member(struct stream *s)
+{
+	struct member *m;
+	const struct value *v;
+	int c;
+
+	if (stream_peek(s, &c) < 0)
+		return -1;
+	if (c == '}') {
+		s->begin++;
+		return stream_done(s);
+	}
+	if (!s->first) {
+		if (c != ',')
+			return stream_error(s, EINVAL);
+		s->begin++;
+	}
+	s->first = 0;
+
+	/* read the key */
+	if (reserve(&s->members, &s->amembers, s->nmembers + 1, sizeof *s->members) < 0)
+		return stream_error(s, errno);
+	m = &s->members[s->nmembers];
+	m->doc = NULL;
+	if (stream_value(s, &m->key) < 0)
+		return -1;
+	s->nmembers++;
+	v = &m->key->values[root_of(m->key)];
+	if (v->type != String)
+		return stream_error(s, EINVAL);
+	m->name = &m->key->pool[v->text.offset];
+	m->length = v->text.length;
+
+	/* read the value unless it is an array */
+	if (stream_expect(s, ':') < 0 || stream_peek(s, &c) < 0)
+		return -1;
+	if (c == '[')
+		s->state = Pending;
+	else if (stream_value(s, &m->doc) < 0)
+		return -1;
+	return 1;
+}
+
+/* reads the pending array in memory, returns 0 or -1 on error */
+static int stream_pending(struct stream *s)
+{
+	if (s->array) {
+		if (stream_value(s, &s->root) < 0)
+			return -1;
+		return stream_done(s);
+	}
+	if (stream_value(s, &s->members[s->nmembers - 1].doc) < 0)
+		return -1;
+	s->state = Members;
+	return 0;
+}
+
+/* reads the rest of the root and makes it the root document, returns 0 or -1 on error */
+static int stream_all(struct stream *s)
+{
+	struct serial *serial = NULL;
+	size_t used = 0, i;
+	struct member *m;
+	int rc;
+
+	/* read the rest */
+	for (;;) {
+		if (s->state == Pending && stream_pending(s) < 0)
+			return -1;
+		if (s->state != Members)
+			break;
+		if (stream_member(s) < 0)
+			return -1;
+	}
+	if (s->root != NULL)
+		return 0;
+	if (s->state != Done)
+		return stream_error(s, EINVAL);
+
+	/* make the root object from the members */
+	rc = append(&serial, &used, "{", 1);
+	for (i = 0 ; rc == 0 && i < s->nmembers ; i++) {
+		m = &s->members[i];
+		if ((i && append(&serial, &used, ",", 1) < 0)
+		 || append_string(&serial, &used, m->name, m->length) < 0
+		 || append(&serial, &used, ":", 1) < 0)
+			rc = -1;
+		else if (m->doc == NULL)
+			rc = append(&serial, &used, "null", 4);
+		else
+			rc = append_json(&serial, &used, m->doc, root_of(m->doc));
+	}
+	if (rc == 0)
+		rc = append(&serial, &used, "}", 1);
+	if (rc == 0)
+		rc = mustach_flat_parse(serial->text, used, &s->root, NULL);
+	free(serial);
+	return rc < 0 ? stream_error(s, errno) : 0;
+}
+
+/* searches the member 'name' of 'length' of the root object in 'doc' and 'index', returns 0 or -1 on error */
+static int stream_find(struct stream *s, const char *name, size_t length, const struct mustach_flat **doc, uint32_t *index)
+{
+	size_t i;
+	struct member *m;
+	int rc;
+
+	/* search the members already read, the last duplicate wins */
+	for (i = s->nmembers ; i ; ) {
+		m = &s->members[--i];
+		if (m->length == length && !memcmp(m->name, name, length))
+			goto found;
+	}
+
+	/* read the next members until found */
+	for (;;) {
+		if (s->state == Pending && stream_pending(s) < 0)
+			return -1;
+		if (s->state != Members)
+			break;
+		rc = stream_member(s);
+		if (rc <= 0) {
+			if (rc < 0)
+				return -1;
+			break;
+		}
+		m = &s->members[s->nmembers - 1];
+		if (m->length == length && !memcmp(m->name, name, length))
+			goto found;
+	}
+	*index = NOVALUE;
+	return 0;
+
+found:
+	*doc = m->doc;
+	if (m->doc != NULL)
+		*index = root_of(m->doc);
+	else if (s->state == Pending && m == &s->members[s->nmembers - 1])
+		*index = STREAM_PENDING;
+	else
+		*index = NOVALUE;
+	return 0;
+}
+
+/* reads the next item of the streamed array in s->item, returns 1 when read, 0 at its end, -1 on error */
+static int stream_item(struct stream *s)
+{
+	struct mustach_flat *empty;
+	int c;
+
+	mustach_flat_free(s->item);
+	s->item = NULL;
+	if (stream_peek(s, &c) < 0)
+		return -1;
+	if (c != ']') {
+		if (!s->first) {
+			if (c != ',')
+				return stream_error(s, EINVAL);
+			s->begin++;
+		}
+		s->first = 0;
+		return stream_value(s, &s->item) < 0 ? -1 : 1;
+	}
+
+	/* end of the array, it is now seen as empty */
+	s->begin++;
+	if (mustach_flat_parse("[]", 2, &empty, NULL) < 0)
+		return stream_error(s, errno);
+	if (s->array) {
+		s->root = empty;
+		return stream_done(s);
+	}
+	s->members[s->nmembers - 1].doc = empty;
+	s->state = Members;
+	s->first = 0;
+	return 0;
+}
+
+/* starts streaming the pending array, returns 1 when an item is read, 0 if empty, -1 on error */
+static int stream_open(struct stream *s)
+{
+	if (s->state != Pending)
+		return stream_error(s, EINVAL);
+	if (stream_expect(s, '[') < 0)
+		return -1;
+	s->state = Items;
+	s->first = 1;
+	return stream_item(s);
+}
+
+/* releases the stream 's' */
+static void stream_free(struct stream *s)
+{
+	size_t i;
+
+	if (s != NULL) {
+		for (i = 0 ; i < s->nmembers ; i++) {
+			mustach_flat_free(s->members[i].key);
+			mustach_flat_free(s->members[i].doc);
+		}
+		free(s->members);
+		mustach_flat_free(s->item);
+		mustach_flat_free(s->root);
+		free(s->buffer);
+		free(s);
+	}
+}
+
+int mustach_flat_stream(int fd, struct mustach_flat **result)
+{
+	struct mustach_flat *flat;
+	struct stream *s;
+	int c;
+
+	flat = calloc(1, sizeof *flat);
+	s = calloc(1, sizeof *s);
+	if (flat == NULL || s == NULL) {
+		free(flat);
+		free(s);
+		errno = ENOMEM;
+		return -1;
+	}
+	flat->stream = s;
+	s->fd = fd;
+	s->first = 1;
+	if (grow(&s->buffer, &s->size, FLAT_STREAM_BUFFER_SIZE, 1) < 0
+	 || stream_peek(s, &c) < 0)
+		goto error;
+
+	/* objects and arrays at root are streamed, other values are read */
+	if (c == '{') {
+		s->begin++;
+		s->state = Members;
+	}
+	else if (c == '[') {
+		s->array = 1;
+		s->state = Pending;
+	}
+	else if (stream_value(s, &s->root) < 0 || stream_done(s) < 0)
+		goto error;
+	*result = flat;
+	return 0;
+
+error:
+	c = errno;
+	mustach_flat_free(flat);
+	errno = c;
+	return -1;
+}
+
+/******************************************************************************/
+/*** LAZY DOCUMENTS                                                         ***/
+/******************************************************************************/
+
+static void source_free(const struct source *src)
+{
+	if (src != NULL) {
+		munmap((void*)src->text, src->size);
+		free(src->spans);
+		free((void*)src);
+	}
+}
+
+/*
+ * records the spans of the big arrays and objects of the text of 'src',
+ * sorted by their beginning, returns 0 or -1 when they are not balanced
+ */
+static int index_spans(struct source *src)
+{
+	const char *text = src->text, *s = text, *end = &text[src->size];
+	size_t *opens, nopens = 0, aspans = 0, i;
+	int rc = -1;
+	char c;
+
+	opens = malloc(FLAT_MAX_DEPTH * sizeof *opens);
+	if (opens == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	while (s != end) {
+		c = *s++;
+		switch (c) {
+		case '"':
+			while (s != end && *s != '"')
+				if (*s++ == '\\' && s != end)
+					s++;
+			if (s == end)
+				goto invalid;
+			s++;
+			break;
+		case '[':
+		case '{':
+			if (nopens == FLAT_MAX_DEPTH)
+				goto invalid;
+			if (reserve(&src->spans, &aspans, src->nspans + 1, sizeof *src->spans) < 0)
+				goto error;
+			src->spans[src->nspans].begin = (uint64_t)(s - 1 - text);
+			opens[nopens++] = src->nspans++;
+			break;
+		case ']':
+		case '}':
+			if (nopens == 0)
+				goto invalid;
+			i = opens[--nopens];
+			if (text[src->spans[i].begin] != (c == ']' ? '[' : '{'))
+				goto invalid;
+			src->spans[i].end = (uint64_t)(s - text);
+			if (src->spans[i].end - src->spans[i].begin < FLAT_LAZY_SPAN)
+				src->nspans = i; /* the spans it contains are already forgotten */
+			break;
+		default:
+			break;
+		}
+	}
+	if (nopens == 0)
+		rc = 0;
+	else {
+invalid:
+		errno = EINVAL;
+	}
+error:
+	free(opens);
+	return rc;
+}
+
+int mustach_flat_lazy(const char *filename, struct mustach_flat **result)
+{
+	static const uint32_t nokey = 0;
+	struct mustach_flat *flat;
+	struct source *src;
+	struct stat st;
+	size_t begin, end;
+	void *map;
+	int fd;
+
+	/* map the file */
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	/* make the document */
+	flat = calloc(1, sizeof *flat);
+	src = calloc(1, sizeof *src);
+	if (flat == NULL || src == NULL) {
+		free(flat);
+		free(src);
+		munmap(map, (size_t)st.st_size);
+		errno = ENOMEM;
+		return -1;
+	}
+	src->text = map;
+	src->size = (size_t)st.st_size;
+	flat->source = src;
+	flat->lazy = 1;
+	if (index_spans(src) < 0)
+		goto error;
+
+	/* its root is the text without surrounding spaces, not parsed */
+	for (begin = 0 ; begin < src->size && is_space(src->text[begin]) ; begin++);
+	for (end = src->size ; end > begin && is_space(src->text[end - 1]) ; end--);
+	if (begin == end) {
+		errno = EINVAL;
+		goto error;
+	}
+	src->root.type = Lazy;
+	src->root.key = NOKEY;
+	src->root.extent = end - begin;
+	src->root.position = begin;
+	flat->values = &src->root;
+	flat->nvalues = 1;
+	flat->keymap = &nokey;
+	*result = flat;
+	return 0;
+
+error:
+	fd = errno;
+	mustach_flat_free(flat);
+	errno = fd;
+	return -1;
+}
+
+/******************************************************************************/
+/*** RENDERING                                                              ***/
+/******************************************************************************/
+
+/*
+ * The values are designated by their document and their index.
+ * All the values are in the root document, except for streamed
+ * documents where the document is NULL for the values not yet
+ * read (STREAM_ROOT and STREAM_PENDING), and for lazy documents
+ * where the values are in the documents parsed by the render in
+ * its arena, each one recording the documents parsed from its lazy
+ * values.
+ */
+struct expl {
+	const struct mustach_flat *root;
+	struct stream *stream;
+	int error;
+	const struct mustach_flat *seldoc;
+	uint32_t selection;
+	int depth;
+	uint64_t stamp;
+	struct {
+		const struct mustach_flat *doc;  /* the current value, not lazy */
+		uint32_t obj;
+		const struct mustach_flat *idoc; /* the current item of iterations */
+		uint32_t item;
+		uint32_t cont;
+		uint32_t index, count;
+		int is_objiter;
+		int is_streamed;
+		uint64_t stamp;
+	} stack[MUSTACH_MAX_DEPTH];
+
+	/* remembered searches, by hash of name (see mustach_wrap_memo),
+	 * with the document as value and the offset as data, not used
+	 * for streamed documents */
+	struct mustach_wrap_memo memo[SEL_MEMO_SIZE];
+
+	/* spare buffer for serializing arrays and objects */
+	struct serial *serial;
+
+	/* parsing of lazy values */
+	struct parser parser;
+	struct arena arena;
+};
+
+/* serializes the value at 'index' of 'doc' in the spare buffer of 'e', returns its text or NULL */
+static char *serialize(struct expl *e, const struct mustach_flat *doc, uint32_t index, size_t *length)
+{
+	struct serial *serial = e->serial;
+	size_t used = 0;
+
+	e->serial = NULL;
+	if (append_json(&serial, &used, doc, index) < 0
+	 || append(&serial, &used, "", 1) < 0) {
+		free(serial);
+		return NULL;
+	}
+	*length = used - 1;
+	return serial->text;
+}
+
+/* gives back the serialized text 'value' to 'closure' */
+static void release_serial(const char *value, void *closure)
+{
+	struct expl *e = closure;
+	struct serial *s = (struct serial*)(value - offsetof(struct serial, text));
+
+	if (e->serial == NULL)
+		e->serial = s;
+	else
+		free(s);
+}
+
+/* type of the value at 'index' of 'doc' */
+static inline uint32_t type_of(const struct mustach_flat *doc, uint32_t index)
+{
+	return index == NOVALUE ? Null : doc->values[index].type;
+}
+
+/* is the value at 'index' of 'doc' true? */
+static int truthy(const struct mustach_flat *doc, uint32_t index)
+{
+	const struct value *v;
+
+	if (index == NOVALUE)
+		return 0;
+	v = &doc->values[index];
+	switch (v->type) {
+	case True:
+	case Object:
+		return 1;
+	case Integer:
+		return v->integer != 0;
+	case Real:
+		return v->real != 0;
+	case String:
+		return v->text.length != 0;
+	default:
+		return 0;
+	}
+}
+
+/* uses the root of the stream when it is fully read */
+static void use_stream_root(struct expl *e)
+{
+	const struct mustach_flat *root = e->stream->root;
+	int i;
+
+	if (root != NULL) {
+		for (i = 0 ; i <= e->depth ; i++)
+			if (e->stack[i].doc == NULL) {
+				e->stack[i].doc = root;
+				e->stack[i].obj = root_of(root);
+			}
+		if (e->seldoc == NULL && e->selection != NOVALUE
+		 && (e->selection == STREAM_ROOT || e->stream->array)) {
+			e->seldoc = root;
+			e->selection = root_of(root);
+		}
+	}
+}
+
+/* is the reading of the document of 'e' failed? then errno is set */
+static inline int failed(struct expl *e)
+{
+	if (e->error != 0)
+		errno = e->error;
+	else if (e->stream != NULL && e->stream->error != 0)
+		errno = e->stream->error;
+	else
+		return 0;
+	return 1;
+}
+
+/*
+ * replaces the lazy value at '*index' of '*doc' by the root of its
+ * document, parsed once by render, returns 0 or -1 on error
+ */
+static int resolve(struct expl *e, const struct mustach_flat **doc, uint32_t *index)
+{
+	const struct value *v;
+	struct mustach_flat *flat, **parsed;
+	uint32_t i;
+
+	if (*doc == NULL || *index == NOVALUE || (*doc)->values[*index].type != Lazy)
+		return 0;
+	v = &(*doc)->values[*index];
+
+	/* the root of lazy documents has no record, it is parsed at start */
+	parsed = (*doc)->parsed;
+	if (parsed != NULL && parsed[*index] != NULL) {
+		flat = parsed[*index];
+		goto found;
+	}
+
+	/* parse it in the arena */
+	parser_reset(&e->parser, &(*doc)->source->text[v->position], (size_t)v->extent, (*doc)->source);
+	if (parse(&e->parser) < 0 || (flat = make_flat(&e->parser, &e->arena)) == NULL)
+		goto error;
+	for (i = 0 ; i < flat->nvalues && flat->values[i].type != Lazy ; i++);
+	if (i < flat->nvalues) {
+		flat->parsed = arena_alloc(&e->arena, flat->nvalues * sizeof *flat->parsed);
+		if (flat->parsed == NULL)
+			goto error;
+		memset(flat->parsed, 0, flat->nvalues * sizeof *flat->parsed);
+	}
+	if (parsed != NULL)
+		parsed[*index] = flat;
+
+found:
+	*doc = flat;
+	*index = root_of(flat);
+	return 0;
+
+error:
+	e->error = errno;
+	return -1;
+}
+
+/* reads the selection of streamed documents, returns 0 or -1 on error */
+static int read_selection(struct expl *e)
+{
+	struct stream *s = e->stream;
+
+	if (e->seldoc != NULL || e->selection == NOVALUE)
+		return 0;
+	if (failed(e))
+		return -1;
+	if (e->selection == STREAM_PENDING && !s->array) {
+		if (stream_pending(s) < 0)
+			return -1;
+		e->seldoc = s->members[s->nmembers - 1].doc;
+		e->selection = root_of(e->seldoc);
+		return 0;
+	}
+	if (stream_all(s) < 0)
+		return -1;
+	use_stream_root(e);
+	return 0;
+}
+
+static int start(void *closure)
+{
+	struct expl *e = closure;
+	e->stream = e->root->stream;
+	e->depth = 0;
+	e->seldoc = NULL;
+	e->selection = NOVALUE;
+	if (e->stream == NULL) {
+		e->stack[0].doc = e->root;
+		e->stack[0].obj = root_of(e->root);
+	} else if (e->stream->root != NULL) {
+		e->stack[0].doc = e->stream->root;
+		e->stack[0].obj = root_of(e->stream->root);
+	} else {
+		e->stack[0].doc = NULL;
+		e->stack[0].obj = e->stream->array ? STREAM_PENDING : STREAM_ROOT;
+	}
+	e->stack[0].cont = NOVALUE;
+	e->stack[0].index = 0;
+	e->stack[0].count = 1;
+	e->stack[0].is_objiter = 0;
+	e->stack[0].is_streamed = 0;
+	e->stack[0].stamp = 0;
+	e->stamp = 0;
+	memset(e->memo, 0, sizeof e->memo);
+	e->serial = NULL;
+	e->error = 0;
+	memset(&e->parser, 0, sizeof e->parser);
+	memset(&e->arena, 0, sizeof e->arena);
+	if (resolve(e, &e->stack[0].doc, &e->stack[0].obj) < 0)
+		return MUSTACH_ERROR_SYSTEM;
+	return failed(e) ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
+}
+
+static void stop(void *closure, int status)
+{
+	struct expl *e = closure;
+	(void)status;
+	free(e->serial);
+	parser_release(&e->parser);
+	arena_free(&e->arena);
+}
+
+static int compare(void *closure, const struct mustach_wrap_value *value)
+{
+	struct expl *e = closure;
+	const struct value *v;
+	const char *s;
+	size_t length;
+	double d;
+	int r;
+
+	if (e->selection == NOVALUE || read_selection(e) < 0)
+		return strcmp("null", value->string);
+	v = &e->seldoc->values[e->selection];
+	switch (v->type) {
+	case Real:
+		d = v->real - value->real;
+		return d < 0 ? -1 : d > 0 ? 1 : 0;
+	case Integer:
+		if (value->type == Mustach_Wrap_Double) {
+			d = (double)v->integer - value->real;
+			return d < 0 ? -1 : d > 0 ? 1 : 0;
+		}
+		return v->integer < value->integer ? -1 : v->integer > value->integer ? 1 : 0;
+	case String:
+		return strcmp(&e->seldoc->pool[v->text.offset], value->string);
+	case True:
+		return strcmp("true", value->string);
+	case False:
+		return strcmp("false", value->string);
+	case Array:
+	case Object:
+		s = serialize(e, e->seldoc, e->selection, &length);
+		if (s == NULL)
+			return -1;
+		r = strcmp(s, value->string);
+		release_serial(s, e);
+		return r;
+	default:
+		return strcmp("null", value->string);
+	}
+}
+
+static int sel_atom(void *closure, const struct mustach_wrap_atom *key)
+{
+	struct expl *e = closure;
+	const struct mustach_flat *doc, *d;
+	struct mustach_wrap_memo *m;
+	uint32_t o, atom;
+	int i;
+
+	/* search the frames from the innermost, the atom depends on the document */
+	m = e->stream == NULL ? mustach_wrap_memo_get(e->memo, SEL_MEMO_SIZE, key) : NULL;
+	doc = d = NULL;
+	atom = NOKEY;
+	o = NOVALUE;
+	for (i = e->depth ; i >= 0 ; i--) {
+		if (mustach_wrap_memo_hit(m, i, e->stack[i].stamp)) {
+			i = m->depth;
+			d = m->value;
+			o = (uint32_t)m->data;
+			break;
+		}
+		d = e->stack[i].doc;
+		if (d != NULL) {
+			if (d != doc) {
+				doc = d;
+				atom = find_key(d, key);
+			}
+			o = find_member(d, e->stack[i].obj, atom);
+			if (resolve(e, &d, &o) < 0) {
+				d = NULL;
+				o = READ_FAILED; /* selected for reporting the error */
+			}
+		}
+		else if (e->stack[i].obj == STREAM_ROOT && stream_find(e->stream, key->name, key->length, &d, &o) < 0)
+			o = READ_FAILED;
+		if (o != NOVALUE)
+			break;
+	}
+	if (o != READ_FAILED)
+		mustach_wrap_memo_set(m, e->stamp, i, d, o);
+	e->seldoc = d;
+	e->selection = o;
+	return o != NOVALUE;
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	struct mustach_wrap_atom key;
+
+	if (name != NULL) {
+		mustach_wrap_make_atom(&key, name);
+		return sel_atom(closure, &key);
+	}
+	e->seldoc = e->stack[e->depth].doc;
+	e->selection = e->stack[e->depth].obj;
+	return 1;
+}
+
+static int subsel_atom(void *closure, const struct mustach_wrap_atom *key)
+{
+	struct expl *e = closure;
+	const struct mustach_flat *d;
+	uint32_t o;
+
+	if (e->seldoc == NULL && e->selection == STREAM_ROOT) {
+		if (stream_find(e->stream, key->name, key->length, &d, &o) < 0) {
+			d = NULL;
+			o = READ_FAILED;
+		}
+	} else if (read_selection(e) < 0) {
+		d = NULL;
+		o = READ_FAILED;
+	} else {
+		d = e->seldoc;
+		o = find_member(d, e->selection, find_key(d, key));
+		if (resolve(e, &d, &o) < 0) {
+			d = NULL;
+			o = READ_FAILED;
+		}
+	}
+	if (o == NOVALUE)
+		return 0;
+	e->seldoc = d;
+	e->selection = o;
+	return 1;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	struct mustach_wrap_atom key;
+
+	mustach_wrap_make_atom(&key, name);
+	return subsel_atom(closure, &key);
+}
+
+/* makes the current item of the iteration of the top frame its current value */
+static int use_item(struct expl *e)
+{
+	e->stack[e->depth].doc = e->stack[e->depth].idoc;
+	e->stack[e->depth].obj = e->stack[e->depth].item;
+	return resolve(e, &e->stack[e->depth].doc, &e->stack[e->depth].obj);
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct expl *e = closure;
+	const struct value *v;
+	uint32_t o, type;
+	int rc;
+
+	if (failed(e))
+		return MUSTACH_ERROR_SYSTEM;
+	if (++e->depth >= MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+
+	e->stack[e->depth].is_objiter = 0;
+	e->stack[e->depth].is_streamed = 0;
+	if (e->seldoc == NULL && e->selection != NOVALUE) {
+		if (!objiter && e->selection == STREAM_ROOT) {
+			/* the root object, not read */
+			e->stack[e->depth].doc = NULL;
+			e->stack[e->depth].cont = NOVALUE;
+			e->stack[e->depth].obj = STREAM_ROOT;
+			e->stack[e->depth].index = 0;
+			e->stack[e->depth].count = 1;
+			return 1;
+		}
+		if (!objiter && e->selection == STREAM_PENDING) {
+			/* the array is rendered while read */
+			rc = stream_open(e->stream);
+			if (rc <= 0) {
+				e->depth--;
+				use_stream_root(e);
+				return rc < 0 ? MUSTACH_ERROR_SYSTEM : 0;
+			}
+			e->stack[e->depth].doc = e->stream->item;
+			e->stack[e->depth].cont = NOVALUE;
+			e->stack[e->depth].obj = root_of(e->stream->item);
+			e->stack[e->depth].index = 0;
+			e->stack[e->depth].count = 1;
+			e->stack[e->depth].is_streamed = 1;
+			return 1;
+		}
+		if (read_selection(e) < 0) {
+			e->depth--;
+			return MUSTACH_ERROR_SYSTEM;
+		}
+	}
+
+	o = e->selection;
+	type = type_of(e->seldoc, o);
+	if (objiter ? type == Object : type == Array) {
+		v = &e->seldoc->values[o];
+		if (v->items.count == 0)
+			goto not_entering;
+		e->stack[e->depth].idoc = e->seldoc;
+		e->stack[e->depth].item = v->items.first;
+		e->stack[e->depth].cont = o;
+		e->stack[e->depth].index = 0;
+		e->stack[e->depth].count = v->items.count;
+		e->stack[e->depth].is_objiter = objiter;
+		if (use_item(e) < 0) {
+			e->depth--;
+			return MUSTACH_ERROR_SYSTEM;
+		}
+	} else if (!objiter && truthy(e->seldoc, o)) {
+		e->stack[e->depth].doc = e->seldoc;
+		e->stack[e->depth].cont = NOVALUE;
+		e->stack[e->depth].obj = o;
+		e->stack[e->depth].index = 0;
+		e->stack[e->depth].count = 1;
+	} else
+		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
+	return 1;
+
+not_entering:
+	e->depth--;
+	return 0;
+}
+
+static int next(void *closure)
+{
+	struct expl *e = closure;
+	int rc;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	if (e->stack[e->depth].is_streamed) {
+		rc = stream_item(e->stream);
+		if (rc <= 0) {
+			use_stream_root(e);
+			return rc < 0 ? MUSTACH_ERROR_SYSTEM : 0;
+		}
+		e->stack[e->depth].doc = e->stream->item;
+		e->stack[e->depth].obj = root_of(e->stream->item);
+		e->stack[e->depth].index++;
+		return 1;
+	}
+
+	e->stack[e->depth].index++;
+	if (e->stack[e->depth].index >= e->stack[e->depth].count)
+		return 0;
+
+	e->stack[e->depth].item++;
+	if (use_item(e) < 0)
+		return MUSTACH_ERROR_SYSTEM;
+	e->stack[e->depth].stamp = ++e->stamp;
+	return 1;
+}
+
+static int leave(void *closure)
+{
+	struct expl *e = closure;
+	int rc;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	/* skip the items of streamed arrays left before their end (inverted sections) */
+	if (e->stack[e->depth].is_streamed && e->stream->state == Items) {
+		while ((rc = stream_item(e->stream)) > 0);
+		use_stream_root(e);
+		if (rc < 0)
+			return MUSTACH_ERROR_SYSTEM;
+	}
+
+	e->depth--;
+	return 0;
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct expl *e = closure;
+	const struct mustach_flat *doc;
+	const struct value *v;
+	const struct key *k;
+	const char *s;
+
+	if (failed(e))
+		return MUSTACH_ERROR_SYSTEM;
+	if (key) {
+		if (!e->stack[e->depth].is_objiter)
+			s = "";
+		else {
+			doc = e->stack[e->depth].idoc;
+			k = &doc->keys[doc->values[e->stack[e->depth].item].key];
+			s = &doc->pool[k->offset];
+			sbuf->length = k->length;
+		}
+	}
+	else if (e->selection == NOVALUE)
+		s = "";
+	else if (read_selection(e) < 0)
+		return MUSTACH_ERROR_SYSTEM;
+	else {
+		doc = e->seldoc;
+		v = &doc->values[e->selection];
+		switch (v->type) {
+		case String:
+		case Integer:
+		case Real:
+			s = &doc->pool[v->text.offset];
+			sbuf->length = v->text.length;
+			break;
+		case True:
+			s = "true";
+			sbuf->length = 4;
+			break;
+		case False:
+			s = "false";
+			sbuf->length = 5;
+			break;
+		case Array:
+		case Object:
+			/* the text is given to sbuf until its release */
+			s = serialize(e, doc, e->selection, &sbuf->length);
+			if (s == NULL)
+				return MUSTACH_ERROR_SYSTEM;
+			sbuf->releasecb = release_serial;
+			sbuf->closure = e;
+			break;
+		default:
+			s = "";
+			break;
+		}
+	}
+	sbuf->value = s;
+	return 1;
+}
+
+const struct mustach_wrap_itf mustach_flat_wrap_itf = {
+	.start = start,
+	.stop = stop,
+	.compare = NULL,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get,
+	.compare_value = compare,
+	.sel_atom = sel_atom,
+	.subsel_atom = subsel_atom
+};
+
+int mustach_flat_file(const char *template, size_t length, const struct mustach_flat *root, int flags, FILE *file)
+{
+	return mustach_flat_file_partial(template, length, root, flags, NULL, NULL, file);
+}
+
+int mustach_flat_file_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_file_partial(template, length, &mustach_flat_wrap_itf, &e, flags, partialcb, partialclosure, file);
+}
+
+int mustach_flat_fd(const char *template, size_t length, const struct mustach_flat *root, int flags, int fd)
+{
+	return mustach_flat_fd_partial(template, length, root, flags, NULL, NULL, fd);
+}
+
+int mustach_flat_fd_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_fd_partial(template, length, &mustach_flat_wrap_itf, &e, flags, partialcb, partialclosure, fd);
+}
+
+int mustach_flat_mem(const char *template, size_t length, const struct mustach_flat *root, int flags, char **result, size_t *size)
+{
+	return mustach_flat_mem_partial(template, length, root, flags, NULL, NULL, result, size);
+}
+
+int mustach_flat_mem_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_mem_partial(template, length, &mustach_flat_wrap_itf, &e, flags, partialcb, partialclosure, result, size);
+}
+
+int mustach_flat_write(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_flat_write_partial(template, length, root, flags, NULL, NULL, writecb, closure);
+}
+
+int mustach_flat_write_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_write_partial(template, length, &mustach_flat_wrap_itf, &e, flags, partialcb, partialclosure, writecb, closure);
+}
+
+int mustach_flat_emit(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_flat_emit_partial(template, length, root, flags, NULL, NULL, emitcb, closure);
+}
+
+int mustach_flat_emit_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_emit_partial(template, length, &mustach_flat_wrap_itf, &e, flags, partialcb, partialclosure, emitcb, closure);
+}
+
+int mustach_flat_compiled_file(const struct mustach_compiled *compiled, const struct mustach_flat *root, FILE *file)
+{
+	return mustach_flat_compiled_file_partial(compiled, root, NULL, NULL, file);
+}
+
+int mustach_flat_compiled_file_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_file_partial(compiled, &mustach_flat_wrap_itf, &e, partialcb, partialclosure, file);
+}
+
+int mustach_flat_compiled_fd(const struct mustach_compiled *compiled, const struct mustach_flat *root, int fd)
+{
+	return mustach_flat_compiled_fd_partial(compiled, root, NULL, NULL, fd);
+}
+
+int mustach_flat_compiled_fd_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_fd_partial(compiled, &mustach_flat_wrap_itf, &e, partialcb, partialclosure, fd);
+}
+
+int mustach_flat_compiled_mem(const struct mustach_compiled *compiled, const struct mustach_flat *root, char **result, size_t *size)
+{
+	return mustach_flat_compiled_mem_partial(compiled, root, NULL, NULL, result, size);
+}
+
+int mustach_flat_compiled_mem_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_mem_partial(compiled, &mustach_flat_wrap_itf, &e, partialcb, partialclosure, result, size);
+}
+
+int mustach_flat_compiled_write(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_flat_compiled_write_partial(compiled, root, NULL, NULL, writecb, closure);
+}
+
+int mustach_flat_compiled_write_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_write_partial(compiled, &mustach_flat_wrap_itf, &e, partialcb, partialclosure, writecb, closure);
+}
+
+int mustach_flat_compiled_emit(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_flat_compiled_emit_partial(compiled, root, NULL, NULL, emitcb, closure);
+}
+
+int mustach_flat_compiled_emit_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_emit_partial(compiled, &mustach_flat_wrap_itf, &e, partialcb, partialclosure, emitcb, closure);
+}
+
+/* closure of the threads of batches */
+struct batch {
+	struct expl e; /* first, the closure of the interface */
+	const struct mustach_flat *const *roots;
+};
+
+/* sets the root of the render of 'index' */
+static int batch_set(void *closure, size_t index)
+{
+	struct batch *b = closure;
+	b->e.root = b->roots[index];
+	return MUSTACH_OK;
+}
+
+int mustach_flat_batch(const struct mustach_compiled *compiled, const struct mustach_flat *const *roots, size_t count, int threads, struct mustach_batch_output *outputs)
+{
+	return mustach_flat_batch_partial(compiled, roots, count, threads, NULL, NULL, outputs);
+}
+
+int mustach_flat_batch_partial(const struct mustach_compiled *compiled, const struct mustach_flat *const *roots, size_t count, int threads, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs)
+{
+	struct batch *batch;
+	int i, rc;
+
+	if (threads < 1 || count == 0)
+		threads = 1;
+	else if ((size_t)threads > count)
+		threads = (int)count;
+	batch = malloc((size_t)threads * sizeof *batch);
+	if (batch == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	for (i = 0 ; i < threads ; i++)
+		batch[i].roots = roots;
+	rc = mustach_wrap_batch_partial(compiled, &mustach_flat_wrap_itf, batch, sizeof *batch, threads, batch_set, count, partialcb, partialclosure, outputs);
+	free(batch);
+	return rc;
+}
+
+int mustach_flat_render_start(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	return mustach_flat_render_start_partial(compiled, root, NULL, NULL, sinkcb, sinkclosure, result);
+}
+
+int mustach_flat_render_start_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_render_start_partial(compiled, &mustach_flat_wrap_itf, &e, sizeof e, partialcb, partialclosure, sinkcb, sinkclosure, result);
+}
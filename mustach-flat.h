@@ -0,0 +1,344 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#ifndef _mustach_flat_h_included_
+#define _mustach_flat_h_included_
+
+/*
+ * mustach-flat renders json documents without any json library.
+ * It includes its own json parser that stores the whole document
+ * in one block of memory: the values are in an array where the
+ * items of arrays and objects are ranges of consecutive values,
+ * the keys are interned and their hash are precomputed, the
+ * strings are recorded with their length.
+ *
+ * A parsed document is never modified by renders, so it can be
+ * rendered by many threads at the same time.
+ *
+ * Because the document only uses offsets and indexes, it can be
+ * saved in a packed file (see mustach_flat_save) that is later
+ * rendered directly from memory mapping without parsing nor copying
+ * (see mustach_flat_map).
+ *
+ * Huge documents can also be rendered while read from their input
+ * (see mustach_flat_stream) or directly from their mapped file,
+ * parsing only the values used by the renders (see mustach_flat_lazy).
+ */
+
+#include <stdio.h>
+#include "mustach-wrap.h"
+
+/**
+ * Parsed json document, see mustach_flat_parse.
+ */
+struct mustach_flat;
+
+/**
+ * mustach_flat_parse - Parses the json 'text' of 'length' in 'result'.
+ *
+ * @text:     the json text to parse (any json value is accepted)
+ * @length:   length of the text or zero if unknown and text null terminated
+ * @result:   the pointer receiving the parsed document when 0 is returned
+ * @errpos:   if not NULL, receives the offset of the syntax error
+ *
+ * Returns 0 in case of success, -1 with errno set in case of error:
+ * EINVAL for a syntax error, ENOMEM when out of memory, EFBIG when
+ * the document is too big.
+ */
+extern int mustach_flat_parse(const char *text, size_t length, struct mustach_flat **result, size_t *errpos);
+
+/**
+ * mustach_flat_save - Saves the document 'flat' in the packed file 'filename'.
+ *
+ * The packed file is specific to the architecture that saved it:
+ * its byte order and the layout of its records are the ones of the
+ * memory. It can be mapped later using mustach_flat_map.
+ *
+ * @flat:     the document to save
+ * @filename: the name of the packed file to create
+ *
+ * Returns 0 in case of success, -1 with errno set in case of error,
+ * EINVAL for streamed and lazy documents.
+ */
+extern int mustach_flat_save(const struct mustach_flat *flat, const char *filename);
+
+/**
+ * mustach_flat_map - Maps the packed file 'filename' in memory in 'result'.
+ *
+ * The mapped document is rendered directly from the file, without
+ * parsing nor copying it, until it is released using mustach_flat_free.
+ * Only the header of the file is checked: the packed files are trusted
+ * and must not be modified while mapped.
+ *
+ * @filename: the name of the packed file to map (see mustach_flat_save)
+ * @result:   the pointer receiving the mapped document when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of error:
+ * EINVAL when the file is not a packed document of the architecture.
+ */
+extern int mustach_flat_map(const char *filename, struct mustach_flat **result);
+
+/**
+ * mustach_flat_stream - Makes in 'result' a document read from 'fd' while rendered.
+ *
+ * When the root of the document is an object, its members are read
+ * when searched by the render and are kept in memory, except the
+ * arrays that are sections: their items are read and rendered one at
+ * a time. When the root is an array, its items are rendered the same
+ * way by the section {{#.}}. So the memory used is bounded by the
+ * biggest item of the streamed arrays and the render starts before
+ * the end of the input. Because the input is read only once:
+ *
+ *  - a streamed array is seen as empty after its section;
+ *  - the members following a streamed array are not visible in its
+ *    section, and the members searched before a section that follow
+ *    its array in the input make it read in memory, as arrays
+ *    rendered in other ways than sections;
+ *  - a streamed document must be rendered by only one thread at a time.
+ *
+ * The errors of the input are reported by renders with the status
+ * MUSTACH_ERROR_SYSTEM and errno set, EINVAL for syntax errors.
+ *
+ * @fd:       the file descriptor of the input, not closed
+ * @result:   the pointer receiving the streamed document when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of error.
+ */
+extern int mustach_flat_stream(int fd, struct mustach_flat **result);
+
+/**
+ * mustach_flat_lazy - Maps the json file 'filename' in memory as a lazy document in 'result'.
+ *
+ * Only the boundaries of the arrays and objects of the file are read
+ * when it is mapped, for indexing the big ones. Then each render parses
+ * the arrays and objects it reaches, one level at a time, and keeps them
+ * until its end. So the time and the memory used by renders depend on
+ * the values they use, not on the size of the file. The rendered output
+ * is the same as for the parsed document, but the syntax errors are only
+ * detected in the values parsed: they are reported by renders with the
+ * status MUSTACH_ERROR_SYSTEM and errno set to EINVAL.
+ *
+ * A lazy document is never modified by renders, so it can be rendered
+ * by many threads at the same time. The file must not be modified while
+ * mapped.
+ *
+ * @filename: the name of the json file to map
+ * @result:   the pointer receiving the lazy document when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of error:
+ * EINVAL when the file is empty or its arrays and objects are not balanced.
+ */
+extern int mustach_flat_lazy(const char *filename, struct mustach_flat **result);
+
+/**
+ * mustach_flat_free - Releases the memory of the parsed, mapped, streamed or lazy 'flat' document.
+ *
+ * @flat:     the document to release (can be NULL)
+ */
+extern void mustach_flat_free(struct mustach_flat *flat);
+
+/**
+ * Wrap interface used internally by mustach flat functions.
+ * Can be used for overriding behaviour.
+ */
+extern const struct mustach_wrap_itf mustach_flat_wrap_itf;
+
+/**
+ * mustach_flat_file - Renders the mustache 'template' in 'file' for 'root'.
+ *
+ * @template: the template string to instanciate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the parsed json document to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_file(const char *template, size_t length, const struct mustach_flat *root, int flags, FILE *file);
+
+/**
+ * mustach_flat_fd - Renders the mustache 'template' in 'fd' for 'root'.
+ *
+ * @template: the template string to instanciate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the parsed json document to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_fd(const char *template, size_t length, const struct mustach_flat *root, int flags, int fd);
+
+/**
+ * mustach_flat_mem - Renders the mustache 'template' in 'result' for 'root'.
+ *
+ * @template: the template string to instanciate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the parsed json document to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_mem(const char *template, size_t length, const struct mustach_flat *root, int flags, char **result, size_t *size);
+
+/**
+ * mustach_flat_write - Renders the mustache 'template' for 'root' to custom writer 'writecb' with 'closure'.
+ *
+ * @template: the template string to instanciate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the parsed json document to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_write(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_flat_emit - Renders the mustache 'template' for 'root' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @template: the template string to instanciate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the parsed json document to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_emit(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/**
+ * mustach_flat_compiled_file - Renders the 'compiled' template in 'file' for 'root'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the parsed json document to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_compiled_file(const struct mustach_compiled *compiled, const struct mustach_flat *root, FILE *file);
+
+/**
+ * mustach_flat_compiled_fd - Renders the 'compiled' template in 'fd' for 'root'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the parsed json document to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_compiled_fd(const struct mustach_compiled *compiled, const struct mustach_flat *root, int fd);
+
+/**
+ * mustach_flat_compiled_mem - Renders the 'compiled' template in 'result' for 'root'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the parsed json document to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_compiled_mem(const struct mustach_compiled *compiled, const struct mustach_flat *root, char **result, size_t *size);
+
+/**
+ * mustach_flat_compiled_write - Renders the 'compiled' template for 'root' to custom writer 'writecb' with 'closure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the parsed json document to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_compiled_write(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_flat_compiled_emit - Renders the 'compiled' template for 'root' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the parsed json document to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_compiled_emit(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_emit_cb_t *emitcb, void *closure);
+
+/**
+ * mustach_flat_batch - Renders the 'compiled' template for each of the 'count'
+ * 'roots' using up to 'threads' threads, the calling thread included.
+ * The result of the render of roots[i] is given to outputs[i], the outputs
+ * are delivered in the order of the roots (see mustach_batch_output).
+ * Streamed documents are consumed by their renders, they can't be given
+ * more than once.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @roots:    the roots to render
+ * @count:    the count of roots and of outputs
+ * @threads:  the count of threads
+ * @outputs:  the outputs of the renders
+ *
+ * Returns MUSTACH_OK if all renders succeeded or else the status of
+ * the first one that failed.
+ */
+extern int mustach_flat_batch(const struct mustach_compiled *compiled, const struct mustach_flat *const *roots, size_t count, int threads, struct mustach_batch_output *outputs);
+
+/**
+ * mustach_flat_render_start - Starts in 'result' the resumable render of the
+ * 'compiled' template for the json document 'root', giving its output to
+ * 'sinkcb' without blocking. The render is continued with
+ * mustach_render_step and released with mustach_render_stop.
+ *
+ * @compiled:    the compiled template to instanciate (see mustach_compile)
+ * @root:        the parsed json document to render, kept until the end
+ * @sinkcb:      the function receiving the output
+ * @sinkclosure: the closure to pass to 'sinkcb'
+ * @result:      the pointer receiving the render when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_flat_render_start(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result);
+
+/**
+ * mustach_flat_file_partial, mustach_flat_fd_partial, mustach_flat_mem_partial,
+ * mustach_flat_write_partial, mustach_flat_emit_partial, their compiled
+ * counterparts, mustach_flat_batch_partial and
+ * mustach_flat_render_start_partial - Same as the functions without
+ * the suffix _partial but partials of the renders are provided by
+ * 'partialcb' with 'partialclosure' instead of the default behaviour
+ * (see mustach_wrap_file_partial).
+ *
+ * @partialcb:      the function providing partials or NULL for default
+ * @partialclosure: the closure for the partial function
+ */
+extern int mustach_flat_file_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file);
+extern int mustach_flat_fd_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd);
+extern int mustach_flat_mem_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size);
+extern int mustach_flat_write_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure);
+extern int mustach_flat_emit_partial(const char *template, size_t length, const struct mustach_flat *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure);
+extern int mustach_flat_compiled_file_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file);
+extern int mustach_flat_compiled_fd_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, int fd);
+extern int mustach_flat_compiled_mem_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size);
+extern int mustach_flat_compiled_write_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure);
+extern int mustach_flat_compiled_emit_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure);
+extern int mustach_flat_batch_partial(const struct mustach_compiled *compiled, const struct mustach_flat *const *roots, size_t count, int threads, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs);
+extern int mustach_flat_render_start_partial(const struct mustach_compiled *compiled, const struct mustach_flat *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result);
+
+#endif
+
@@ -9,25 +9,127 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <locale.h>
 
 #include "mustach.h"
 #include "mustach-wrap.h"
 #include "mustach-jansson.h"
 
+#if !defined(SEL_MEMO_SIZE)
+# define SEL_MEMO_SIZE 16 /* count of names whose searches are remembered */
+#endif
+
+
 struct expl {
 	json_t *root;
 	json_t *selection;
 	int depth;
+	uint64_t stamp;
 	struct {
 		json_t *cont;
 		json_t *obj;
 		void *iter;
 		int is_objiter;
 		size_t index, count;
+		uint64_t stamp;
 	} stack[MUSTACH_MAX_DEPTH];
+
+	/* remembered searches, by hash of name (see mustach_wrap_memo) */
+	struct mustach_wrap_memo memo[SEL_MEMO_SIZE];
+
+	/* scratch area for formatting numbers */
+	char number[32];
+};
+
+/* formats the integer 'value' at the end of 'buffer' of 'size', returns its start */
+static char *format_integer(char *buffer, size_t size, json_int_t value)
+{
+	unsigned long long u = value < 0 ? 0 - (unsigned long long)value : (unsigned long long)value;
+	char *p = &buffer[size];
+
+	*--p = 0;
+	do {
+		*--p = (char)('0' + u % 10);
+	} while ((u /= 10) != 0);
+	if (value < 0)
+		*--p = '-';
+	return p;
+}
+
+/*
+ * formats the real 'value' in 'buffer' of 'size' exactly as json_dumps does.
+ * Returns the length or -1 if the buffer is too small.
+ */
+static int format_real(char *buffer, size_t size, double value)
+{
+	char *start, *end, point;
+	int length;
+
+	length = snprintf(buffer, size, "%.17g", value);
+	if (length < 0 || (size_t)length + 3 >= size)
+		return -1;
+
+	/* use the dot as decimal point */
+	point = *localeconv()->decimal_point;
+	if (point != '.' && (start = strchr(buffer, point)) != NULL)
+		*start = '.';
+
+	/* make sure it is read back as a real */
+	if (strchr(buffer, '.') == NULL && strchr(buffer, 'e') == NULL) {
+		buffer[length++] = '.';
+		buffer[length++] = '0';
+		buffer[length] = 0;
+	}
+
+	/* remove + and leading zeros of the exponent */
+	start = strchr(buffer, 'e');
+	if (start != NULL) {
+		start++;
+		end = start + 1;
+		if (*start == '-')
+			start++;
+		while (*end == '0')
+			end++;
+		if (end != start) {
+			memmove(start, end, (size_t)(length - (end - buffer) + 1));
+			length -= (int)(end - start);
+		}
+	}
+	return length;
+}
+
+/* text of dumped arrays and objects with its length */
+struct dump {
+	char *text;
+	size_t length;
+	size_t size;
 };
 
+/* callback of json_dump_callback appending 'buffer' of 'size' to the dump 'data' */
+static int dump_append(const char *buffer, size_t size, void *data)
+{
+	struct dump *d = data;
+	size_t nsz;
+	char *text;
+
+	if (d->length + size > d->size) {
+		nsz = d->size ? d->size : 256;
+		while (d->length + size > nsz)
+			nsz *= 2;
+		text = realloc(d->text, nsz);
+		if (text == NULL)
+			return -1;
+		d->text = text;
+		d->size = nsz;
+	}
+	memcpy(&d->text[d->length], buffer, size);
+	d->length += size;
+	return 0;
+}
+
 static int start(void *closure)
 {
 	struct expl *e = closure;
@@ -37,10 +139,14 @@ static int start(void *closure)
 	e->stack[0].obj = e->root;
 	e->stack[0].index = 0;
 	e->stack[0].count = 1;
+	e->stack[0].is_objiter = 0;
+	e->stack[0].stamp = 0;
+	e->stamp = 0;
+	memset(e->memo, 0, sizeof e->memo);
 	return MUSTACH_OK;
 }
 
-static int compare(void *closure, const char *value)
+static int compare(void *closure, const struct mustach_wrap_value *value)
 {
 	struct expl *e = closure;
 	json_t *o = e->selection;
@@ -49,61 +155,100 @@ static int compare(void *closure, const char *value)
 
 	switch (json_typeof(o)) {
 	case JSON_REAL:
-		d = json_number_value(o) - atof(value);
+		d = json_number_value(o) - value->real;
 		return d < 0 ? -1 : d > 0 ? 1 : 0;
 	case JSON_INTEGER:
-		i = (json_int_t)json_integer_value(o) - (json_int_t)atoll(value);
-		return i < 0 ? -1 : i > 0 ? 1 : 0;
+		i = json_integer_value(o);
+		if (value->type == Mustach_Wrap_Double) {
+			d = (double)i - value->real;
+			return d < 0 ? -1 : d > 0 ? 1 : 0;
+		}
+		return i < value->integer ? -1 : i > value->integer ? 1 : 0;
 	case JSON_STRING:
-		return strcmp(json_string_value(o), value);
+		return strcmp(json_string_value(o), value->string);
 	case JSON_TRUE:
-		return strcmp("true", value);
+		return strcmp("true", value->string);
 	case JSON_FALSE:
-		return strcmp("false", value);
+		return strcmp("false", value->string);
 	case JSON_NULL:
-		return strcmp("null", value);
+		return strcmp("null", value->string);
 	default:
 		return 1;
 	}
 }
 
-static int sel(void *closure, const char *name)
+/* get the member of key 'atom' in 'object' or NULL */
+static json_t *getmember(json_t *object, const struct mustach_wrap_atom *atom)
+{
+#if JANSSON_VERSION_HEX >= 0x020e00
+	return json_object_getn(object, atom->name, atom->length);
+#else
+	return json_object_get(object, atom->name);
+#endif
+}
+
+static int sel_atom(void *closure, const struct mustach_wrap_atom *atom)
 {
 	struct expl *e = closure;
 	json_t *o;
+	struct mustach_wrap_memo *m;
 	int i, r;
 
-	if (name == NULL) {
-		o = e->stack[e->depth].obj;
-		r = 1;
-	} else {
-		i = e->depth;
-		while (i >= 0 && !(o = json_object_get(e->stack[i].obj, name)))
-			i--;
-		if (i >= 0)
-			r = 1;
-		else {
-			o = json_null();
-			r = 0;
+	m = mustach_wrap_memo_get(e->memo, SEL_MEMO_SIZE, atom);
+	for (i = e->depth ; i >= 0 ; i--) {
+		if (mustach_wrap_memo_hit(m, i, e->stack[i].stamp)) {
+			i = m->depth;
+			o = (json_t*)m->value;
+			break;
 		}
+		if ((o = getmember(e->stack[i].obj, atom)) != NULL)
+			break;
+	}
+	if (i >= 0)
+		r = 1;
+	else {
+		o = json_null();
+		r = 0;
 	}
+	mustach_wrap_memo_set(m, e->stamp, i, o, 0);
 	e->selection = o;
 	return r;
 }
 
-static int subsel(void *closure, const char *name)
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	struct mustach_wrap_atom atom;
+
+	if (name != NULL) {
+		mustach_wrap_make_atom(&atom, name);
+		return sel_atom(closure, &atom);
+	}
+	e->selection = e->stack[e->depth].obj;
+	return 1;
+}
+
+static int subsel_atom(void *closure, const struct mustach_wrap_atom *atom)
 {
 	struct expl *e = closure;
 	json_t *o;
 	int r;
 
-	o = json_object_get(e->selection, name);
+	o = getmember(e->selection, atom);
 	r = o != NULL;
 	if (r)
 		e->selection = o;
 	return r;
 }
 
+static int subsel(void *closure, const char *name)
+{
+	struct mustach_wrap_atom atom;
+
+	mustach_wrap_make_atom(&atom, name);
+	return subsel_atom(closure, &atom);
+}
+
 static int enter(void *closure, int objiter)
 {
 	struct expl *e = closure;
@@ -137,6 +282,7 @@ static int enter(void *closure, int objiter)
 		e->stack[e->depth].index = 0;
 	} else
 		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 
 not_entering:
@@ -156,6 +302,7 @@ static int next(void *closure)
 		if (e->stack[e->depth].iter == NULL)
 			return 0;
 		e->stack[e->depth].obj = json_object_iter_value(e->stack[e->depth].iter);
+		e->stack[e->depth].stamp = ++e->stamp;
 		return 1;
 	}
 
@@ -164,6 +311,7 @@ static int next(void *closure)
 		return 0;
 
 	e->stack[e->depth].obj = json_array_get(e->stack[e->depth].cont, e->stack[e->depth].index);
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 }
 
@@ -181,71 +329,284 @@ static int leave(void *closure)
 static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 {
 	struct expl *e = closure;
+	struct dump dump;
 	const char *s;
+	int length;
 
 	if (key) {
-		s = e->stack[e->depth].is_objiter
-			? json_object_iter_key(e->stack[e->depth].iter)
-			: "";
+		if (!e->stack[e->depth].is_objiter)
+			s = "";
+		else {
+			s = json_object_iter_key(e->stack[e->depth].iter);
+#if JANSSON_VERSION_HEX >= 0x020e00
+			sbuf->length = json_object_iter_key_len(e->stack[e->depth].iter);
+#endif
+		}
 	}
-	else if (json_is_string(e->selection))
+	else if (json_is_string(e->selection)) {
 		s = json_string_value(e->selection);
+		sbuf->length = json_string_length(e->selection);
+	}
 	else if (json_is_null(e->selection))
 		s = "";
+	else if (json_is_true(e->selection)) {
+		s = "true";
+		sbuf->length = 4;
+	}
+	else if (json_is_false(e->selection)) {
+		s = "false";
+		sbuf->length = 5;
+	}
+	else if (json_is_integer(e->selection)) {
+		s = format_integer(e->number, sizeof e->number, json_integer_value(e->selection));
+		sbuf->length = (size_t)(&e->number[sizeof e->number - 1] - s);
+	}
+	else if (json_is_real(e->selection)
+	      && (length = format_real(e->number, sizeof e->number, json_real_value(e->selection))) >= 0) {
+		s = e->number;
+		sbuf->length = (size_t)length;
+	}
 	else {
-		s = json_dumps(e->selection, JSON_ENCODE_ANY | JSON_COMPACT);
-		if (s == NULL)
+		dump.text = NULL;
+		dump.length = dump.size = 0;
+		if (json_dump_callback(e->selection, dump_append, &dump, JSON_ENCODE_ANY | JSON_COMPACT) < 0
+		 || dump_append("", 1, &dump) < 0) {
+			free(dump.text);
 			return MUSTACH_ERROR_SYSTEM;
+		}
+		s = dump.text;
+		sbuf->length = dump.length - 1;
 		sbuf->freecb = free;
 	}
 	sbuf->value = s;
 	return 1;
 }
 
+static size_t items(void *closure)
+{
+	struct expl *e = closure;
+
+#if JANSSON_VERSION_HEX < 0x020d00
+	/* dumps of arrays and objects mark them */
+	(void)e;
+	return 0;
+#else
+	if (e->stack[e->depth].is_objiter)
+		return json_object_size(e->stack[e->depth].cont);
+	return e->stack[e->depth].count;
+#endif
+}
+
+static void *make_clone(void *closure, size_t index)
+{
+	struct expl *e = closure, *c;
+
+	c = malloc(sizeof *c);
+	if (c != NULL) {
+		*c = *e;
+		if (c->stack[c->depth].is_objiter) {
+			while (index--)
+				c->stack[c->depth].iter = json_object_iter_next(c->stack[c->depth].cont, c->stack[c->depth].iter);
+			c->stack[c->depth].obj = json_object_iter_value(c->stack[c->depth].iter);
+		}
+		else {
+			c->stack[c->depth].index = index;
+			c->stack[c->depth].obj = json_array_get(c->stack[c->depth].cont, index);
+		}
+		c->stack[c->depth].stamp = ++c->stamp;
+	}
+	return c;
+}
+
+static void free_clone(void *clone)
+{
+	free(clone);
+}
+
 const struct mustach_wrap_itf mustach_jansson_wrap_itf = {
 	.start = start,
 	.stop = NULL,
-	.compare = compare,
+	.compare = NULL,
 	.sel = sel,
 	.subsel = subsel,
 	.enter = enter,
 	.next = next,
 	.leave = leave,
-	.get = get
+	.get = get,
+	.compare_value = compare,
+	.sel_atom = sel_atom,
+	.subsel_atom = subsel_atom,
+	.items = items,
+	.clone = make_clone,
+	.unclone = free_clone
 };
 
 int mustach_jansson_file(const char *template, size_t length, json_t *root, int flags, FILE *file)
+{
+	return mustach_jansson_file_partial(template, length, root, flags, NULL, NULL, file);
+}
+
+int mustach_jansson_file_partial(const char *template, size_t length, json_t *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_file(template, length, &mustach_jansson_wrap_itf, &e, flags, file);
+	return mustach_wrap_file_partial(template, length, &mustach_jansson_wrap_itf, &e, flags, partialcb, partialclosure, file);
 }
 
 int mustach_jansson_fd(const char *template, size_t length, json_t *root, int flags, int fd)
+{
+	return mustach_jansson_fd_partial(template, length, root, flags, NULL, NULL, fd);
+}
+
+int mustach_jansson_fd_partial(const char *template, size_t length, json_t *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_fd(template, length, &mustach_jansson_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd_partial(template, length, &mustach_jansson_wrap_itf, &e, flags, partialcb, partialclosure, fd);
 }
 
 int mustach_jansson_mem(const char *template, size_t length, json_t *root, int flags, char **result, size_t *size)
+{
+	return mustach_jansson_mem_partial(template, length, root, flags, NULL, NULL, result, size);
+}
+
+int mustach_jansson_mem_partial(const char *template, size_t length, json_t *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_mem(template, length, &mustach_jansson_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem_partial(template, length, &mustach_jansson_wrap_itf, &e, flags, partialcb, partialclosure, result, size);
 }
 
 int mustach_jansson_write(const char *template, size_t length, json_t *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_jansson_write_partial(template, length, root, flags, NULL, NULL, writecb, closure);
+}
+
+int mustach_jansson_write_partial(const char *template, size_t length, json_t *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_write(template, length, &mustach_jansson_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write_partial(template, length, &mustach_jansson_wrap_itf, &e, flags, partialcb, partialclosure, writecb, closure);
 }
 
 int mustach_jansson_emit(const char *template, size_t length, json_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_jansson_emit_partial(template, length, root, flags, NULL, NULL, emitcb, closure);
+}
+
+int mustach_jansson_emit_partial(const char *template, size_t length, json_t *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_emit_partial(template, length, &mustach_jansson_wrap_itf, &e, flags, partialcb, partialclosure, emitcb, closure);
+}
+
+int mustach_jansson_compiled_file(const struct mustach_compiled *compiled, json_t *root, FILE *file)
+{
+	return mustach_jansson_compiled_file_partial(compiled, root, NULL, NULL, file);
+}
+
+int mustach_jansson_compiled_file_partial(const struct mustach_compiled *compiled, json_t *root, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_file_partial(compiled, &mustach_jansson_wrap_itf, &e, partialcb, partialclosure, file);
+}
+
+int mustach_jansson_compiled_fd(const struct mustach_compiled *compiled, json_t *root, int fd)
+{
+	return mustach_jansson_compiled_fd_partial(compiled, root, NULL, NULL, fd);
+}
+
+int mustach_jansson_compiled_fd_partial(const struct mustach_compiled *compiled, json_t *root, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_fd_partial(compiled, &mustach_jansson_wrap_itf, &e, partialcb, partialclosure, fd);
+}
+
+int mustach_jansson_compiled_mem(const struct mustach_compiled *compiled, json_t *root, char **result, size_t *size)
+{
+	return mustach_jansson_compiled_mem_partial(compiled, root, NULL, NULL, result, size);
+}
+
+int mustach_jansson_compiled_mem_partial(const struct mustach_compiled *compiled, json_t *root, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_mem_partial(compiled, &mustach_jansson_wrap_itf, &e, partialcb, partialclosure, result, size);
+}
+
+int mustach_jansson_compiled_write(const struct mustach_compiled *compiled, json_t *root, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_jansson_compiled_write_partial(compiled, root, NULL, NULL, writecb, closure);
+}
+
+int mustach_jansson_compiled_write_partial(const struct mustach_compiled *compiled, json_t *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_emit(template, length, &mustach_jansson_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_compiled_write_partial(compiled, &mustach_jansson_wrap_itf, &e, partialcb, partialclosure, writecb, closure);
+}
+
+int mustach_jansson_compiled_emit(const struct mustach_compiled *compiled, json_t *root, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_jansson_compiled_emit_partial(compiled, root, NULL, NULL, emitcb, closure);
+}
+
+int mustach_jansson_compiled_emit_partial(const struct mustach_compiled *compiled, json_t *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_emit_partial(compiled, &mustach_jansson_wrap_itf, &e, partialcb, partialclosure, emitcb, closure);
+}
+
+/* closure of the threads of batches */
+struct batch {
+	struct expl e; /* first, the closure of the interface */
+	json_t *const *roots;
+};
+
+/* sets the root of the render of 'index' */
+static int batch_set(void *closure, size_t index)
+{
+	struct batch *b = closure;
+	b->e.root = b->roots[index];
+	return MUSTACH_OK;
+}
+
+int mustach_jansson_batch(const struct mustach_compiled *compiled, json_t *const *roots, size_t count, int threads, struct mustach_batch_output *outputs)
+{
+	return mustach_jansson_batch_partial(compiled, roots, count, threads, NULL, NULL, outputs);
+}
+
+int mustach_jansson_batch_partial(const struct mustach_compiled *compiled, json_t *const *roots, size_t count, int threads, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs)
+{
+	struct batch *batch;
+	int i, rc;
+
+	if (threads < 1 || count == 0)
+		threads = 1;
+	else if ((size_t)threads > count)
+		threads = (int)count;
+	batch = malloc((size_t)threads * sizeof *batch);
+	if (batch == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	for (i = 0 ; i < threads ; i++)
+		batch[i].roots = roots;
+	rc = mustach_wrap_batch_partial(compiled, &mustach_jansson_wrap_itf, batch, sizeof *batch, threads, batch_set, count, partialcb, partialclosure, outputs);
+	free(batch);
+	return rc;
+}
+
+int mustach_jansson_render_start(const struct mustach_compiled *compiled, json_t *root, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	return mustach_jansson_render_start_partial(compiled, root, NULL, NULL, sinkcb, sinkclosure, result);
 }
 
+int mustach_jansson_render_start_partial(const struct mustach_compiled *compiled, json_t *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_render_start_partial(compiled, &mustach_jansson_wrap_itf, &e, sizeof e, partialcb, partialclosure, sinkcb, sinkclosure, result);
+}
@@ -9,16 +9,47 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <inttypes.h>
+#include <locale.h>
 
 #include "mustach.h"
 #include "mustach-wrap.h"
 #include "mustach-json-c.h"
 
+#if !defined(SEL_MEMO_SIZE)
+# define SEL_MEMO_SIZE 16 /* count of names whose searches are remembered */
+#endif
+
+#if defined(JSON_C_VERSION_NUM) && JSON_C_VERSION_NUM >= 0x000d00
+# define JSON_C_HASH 1 /* searches the tables of objects with the hash of names remembered */
+#else
+# define JSON_C_HASH 0
+#endif
+
+/* text of serialized arrays and objects, recycled after use */
+struct serial {
+	size_t size;
+	char text[];
+};
+
+#if JSON_C_HASH
+/* hash of the name of a memo for the tables of objects */
+struct memo_hash {
+	lh_hash_fn *hashfn;       /* hash function of 'hash' or NULL */
+	unsigned long hash;       /* hash of the name */
+};
+#else
+struct memo_hash;
+#endif
+
 struct expl {
 	struct json_object *root;
 	struct json_object *selection;
 	int depth;
+	uint64_t stamp;
 	struct {
 		struct json_object *cont;
 		struct json_object *obj;
@@ -26,9 +57,218 @@ struct expl {
 		struct json_object_iterator enditer;
 		int is_objiter;
 		int index, count;
+		uint64_t stamp;
 	} stack[MUSTACH_MAX_DEPTH];
+
+	/* remembered searches, by hash of name (see mustach_wrap_memo) */
+	struct mustach_wrap_memo memo[SEL_MEMO_SIZE];
+#if JSON_C_HASH
+	struct memo_hash hashes[SEL_MEMO_SIZE];
+#endif
+
+	/* spare buffer for serializing arrays and objects */
+	struct serial *serial;
+
+	/* scratch area for formatting scalars */
+	char number[32];
 };
 
+/*
+ * The values are formatted as json_object_to_json_string_ext(o, 0) does
+ * but without using it because it records the text in the object. So
+ * the json objects are never modified and renders of a same object can
+ * run concurrently.
+ */
+
+/*
+ * formats the scalar 'o' (boolean, double or integer) in 'buffer'
+ * of 32 bytes and returns its text and its 'length'
+ */
+static const char *format_scalar(char *buffer, struct json_object *o, size_t *length)
+{
+	const char *s;
+	char *p;
+	double d;
+	int64_t i;
+	uint64_t u;
+
+	switch (json_object_get_type(o)) {
+	case json_type_boolean:
+		s = json_object_get_boolean(o) ? "true" : "false";
+		*length = strlen(s);
+		return s;
+	case json_type_double:
+#if JSON_C_VERSION_NUM >= 0x000D00
+		/* doubles read by the parser keep their original text */
+		s = json_object_get_userdata(o);
+		if (s != NULL) {
+			*length = strlen(s);
+			return s;
+		}
+#endif
+		d = json_object_get_double(o);
+		if (d != d)
+			s = "NaN";
+		else if (d - d != 0)
+			s = d > 0 ? "Infinity" : "-Infinity";
+		else {
+			*length = (size_t)snprintf(buffer, 32, "%.17g", d);
+			p = strchr(buffer, *localeconv()->decimal_point);
+			if (p != NULL)
+				*p = '.';
+			else if (strchr(buffer, 'e') == NULL
+			      && (buffer[buffer[0] == '-'] >= '0' && buffer[buffer[0] == '-'] <= '9')) {
+				memcpy(&buffer[*length], ".0", 3);
+				*length += 2;
+			}
+			return buffer;
+		}
+		*length = strlen(s);
+		return s;
+	case json_type_int:
+		i = json_object_get_int64(o);
+#if JSON_C_VERSION_NUM >= 0x000E00
+		u = i == INT64_MAX ? json_object_get_uint64(o) : i < 0 ? 0 - (uint64_t)i : (uint64_t)i;
+#else
+		u = i < 0 ? 0 - (uint64_t)i : (uint64_t)i;
+#endif
+		p = &buffer[31];
+		*p = 0;
+		do {
+			*--p = (char)('0' + u % 10);
+		} while ((u /= 10) != 0);
+		if (i < 0)
+			*--p = '-';
+		*length = (size_t)(&buffer[31] - p);
+		return p;
+	default:
+		*length = 4;
+		return "null";
+	}
+}
+
+/* appends 'text' of 'length' to the 'serial' having 'used' bytes */
+static int append(struct serial **serial, size_t *used, const char *text, size_t length)
+{
+	struct serial *s = *serial;
+	size_t size = s == NULL ? 256 : s->size;
+
+	if (s == NULL || *used + length >= size) {
+		while (*used + length >= size)
+			size *= 2;
+		s = realloc(s, sizeof *s + size);
+		if (s == NULL)
+			return -1;
+		s->size = size;
+		*serial = s;
+	}
+	memcpy(&s->text[*used], text, length);
+	*used += length;
+	return 0;
+}
+
+/* appends the json string of 'text' of 'length' to the 'serial' having 'used' bytes */
+static int append_string(struct serial **serial, size_t *used, const char *text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6];
+	size_t run, escl;
+	unsigned char c;
+
+	if (append(serial, used, "\"", 1) < 0)
+		return -1;
+	while (length) {
+		/* copy the run of characters not escaped */
+		for (run = 0 ; run < length ; run++) {
+			c = (unsigned char)text[run];
+			if (c < ' ' || c == '"' || c == '\\' || c == '/')
+				break;
+		}
+		if (run && append(serial, used, text, run) < 0)
+			return -1;
+		if (run == length)
+			break;
+
+		/* escape the character */
+		c = (unsigned char)text[run];
+		esc[0] = '\\';
+		escl = 2;
+		switch (c) {
+		case '\b': esc[1] = 'b'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		case '\f': esc[1] = 'f'; break;
+		case '"':
+		case '\\':
+		case '/': esc[1] = (char)c; break;
+		default:
+			memcpy(&esc[1], "u00", 3);
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 15];
+			escl = 6;
+			break;
+		}
+		if (append(serial, used, esc, escl) < 0)
+			return -1;
+		text += run + 1;
+		length -= run + 1;
+	}
+	return append(serial, used, "\"", 1);
+}
+
+/* appends the json text of 'o' to the 'serial' having 'used' bytes */
+static int append_json(struct serial **serial, size_t *used, struct json_object *o)
+{
+	struct json_object_iterator it, end;
+	const char *s;
+	char buffer[32];
+	size_t i, n, length;
+
+	switch (json_object_get_type(o)) {
+	case json_type_string:
+		return append_string(serial, used, json_object_get_string(o), (size_t)json_object_get_string_len(o));
+	case json_type_array:
+		if (append(serial, used, "[", 1) < 0)
+			return -1;
+		n = json_object_array_length(o);
+		for (i = 0 ; i < n ; i++)
+			if ((i && append(serial, used, ",", 1) < 0)
+			 || append_json(serial, used, json_object_array_get_idx(o, i)) < 0)
+				return -1;
+		return append(serial, used, "]", 1);
+	case json_type_object:
+		if (append(serial, used, "{", 1) < 0)
+			return -1;
+		it = json_object_iter_begin(o);
+		end = json_object_iter_end(o);
+		for (i = 0 ; !json_object_iter_equal(&it, &end) ; i++, json_object_iter_next(&it)) {
+			s = json_object_iter_peek_name(&it);
+			if ((i && append(serial, used, ",", 1) < 0)
+			 || append_string(serial, used, s, strlen(s)) < 0
+			 || append(serial, used, ":", 1) < 0
+			 || append_json(serial, used, json_object_iter_peek_value(&it)) < 0)
+				return -1;
+		}
+		return append(serial, used, "}", 1);
+	default:
+		s = format_scalar(buffer, o, &length);
+		return append(serial, used, s, length);
+	}
+}
+
+/* gives back the serialized text 'value' to 'closure' */
+static void release_serial(const char *value, void *closure)
+{
+	struct expl *e = closure;
+	struct serial *s = (struct serial*)(value - offsetof(struct serial, text));
+
+	if (e->serial == NULL)
+		e->serial = s;
+	else
+		free(s);
+}
+
 static int start(void *closure)
 {
 	struct expl *e = closure;
@@ -38,52 +278,139 @@ static int start(void *closure)
 	e->stack[0].obj = e->root;
 	e->stack[0].index = 0;
 	e->stack[0].count = 1;
+	e->stack[0].is_objiter = 0;
+	e->stack[0].stamp = 0;
+	e->stamp = 0;
+	memset(e->memo, 0, sizeof e->memo);
+	e->serial = NULL;
 	return MUSTACH_OK;
 }
 
-static int compare(void *closure, const char *value)
+static void stop(void *closure, int status)
+{
+	struct expl *e = closure;
+	(void)status;
+	free(e->serial);
+}
+
+static int compare(void *closure, const struct mustach_wrap_value *value)
 {
 	struct expl *e = closure;
 	struct json_object *o = e->selection;
+	struct serial *serial;
+	const char *s;
+	size_t used;
 	double d;
 	int64_t i;
+	int r;
 
 	switch (json_object_get_type(o)) {
 	case json_type_double:
-		d = json_object_get_double(o) - atof(value);
+		d = json_object_get_double(o) - value->real;
 		return d < 0 ? -1 : d > 0 ? 1 : 0;
 	case json_type_int:
-		i = json_object_get_int64(o) - (int64_t)atoll(value);
-		return i < 0 ? -1 : i > 0 ? 1 : 0;
+		i = json_object_get_int64(o);
+		if (value->type == Mustach_Wrap_Double) {
+			d = (double)i - value->real;
+			return d < 0 ? -1 : d > 0 ? 1 : 0;
+		}
+		return i < value->integer ? -1 : i > value->integer ? 1 : 0;
+	case json_type_string:
+		return strcmp(json_object_get_string(o), value->string);
+	case json_type_array:
+	case json_type_object:
+		serial = e->serial;
+		used = 0;
+		r = append_json(&serial, &used, o) < 0 || append(&serial, &used, "", 1) < 0
+			? -1 : strcmp(serial->text, value->string);
+		e->serial = serial;
+		return r;
 	default:
-		return strcmp(json_object_get_string(o), value);
+		s = format_scalar(e->number, o, &used);
+		return strcmp(s, value->string);
 	}
 }
 
-static int sel(void *closure, const char *name)
+/*
+ * get in 'o' the member of key 'atom' of 'obj', returns 1 if found or 0.
+ * The hash of the key for the table of 'obj' is remembered in 'm' when
+ * not NULL.
+ */
+static int getmember(struct json_object *obj, const struct mustach_wrap_atom *atom, struct memo_hash *m, struct json_object **o)
+{
+#if JSON_C_HASH
+	struct lh_table *t;
+	struct lh_entry *entry;
+
+	if (m != NULL) {
+		t = json_object_get_object(obj);
+		if (t == NULL)
+			entry = NULL;
+		else {
+			if (m->hashfn != t->hash_fn) {
+				m->hashfn = t->hash_fn;
+				m->hash = lh_get_hash(t, atom->name);
+			}
+			entry = lh_table_lookup_entry_w_hash(t, atom->name, m->hash);
+		}
+		*o = entry == NULL ? NULL : (struct json_object*)entry->v;
+		return entry != NULL;
+	}
+#else
+	(void)m;
+#endif
+	return json_object_object_get_ex(obj, atom->name, o);
+}
+
+static int sel_atom(void *closure, const struct mustach_wrap_atom *atom)
 {
 	struct expl *e = closure;
 	struct json_object *o;
+	struct mustach_wrap_memo *m;
+	struct memo_hash *h = NULL;
 	int i, r;
 
-	if (name == NULL) {
-		o = e->stack[e->depth].obj;
-		r = 1;
-	} else {
-		i = e->depth;
-		while (i >= 0 && !json_object_object_get_ex(e->stack[i].obj, name, &o))
-			i--;
-		if (i >= 0)
-			r = 1;
-		else {
-			o = NULL;
-			r = 0;
+	m = mustach_wrap_memo_get(e->memo, SEL_MEMO_SIZE, atom);
+#if JSON_C_HASH
+	if (m != NULL) {
+		h = &e->hashes[m - e->memo];
+		if (m->depth == MUSTACH_WRAP_MEMO_NEW)
+			h->hashfn = NULL;
+	}
+#endif
+	for (i = e->depth ; i >= 0 ; i--) {
+		if (mustach_wrap_memo_hit(m, i, e->stack[i].stamp)) {
+			i = m->depth;
+			o = (struct json_object*)m->value;
+			break;
 		}
+		if (getmember(e->stack[i].obj, atom, h, &o))
+			break;
 	}
+	if (i >= 0)
+		r = 1;
+	else {
+		o = NULL;
+		r = 0;
+	}
+	mustach_wrap_memo_set(m, e->stamp, i, o, 0);
 	e->selection = o;
 	return r;
 }
 
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	struct mustach_wrap_atom atom;
+
+	if (name != NULL) {
+		mustach_wrap_make_atom(&atom, name);
+		return sel_atom(closure, &atom);
+	}
+	e->selection = e->stack[e->depth].obj;
+	return 1;
+}
+
 static int subsel(void *closure, const char *name)
 {
 	struct expl *e = closure;
@@ -131,6 +458,7 @@ static int enter(void *closure, int objiter)
 		e->stack[e->depth].index = 0;
 	} else
 		goto not_entering;
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 
 not_entering:
@@ -150,6 +478,7 @@ static int next(void *closure)
 		if (json_object_iter_equal(&e->stack[e->depth].iter, &e->stack[e->depth].enditer))
 			return 0;
 		e->stack[e->depth].obj = json_object_iter_peek_value(&e->stack[e->depth].iter);
+		e->stack[e->depth].stamp = ++e->stamp;
 		return 1;
 	}
 
@@ -158,6 +487,7 @@ static int next(void *closure)
 		return 0;
 
 	e->stack[e->depth].obj = json_object_array_get_idx(e->stack[e->depth].cont, e->stack[e->depth].index);
+	e->stack[e->depth].stamp = ++e->stamp;
 	return 1;
 }
 
@@ -175,7 +505,9 @@ static int leave(void *closure)
 static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 {
 	struct expl *e = closure;
+	struct serial *serial;
 	const char *s;
+	size_t used;
 
 	if (key)
 		s = e->stack[e->depth].is_objiter
@@ -185,63 +517,209 @@ static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 		switch (json_object_get_type(e->selection)) {
 		case json_type_string:
 			s = json_object_get_string(e->selection);
+			sbuf->length = (size_t)json_object_get_string_len(e->selection);
 			break;
 		case json_type_null:
 			s = "";
 			break;
+		case json_type_array:
+		case json_type_object:
+			/* the text is given to sbuf until its release */
+			serial = e->serial;
+			e->serial = NULL;
+			used = 0;
+			if (append_json(&serial, &used, e->selection) < 0
+			 || append(&serial, &used, "", 1) < 0) {
+				free(serial);
+				return MUSTACH_ERROR_SYSTEM;
+			}
+			s = serial->text;
+			sbuf->length = used - 1;
+			sbuf->releasecb = release_serial;
+			sbuf->closure = e;
+			break;
 		default:
-			s = json_object_to_json_string_ext(e->selection, 0);
+			s = format_scalar(e->number, e->selection, &sbuf->length);
 			break;
 		}
 	sbuf->value = s;
 	return 1;
 }
 
+static size_t items(void *closure)
+{
+	struct expl *e = closure;
+
+	if (e->stack[e->depth].is_objiter)
+		return (size_t)json_object_object_length(e->stack[e->depth].cont);
+	return (size_t)e->stack[e->depth].count;
+}
+
+static void *make_clone(void *closure, size_t index)
+{
+	struct expl *e = closure, *c;
+
+	c = malloc(sizeof *c);
+	if (c != NULL) {
+		*c = *e;
+		c->serial = NULL;
+		if (c->stack[c->depth].is_objiter) {
+			while (index--)
+				json_object_iter_next(&c->stack[c->depth].iter);
+			c->stack[c->depth].obj = json_object_iter_peek_value(&c->stack[c->depth].iter);
+		}
+		else {
+			c->stack[c->depth].index = (int)index;
+			c->stack[c->depth].obj = json_object_array_get_idx(c->stack[c->depth].cont, index);
+		}
+		c->stack[c->depth].stamp = ++c->stamp;
+	}
+	return c;
+}
+
+static void free_clone(void *clone)
+{
+	struct expl *c = clone;
+	free(c->serial);
+	free(c);
+}
+
 const struct mustach_wrap_itf mustach_json_c_wrap_itf = {
 	.start = start,
-	.stop = NULL,
-	.compare = compare,
+	.stop = stop,
+	.compare = NULL,
 	.sel = sel,
 	.subsel = subsel,
 	.enter = enter,
 	.next = next,
 	.leave = leave,
-	.get = get
+	.get = get,
+	.compare_value = compare,
+	.sel_atom = sel_atom,
+	.subsel_atom = NULL,
+	.items = items,
+	.clone = make_clone,
+	.unclone = free_clone
 };
 
 int mustach_json_c_file(const char *template, size_t length, struct json_object *root, int flags, FILE *file)
+{
+	return mustach_json_c_file_partial(template, length, root, flags, NULL, NULL, file);
+}
+
+int mustach_json_c_file_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_file(template, length, &mustach_json_c_wrap_itf, &e, flags, file);
+	return mustach_wrap_file_partial(template, length, &mustach_json_c_wrap_itf, &e, flags, partialcb, partialclosure, file);
 }
 
 int mustach_json_c_fd(const char *template, size_t length, struct json_object *root, int flags, int fd)
+{
+	return mustach_json_c_fd_partial(template, length, root, flags, NULL, NULL, fd);
+}
+
+int mustach_json_c_fd_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_fd(template, length, &mustach_json_c_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd_partial(template, length, &mustach_json_c_wrap_itf, &e, flags, partialcb, partialclosure, fd);
 }
 
 int mustach_json_c_mem(const char *template, size_t length, struct json_object *root, int flags, char **result, size_t *size)
+{
+	return mustach_json_c_mem_partial(template, length, root, flags, NULL, NULL, result, size);
+}
+
+int mustach_json_c_mem_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_mem(template, length, &mustach_json_c_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem_partial(template, length, &mustach_json_c_wrap_itf, &e, flags, partialcb, partialclosure, result, size);
 }
 
 int mustach_json_c_write(const char *template, size_t length, struct json_object *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_json_c_write_partial(template, length, root, flags, NULL, NULL, writecb, closure);
+}
+
+int mustach_json_c_write_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_write(template, length, &mustach_json_c_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write_partial(template, length, &mustach_json_c_wrap_itf, &e, flags, partialcb, partialclosure, writecb, closure);
 }
 
 int mustach_json_c_emit(const char *template, size_t length, struct json_object *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_json_c_emit_partial(template, length, root, flags, NULL, NULL, emitcb, closure);
+}
+
+int mustach_json_c_emit_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_emit_partial(template, length, &mustach_json_c_wrap_itf, &e, flags, partialcb, partialclosure, emitcb, closure);
+}
+
+int mustach_json_c_compiled_file(const struct mustach_compiled *compiled, struct json_object *root, FILE *file)
+{
+	return mustach_json_c_compiled_file_partial(compiled, root, NULL, NULL, file);
+}
+
+int mustach_json_c_compiled_file_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_file_partial(compiled, &mustach_json_c_wrap_itf, &e, partialcb, partialclosure, file);
+}
+
+int mustach_json_c_compiled_fd(const struct mustach_compiled *compiled, struct json_object *root, int fd)
+{
+	return mustach_json_c_compiled_fd_partial(compiled, root, NULL, NULL, fd);
+}
+
+int mustach_json_c_compiled_fd_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_fd_partial(compiled, &mustach_json_c_wrap_itf, &e, partialcb, partialclosure, fd);
+}
+
+int mustach_json_c_compiled_mem(const struct mustach_compiled *compiled, struct json_object *root, char **result, size_t *size)
+{
+	return mustach_json_c_compiled_mem_partial(compiled, root, NULL, NULL, result, size);
+}
+
+int mustach_json_c_compiled_mem_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_mem_partial(compiled, &mustach_json_c_wrap_itf, &e, partialcb, partialclosure, result, size);
+}
+
+int mustach_json_c_compiled_write(const struct mustach_compiled *compiled, struct json_object *root, mustach_write_cb_t *writecb, void *closure)
+{
+	return mustach_json_c_compiled_write_partial(compiled, root, NULL, NULL, writecb, closure);
+}
+
+int mustach_json_c_compiled_write_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_compiled_write_partial(compiled, &mustach_json_c_wrap_itf, &e, partialcb, partialclosure, writecb, closure);
+}
+
+int mustach_json_c_compiled_emit(const struct mustach_compiled *compiled, struct json_object *root, mustach_emit_cb_t *emitcb, void *closure)
+{
+	return mustach_json_c_compiled_emit_partial(compiled, root, NULL, NULL, emitcb, closure);
+}
+
+int mustach_json_c_compiled_emit_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure)
 {
 	struct expl e;
 	e.root = root;
-	return mustach_wrap_emit(template, length, &mustach_json_c_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_compiled_emit_partial(compiled, &mustach_json_c_wrap_itf, &e, partialcb, partialclosure, emitcb, closure);
 }
 
 int fmustach_json_c(const char *template, struct json_object *root, FILE *file)
@@ -264,4 +742,52 @@ int umustach_json_c(const char *template, struct json_object *root, mustach_writ
 	return mustach_json_c_write(template, 0, root, -1, writecb, closure);
 }
 
+/* closure of the threads of batches */
+struct batch {
+	struct expl e; /* first, the closure of the interface */
+	struct json_object *const *roots;
+};
+
+/* sets the root of the render of 'index' */
+static int batch_set(void *closure, size_t index)
+{
+	struct batch *b = closure;
+	b->e.root = b->roots[index];
+	return MUSTACH_OK;
+}
+
+int mustach_json_c_batch(const struct mustach_compiled *compiled, struct json_object *const *roots, size_t count, int threads, struct mustach_batch_output *outputs)
+{
+	return mustach_json_c_batch_partial(compiled, roots, count, threads, NULL, NULL, outputs);
+}
+
+int mustach_json_c_batch_partial(const struct mustach_compiled *compiled, struct json_object *const *roots, size_t count, int threads, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs)
+{
+	struct batch *batch;
+	int i, rc;
+
+	if (threads < 1 || count == 0)
+		threads = 1;
+	else if ((size_t)threads > count)
+		threads = (int)count;
+	batch = malloc((size_t)threads * sizeof *batch);
+	if (batch == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	for (i = 0 ; i < threads ; i++)
+		batch[i].roots = roots;
+	rc = mustach_wrap_batch_partial(compiled, &mustach_json_c_wrap_itf, batch, sizeof *batch, threads, batch_set, count, partialcb, partialclosure, outputs);
+	free(batch);
+	return rc;
+}
 
+int mustach_json_c_render_start(const struct mustach_compiled *compiled, struct json_object *root, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	return mustach_json_c_render_start_partial(compiled, root, NULL, NULL, sinkcb, sinkclosure, result);
+}
+
+int mustach_json_c_render_start_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	struct expl e;
+	e.root = root;
+	return mustach_wrap_render_start_partial(compiled, &mustach_json_c_wrap_itf, &e, sizeof e, partialcb, partialclosure, sinkcb, sinkclosure, result);
+}
@@ -12,6 +12,9 @@
 /*
  * mustach-json-c is intended to make integration of json-c
  * library by providing integrated functions.
+ *
+ * The rendered json objects are only read, never modified, so
+ * a same tree can be rendered concurrently by several threads.
  */
 
 #include <json-c/json.h>
@@ -91,6 +94,128 @@ extern int mustach_json_c_write(const char *template, size_t length, struct json
  */
 extern int mustach_json_c_emit(const char *template, size_t length, struct json_object *root, int flags, mustach_emit_cb_t *emitcb, void *closure);
 
+/**
+ * mustach_json_c_compiled_file - Renders the 'compiled' template in 'file' for 'root'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the root json object to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_file(const struct mustach_compiled *compiled, struct json_object *root, FILE *file);
+
+/**
+ * mustach_json_c_compiled_fd - Renders the 'compiled' template in 'fd' for 'root'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the root json object to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_fd(const struct mustach_compiled *compiled, struct json_object *root, int fd);
+
+/**
+ * mustach_json_c_compiled_mem - Renders the 'compiled' template in 'result' for 'root'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the root json object to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_mem(const struct mustach_compiled *compiled, struct json_object *root, char **result, size_t *size);
+
+/**
+ * mustach_json_c_compiled_write - Renders the 'compiled' template for 'root' to custom writer 'writecb' with 'closure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the root json object to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_write(const struct mustach_compiled *compiled, struct json_object *root, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_json_c_compiled_emit - Renders the 'compiled' template for 'root' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @root:     the root json object to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_emit(const struct mustach_compiled *compiled, struct json_object *root, mustach_emit_cb_t *emitcb, void *closure);
+
+/**
+ * mustach_json_c_batch - Renders the 'compiled' template for each of the 'count'
+ * 'roots' using up to 'threads' threads, the calling thread included.
+ * The result of the render of roots[i] is given to outputs[i], the outputs
+ * are delivered in the order of the roots (see mustach_batch_output).
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @roots:    the roots to render
+ * @count:    the count of roots and of outputs
+ * @threads:  the count of threads
+ * @outputs:  the outputs of the renders
+ *
+ * Returns MUSTACH_OK if all renders succeeded or else the status of
+ * the first one that failed.
+ */
+extern int mustach_json_c_batch(const struct mustach_compiled *compiled, struct json_object *const *roots, size_t count, int threads, struct mustach_batch_output *outputs);
+
+/**
+ * mustach_json_c_render_start - Starts in 'result' the resumable render of the
+ * 'compiled' template for the json object 'root', giving its output to
+ * 'sinkcb' without blocking. The render is continued with
+ * mustach_render_step and released with mustach_render_stop.
+ *
+ * @compiled:    the compiled template to instanciate (see mustach_compile)
+ * @root:        the root json object to render, kept until the end
+ * @sinkcb:      the function receiving the output
+ * @sinkclosure: the closure to pass to 'sinkcb'
+ * @result:      the pointer receiving the render when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_render_start(const struct mustach_compiled *compiled, struct json_object *root, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result);
+
+/**
+ * mustach_json_c_file_partial, mustach_json_c_fd_partial, mustach_json_c_mem_partial,
+ * mustach_json_c_write_partial, mustach_json_c_emit_partial, their compiled
+ * counterparts, mustach_json_c_batch_partial and
+ * mustach_json_c_render_start_partial - Same as the functions without
+ * the suffix _partial but partials of the renders are provided by
+ * 'partialcb' with 'partialclosure' instead of the default behaviour
+ * (see mustach_wrap_file_partial).
+ *
+ * @partialcb:      the function providing partials or NULL for default
+ * @partialclosure: the closure for the partial function
+ */
+extern int mustach_json_c_file_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file);
+extern int mustach_json_c_fd_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd);
+extern int mustach_json_c_mem_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size);
+extern int mustach_json_c_write_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure);
+extern int mustach_json_c_emit_partial(const char *template, size_t length, struct json_object *root, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure);
+extern int mustach_json_c_compiled_file_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file);
+extern int mustach_json_c_compiled_fd_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, int fd);
+extern int mustach_json_c_compiled_mem_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size);
+extern int mustach_json_c_compiled_write_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *closure);
+extern int mustach_json_c_compiled_emit_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *closure);
+extern int mustach_json_c_batch_partial(const struct mustach_compiled *compiled, struct json_object *const *roots, size_t count, int threads, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs);
+extern int mustach_json_c_render_start_partial(const struct mustach_compiled *compiled, struct json_object *root, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result);
+
 /***************************************************************************
 * compatibility with version before 1.0
 */
@@ -15,8 +15,13 @@
 #include <fcntl.h>
 #include <string.h>
 #include <libgen.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "mustach-wrap.h"
+#if WITH_FLAT
+#include "mustach-flat.h"
+#endif
 
 static const size_t BLOCKSIZE = 8192;
 
@@ -40,6 +45,11 @@ static const char *errmsg = 0;
 static int flags = 0;
 static FILE *output = 0;
 
+/* count of threads and destination of outputs of the jobs */
+static int jobs = 1;
+static const char *outdir = NULL;
+static const char *mapfile = NULL;
+
 static void help(char *prog)
 {
 	char *name = basename(prog);
@@ -52,18 +62,52 @@ static void help(char *prog)
 		"\n"
 		"USAGE:\n"
 		"    %s [FLAGS] <json-file> <mustach-templates...>\n"
+		"    %s [FLAGS] -o <directory> <json-file> <mustach-templates...>\n"
+		"    %s [FLAGS] --map <map-file>\n"
+#if WITH_FLAT
+		"    %s --pack <json-file> <packed-file>\n"
+#endif
 		"\n"
 		"FLAGS:\n"
 		"    -h, --help     Prints help information\n"
 		"    -s, --strict   Error when a tag is undefined\n"
+		"    -j, --jobs N   Renders with N threads (0 for one per CPU)\n"
+		"    -o, --output   Writes the outputs in files of the directory\n"
+		"    --map          Renders the lines <json-file> <template> <output-file>\n"
+#if WITH_FLAT
+		"    --pack         Writes the packed file of the JSON file\n"
+		"    --stream       Reads the JSON file while rendering one template\n"
+		"    --lazy         Parses only the values of the JSON file used by templates\n"
+#endif
 		"\n"
 		"ARGS: (if a file is -, read standard input)\n"
 		"    <json-file>              JSON file with input data\n"
-		"    <mustach-templates...>   Template files to instanciate\n",
-		name);
+#if WITH_FLAT
+		"                             or packed file made by --pack\n"
+		"    <packed-file>            Packed file to write\n"
+#endif
+		"    <mustach-templates...>   Template files to instanciate\n"
+		"    <directory>              Directory of the outputs, named as the templates\n"
+		"                             without their extension .mustache\n"
+		"    <map-file>               File of the renders, one by line\n",
+		name, name, name
+#if WITH_FLAT
+		, name
+#endif
+		);
 	exit(0);
 }
 
+/* get the argument of the option *av and advance to it */
+static char *argument(char ***av)
+{
+	if (!(*av)[1]) {
+		fprintf(stderr, "Missing argument for %s\n", **av);
+		exit(1);
+	}
+	return *++*av;
+}
+
 static char *readfile(const char *filename, size_t *length)
 {
 	int f;
@@ -127,6 +171,383 @@ static char *readfile(const char *filename, size_t *length)
 static int load_json(const char *filename);
 static int process(const char *content, size_t length);
 static void close_json();
+static void *get_json();
+static int process_compiled(const struct mustach_compiled *compiled, void *json, FILE *file);
+static void free_json(void *json);
+static int max_jobs();
+
+#if WITH_FLAT
+/* the packed, streamed or lazy document being rendered or NULL */
+static struct mustach_flat *flat = NULL;
+
+/* read the JSON file while rendering? */
+static int stream = 0;
+static int streamfd = -1;
+
+/* parse the JSON file while rendering? */
+static int lazy = 0;
+
+static int pack(const char *jsonfile, const char *packedfile)
+{
+	char *t;
+	size_t length, pos;
+
+	t = readfile(jsonfile, &length);
+	if (mustach_flat_parse(t, length, &flat, &pos) < 0) {
+		if (errno == EINVAL)
+			fprintf(stderr, "Can't load json file %s\n   reason: syntax error at offset %zu\n", jsonfile, pos);
+		else
+			fprintf(stderr, "Can't load json file %s\n   reason: %s\n", jsonfile, strerror(errno));
+		exit(1);
+	}
+	free(t);
+	if (mustach_flat_save(flat, packedfile) < 0) {
+		fprintf(stderr, "Can't write packed file %s\n   reason: %s\n", packedfile, strerror(errno));
+		exit(1);
+	}
+	mustach_flat_free(flat);
+	return 0;
+}
+
+static int load(const char *filename)
+{
+	if (lazy) {
+		if (mustach_flat_lazy(filename, &flat) < 0) {
+			errmsg = strerror(errno);
+			return -1;
+		}
+		return 0;
+	}
+	if (!stream)
+		return mustach_flat_map(filename, &flat) == 0 ? 0 : load_json(filename);
+	streamfd = open(filename, O_RDONLY);
+	if (streamfd < 0 || mustach_flat_stream(streamfd, &flat) < 0) {
+		errmsg = strerror(errno);
+		return -1;
+	}
+	return 0;
+}
+
+static int render(const char *content, size_t length)
+{
+	int rc;
+
+	if (!flat)
+		return process(content, length);
+	rc = mustach_flat_file(content, length, flat, flags, output);
+	if (rc == MUSTACH_ERROR_SYSTEM && (stream || lazy))
+		fprintf(stderr, "Error while reading json file: %s\n", strerror(errno));
+	return rc;
+}
+
+static void unload()
+{
+	if (flat)
+		mustach_flat_free(flat);
+	else
+		close_json();
+	if (streamfd >= 0)
+		close(streamfd);
+}
+#else
+#define load   load_json
+#define render process
+#define unload close_json
+#endif
+
+/*
+ * Jobs rendering many templates for many JSON files: each file is
+ * loaded once, each template is compiled once and the renders are
+ * shared between threads, each writing its own output file.
+ */
+
+/* a JSON file */
+struct data {
+	const char *name;
+	void *json;
+#if WITH_FLAT
+	struct mustach_flat *flat;
+#endif
+};
+
+/* a template file */
+struct template {
+	const char *name;
+	struct mustach_compiled *compiled;
+};
+
+/* a render of a template for a JSON file in an output file */
+struct job {
+	size_t data;      /* index of the JSON file */
+	size_t template;  /* index of the template file */
+	char *output;     /* name of the output file */
+	int status;       /* status of the render */
+	int error;        /* errno of MUSTACH_ERROR_SYSTEM */
+	int reading;      /* MUSTACH_ERROR_SYSTEM while reading the JSON file */
+};
+
+static struct data *datas = NULL;
+static size_t ndatas = 0;
+static struct template *templates = NULL;
+static size_t ntemplates = 0;
+static struct job *joblist = NULL;
+static size_t njobs = 0;
+static size_t nextjob = 0;
+static pthread_mutex_t jobmutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *grow(void *array, size_t count, size_t size)
+{
+	if (count & (count - 1))
+		return array;
+	array = realloc(array, (count ? 2 * count : 1) * size);
+	if (array == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return array;
+}
+
+/* get the index of the JSON file 'name', loading it once */
+static size_t get_data(const char *name)
+{
+	struct data *data;
+	const char *f;
+	size_t i;
+
+	for (i = 0 ; i < ndatas ; i++)
+		if (!strcmp(datas[i].name, name))
+			return i;
+	f = (name[0] == '-' && !name[1]) ? "/dev/stdin" : name;
+#if WITH_FLAT
+	flat = NULL;
+#endif
+	if (load(f) < 0) {
+		fprintf(stderr, "Can't load json file %s\n", name);
+		if(errmsg)
+			fprintf(stderr, "   reason: %s\n", errmsg);
+		exit(1);
+	}
+	datas = grow(datas, ndatas, sizeof *datas);
+	data = &datas[ndatas++];
+	data->name = name;
+#if WITH_FLAT
+	data->flat = flat;
+	data->json = flat ? NULL : get_json();
+#else
+	data->json = get_json();
+#endif
+	return i;
+}
+
+/* get the index of the template file 'name', compiling it once */
+static size_t get_template(const char *name)
+{
+	struct template *template;
+	char *t;
+	size_t i, length;
+	int s;
+
+	for (i = 0 ; i < ntemplates ; i++)
+		if (!strcmp(templates[i].name, name))
+			return i;
+	templates = grow(templates, ntemplates, sizeof *templates);
+	template = &templates[ntemplates++];
+	template->name = name;
+	t = readfile(name, &length);
+	s = mustach_compile(t, length, flags, &template->compiled);
+	free(t);
+	if (s != MUSTACH_OK) {
+		s = -s;
+		if (s < 1 || s >= (int)(sizeof errors / sizeof * errors))
+			s = 0;
+		fprintf(stderr, "Template error %s (file %s)\n", errors[s], name);
+		template->compiled = NULL;
+	}
+	return i;
+}
+
+/* adds the job rendering 'template' for 'json' in 'output' */
+static void add_job(const char *json, const char *template, char *output)
+{
+	struct job *job;
+
+	joblist = grow(joblist, njobs, sizeof *joblist);
+	job = &joblist[njobs++];
+	job->data = get_data(json);
+	job->template = get_template(template);
+	job->output = output;
+	job->status = MUSTACH_OK;
+	job->error = 0;
+	job->reading = 0;
+}
+
+/* adds the jobs rendering the 'templates' for 'json' in files of 'outdir' */
+static void add_dir_jobs(const char *json, char **templates)
+{
+	char *output, *name;
+	size_t len;
+
+	for ( ; *templates ; templates++) {
+		name = strrchr(*templates, '/');
+		name = name ? name + 1 : *templates;
+		len = strlen(name);
+		if (len > 9 && !strcmp(&name[len - 9], ".mustache"))
+			len -= 9;
+		if (asprintf(&output, "%s/%.*s", outdir, (int)len, name) < 0) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		add_job(json, *templates, output);
+	}
+}
+
+/* adds the jobs of the lines of the map file */
+static char *add_map_jobs()
+{
+	char *t, *line, *next, *fields[4];
+	int n, lino;
+
+	t = readfile(mapfile, NULL);
+	for (lino = 1, line = t ; *line ; line = next, lino++) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+		else
+			next = &line[strlen(line)];
+		for (n = 0 ; n < 4 ; n++) {
+			line += strspn(line, " \t\r");
+			if (!*line || *line == '#')
+				break;
+			fields[n] = line;
+			line += strcspn(line, " \t\r");
+			if (*line)
+				*line++ = 0;
+		}
+		if (n == 0)
+			continue;
+		if (n != 3) {
+			fprintf(stderr, "Bad line %d of map file %s\n", lino, mapfile);
+			exit(1);
+		}
+		add_job(fields[0], fields[1], strdup(fields[2]));
+	}
+	return t;
+}
+
+/* renders the job */
+static void run_job(struct job *job)
+{
+	const struct mustach_compiled *compiled = templates[job->template].compiled;
+	const struct data *data = &datas[job->data];
+	FILE *file;
+	int rc;
+
+	if (compiled == NULL)
+		return;
+	file = fopen(job->output, "w");
+	if (file == NULL) {
+		rc = MUSTACH_ERROR_SYSTEM;
+		job->error = errno;
+	}
+	else {
+#if WITH_FLAT
+		if (data->flat)
+			rc = mustach_flat_compiled_file(compiled, data->flat, file);
+		else
+#endif
+		rc = process_compiled(compiled, data->json, file);
+		if (rc == MUSTACH_ERROR_SYSTEM) {
+			job->error = errno;
+#if WITH_FLAT
+			/* lazy documents report their syntax errors when read */
+			job->reading = lazy && !ferror(file);
+#endif
+		}
+		if (fclose(file) && rc == MUSTACH_OK) {
+			rc = MUSTACH_ERROR_SYSTEM;
+			job->error = errno;
+		}
+	}
+	job->status = rc;
+}
+
+/* renders the jobs not yet taken */
+static void *run_jobs(void *arg)
+{
+	size_t i;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&jobmutex);
+		i = nextjob++;
+		pthread_mutex_unlock(&jobmutex);
+		if (i >= njobs)
+			return NULL;
+		run_job(&joblist[i]);
+	}
+}
+
+/* renders the jobs given by 'av' or by the map file */
+static int process_jobs(char **av)
+{
+	pthread_t *threads;
+	char *map = NULL;
+	size_t i;
+	int n, started, s;
+
+	if (mapfile)
+		map = add_map_jobs();
+	else if (*av)
+		add_dir_jobs(av[0], &av[1]);
+
+	/* render using this thread and the others */
+	if (jobs <= 0)
+		jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_jobs() > 0 && jobs > max_jobs())
+		jobs = max_jobs();
+	if ((size_t)jobs > njobs)
+		jobs = (int)njobs;
+	threads = jobs > 1 ? malloc((size_t)(jobs - 1) * sizeof *threads) : NULL;
+	for (started = 0 ; threads != NULL && started < jobs - 1 ; started++)
+		if (pthread_create(&threads[started], NULL, run_jobs, NULL) != 0)
+			break;
+	run_jobs(NULL);
+	for (n = 0 ; n < started ; n++)
+		pthread_join(threads[n], NULL);
+	free(threads);
+
+	/* report the errors in order */
+	for (i = 0 ; i < njobs ; i++) {
+		s = joblist[i].status;
+		if (s == MUSTACH_ERROR_SYSTEM && joblist[i].reading)
+			fprintf(stderr, "Error while reading json file %s\n   reason: %s\n", datas[joblist[i].data].name, strerror(joblist[i].error));
+		else if (s == MUSTACH_ERROR_SYSTEM)
+			fprintf(stderr, "Can't write file %s\n   reason: %s\n", joblist[i].output, strerror(joblist[i].error));
+		else if (s != MUSTACH_OK) {
+			s = -s;
+			if (s < 1 || s >= (int)(sizeof errors / sizeof * errors))
+				s = 0;
+			fprintf(stderr, "Template error %s (file %s)\n", errors[s], templates[joblist[i].template].name);
+		}
+		free(joblist[i].output);
+	}
+	free(joblist);
+	for (i = 0 ; i < ntemplates ; i++)
+		mustach_compiled_free(templates[i].compiled);
+	free(templates);
+	for (i = 0 ; i < ndatas ; i++) {
+#if WITH_FLAT
+		if (datas[i].flat) {
+			mustach_flat_free(datas[i].flat);
+			continue;
+		}
+#endif
+		free_json(datas[i].json);
+	}
+	free(datas);
+	free(map);
+	return 0;
+}
 
 int main(int ac, char **av)
 {
@@ -144,10 +565,46 @@ int main(int ac, char **av)
 			help(prog);
 		if (!strcmp(*av, "-s") || !strcmp(*av, "--strict"))
 			flags |= Mustach_With_ErrorUndefined;
+		if (!strcmp(*av, "-j") || !strcmp(*av, "--jobs"))
+			jobs = atoi(argument(&av));
+		if (!strcmp(*av, "-o") || !strcmp(*av, "--output"))
+			outdir = argument(&av);
+		if (!strcmp(*av, "--map"))
+			mapfile = argument(&av);
+#if WITH_FLAT
+		if (!strcmp(*av, "--pack")) {
+			if (!av[1] || !av[2]) {
+				fprintf(stderr, "Missing files for --pack\n");
+				exit(1);
+			}
+			return pack(av[1], av[2]);
+		}
+		if (!strcmp(*av, "--stream"))
+			stream = 1;
+		if (!strcmp(*av, "--lazy"))
+			lazy = 1;
+#endif
+	}
+	if (outdir || mapfile) {
+		if (mapfile && (outdir || *av)) {
+			fprintf(stderr, "No files nor output directory with --map\n");
+			exit(1);
+		}
+#if WITH_FLAT
+		if (stream) {
+			fprintf(stderr, "No --stream with -o or --map\n");
+			exit(1);
+		}
+#endif
+		return process_jobs(av);
+	}
+	if (jobs != 1) {
+		fprintf(stderr, "Option -j needs -o or --map\n");
+		exit(1);
 	}
 	if (*av) {
 		f = (av[0][0] == '-' && !av[0][1]) ? "/dev/stdin" : av[0];
-		s = load_json(f);
+		s = load(f);
 		if (s < 0) {
 			fprintf(stderr, "Can't load json file %s\n", av[0]);
 			if(errmsg)
@@ -156,7 +613,7 @@ int main(int ac, char **av)
 		}
 		while(*++av) {
 			t = readfile(*av, &length);
-			s = process(t, length);
+			s = render(t, length);
 			free(t);
 			if (s != MUSTACH_OK) {
 				s = -s;
@@ -165,7 +622,7 @@ int main(int ac, char **av)
 				fprintf(stderr, "Template error %s (file %s)\n", errors[s], *av);
 			}
 		}
-		close_json();
+		unload();
 	}
 	return 0;
 }
@@ -173,6 +630,7 @@ int main(int ac, char **av)
 #define MUSTACH_TOOL_JSON_C  1
 #define MUSTACH_TOOL_JANSSON 2
 #define MUSTACH_TOOL_CJSON   3
+#define MUSTACH_TOOL_FLAT    4
 
 #if TOOL == MUSTACH_TOOL_JSON_C
 
@@ -201,6 +659,18 @@ static void close_json()
 {
 	json_object_put(o);
 }
+static void *get_json()
+{
+	return o;
+}
+static int process_compiled(const struct mustach_compiled *compiled, void *json, FILE *file)
+{
+	return mustach_json_c_compiled_file(compiled, json, file);
+}
+static void free_json(void *json)
+{
+	json_object_put(json);
+}
 
 #elif TOOL == MUSTACH_TOOL_JANSSON
 
@@ -225,6 +695,18 @@ static void close_json()
 {
 	json_decref(o);
 }
+static void *get_json()
+{
+	return o;
+}
+static int process_compiled(const struct mustach_compiled *compiled, void *json, FILE *file)
+{
+	return mustach_jansson_compiled_file(compiled, json, file);
+}
+static void free_json(void *json)
+{
+	json_decref(json);
+}
 
 #elif TOOL == MUSTACH_TOOL_CJSON
 
@@ -249,7 +731,76 @@ static void close_json()
 {
 	cJSON_Delete(o);
 }
+static void *get_json()
+{
+	return o;
+}
+static int process_compiled(const struct mustach_compiled *compiled, void *json, FILE *file)
+{
+	return mustach_cJSON_compiled_file(compiled, json, file);
+}
+static void free_json(void *json)
+{
+	cJSON_Delete(json);
+}
+
+#elif TOOL == MUSTACH_TOOL_FLAT
+
+#include <errno.h>
+#include "mustach-flat.h"
+
+static struct mustach_flat *o;
+static char errbuf[100];
+static int load_json(const char *filename)
+{
+	char *t;
+	size_t length, pos;
+	int rc;
+
+	t = readfile(filename, &length);
+	rc = mustach_flat_parse(t, length, &o, &pos);
+	if (rc < 0) {
+		if (errno == EINVAL)
+			snprintf(errbuf, sizeof errbuf, "syntax error at offset %zu", pos);
+		else
+			snprintf(errbuf, sizeof errbuf, "%s", strerror(errno));
+		errmsg = errbuf;
+	}
+	free(t);
+	return rc;
+}
+static int process(const char *content, size_t length)
+{
+	return mustach_flat_file(content, length, o, flags, output);
+}
+static void close_json()
+{
+	mustach_flat_free(o);
+}
+static void *get_json()
+{
+	return o;
+}
+static int process_compiled(const struct mustach_compiled *compiled, void *json, FILE *file)
+{
+	return mustach_flat_compiled_file(compiled, json, file);
+}
+static void free_json(void *json)
+{
+	mustach_flat_free(json);
+}
 
 #else
 #error "no defined json library"
 #endif
+
+/* returns the maximal count of threads sharing the json values or 0 if no limit */
+static int max_jobs()
+{
+#if TOOL == MUSTACH_TOOL_JANSSON && JANSSON_VERSION_HEX < 0x020d00
+	/* dumps of arrays and objects mark them before jansson 2.13 */
+	return 1;
+#else
+	return 0;
+#endif
+}
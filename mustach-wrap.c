@@ -11,6 +11,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <locale.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #ifdef _WIN32
 #include <malloc.h>
 #endif
@@ -22,9 +29,53 @@
 # define INCLUDE_PARTIAL_EXTENSION ".mustache"
 #endif
 
+#if !defined(PARTIAL_CACHE_INTERVAL)
+# define PARTIAL_CACHE_INTERVAL 1000 /* milliseconds */
+#endif
+
+#if !defined(PATH_CACHE_BUCKETS)
+# define PATH_CACHE_BUCKETS 32
+#endif
+
+#if !defined(PARTIAL_CACHE_BUCKETS)
+# define PARTIAL_CACHE_BUCKETS 61
+#endif
+
+#if !defined(REGISTRY_BUCKETS)
+# define REGISTRY_BUCKETS 257
+#endif
+
+#if !defined(PARALLEL_SECTION_ITEMS)
+# define PARALLEL_SECTION_ITEMS 1024 /* minimal count of items of sections split between threads */
+#endif
+
 /* global hook for partials */
 int (*mustach_wrap_get_partial)(const char *name, struct mustach_sbuf *sbuf) = NULL;
 
+/* length given by masking with 3 */
+enum comp {
+	C_no = 0,
+	C_eq = 1,
+	C_lt = 5,
+	C_le = 6,
+	C_gt = 9,
+	C_ge = 10
+};
+
+/* parsed form of a selection name, cached for the duration of a render */
+struct path {
+	struct path *next;  /* next path of same hash */
+	const char *name;   /* the name as given by the template */
+	const char *value;  /* the value to compare or NULL */
+	struct mustach_wrap_value typed; /* the typed value to compare */
+	enum comp comp;     /* the comparator */
+	int negate;         /* the comparison is negated */
+	int dot;            /* selection of the current item */
+	int objiter;        /* the last key is * of object iteration */
+	unsigned count;     /* count of keys */
+	struct mustach_wrap_atom *keys; /* the keys */
+};
+
 /* internal structure for wrapping */
 struct wrap {
 	/* original interface */
@@ -41,16 +92,24 @@ struct wrap {
 
 	/* write callback */
 	mustach_write_cb_t *writecb;
-};
 
-/* length given by masking with 3 */
-enum comp {
-	C_no = 0,
-	C_eq = 1,
-	C_lt = 5,
-	C_le = 6,
-	C_gt = 9,
-	C_ge = 10
+	/* partial callback */
+	mustach_partial_cb_t *partialcb;
+	void *partialclosure;
+
+	/* parsed selection names, kept after the render if 'keep' is set */
+	struct path *paths[PATH_CACHE_BUCKETS];
+	int keep;
+
+	/* allocated for a resumable render and released by 'stop' */
+	int owned;
+
+	/* 'start' of the interface was called */
+	int started;
+
+	/* output gathered for the write callback */
+	size_t oused;
+	char obuf[MUSTACH_OUTPUT_BUFFER_SIZE];
 };
 
 enum sel {
@@ -134,21 +193,127 @@ static char *getkey(char **head, int sflags)
 	return result;
 }
 
-static enum sel sel(struct wrap *w, const char *name)
+uint32_t mustach_wrap_hash(const char *text, size_t length)
 {
-	enum sel result;
-	int i, j, sflags, scmp;
+	uint32_t h = 5381;
+	while (length--)
+		h = h * 33 + (unsigned char)*text++;
+	return h;
+}
+
+/* computes the hash code of 'name' */
+static uint32_t hash_name(const char *name)
+{
+	return mustach_wrap_hash(name, strlen(name));
+}
+
+void mustach_wrap_make_atom(struct mustach_wrap_atom *atom, const char *name)
+{
+	size_t n = strlen(name);
+
+	atom->name = name;
+	atom->length = n;
+	atom->hash = mustach_wrap_hash(name, n);
+}
+
+struct mustach_wrap_memo *mustach_wrap_memo_get(struct mustach_wrap_memo *memos, unsigned count, const struct mustach_wrap_atom *atom)
+{
+	struct mustach_wrap_memo *m;
+
+	if (atom->length == 0 || atom->length >= MUSTACH_WRAP_MEMO_NAME)
+		return NULL;
+	m = &memos[atom->hash % count];
+	if (memcmp(m->name, atom->name, atom->length + 1)) {
+		memcpy(m->name, atom->name, atom->length + 1);
+		m->depth = MUSTACH_WRAP_MEMO_NEW;
+	}
+	return m;
+}
+
+int mustach_wrap_memo_hit(const struct mustach_wrap_memo *memo, int depth, uint64_t stamp)
+{
+	/* the frames from 'depth' down to the one found are unchanged */
+	return memo != NULL
+		&& memo->depth != MUSTACH_WRAP_MEMO_NEW
+		&& memo->depth <= depth
+		&& stamp <= memo->stamp;
+}
+
+void mustach_wrap_memo_set(struct mustach_wrap_memo *memo, uint64_t stamp, int depth, const void *value, uint64_t data)
+{
+	if (memo != NULL) {
+		memo->stamp = stamp;
+		memo->depth = depth;
+		memo->value = value;
+		memo->data = data;
+	}
+}
+
+/*
+ * parses the floating number 'text' with the dot as decimal point
+ * and returns 1 if 'text' is entirely a number or else 0
+ */
+static int parse_real(const char *text, double *real)
+{
+	const char *point = localeconv()->decimal_point;
+	size_t lpoint = strlen(point);
+	char buffer[1 + strlen(text) * lpoint], *end, *iter;
+
+	/* translate the dot to the decimal point of the locale */
+	if (point[0] == '.' && !point[1])
+		*real = strtod(text, &end);
+	else {
+		for (iter = buffer ; *text ; text++)
+			if (*text != '.')
+				*iter++ = *text;
+			else {
+				memcpy(iter, point, lpoint);
+				iter += lpoint;
+			}
+		*iter = 0;
+		text = buffer;
+		*real = strtod(text, &end);
+	}
+	return end != text && !*end;
+}
+
+/* parses the value to compare 'text' to its typed form 'value' */
+static void parse_value(struct mustach_wrap_value *value, const char *text)
+{
+	char *end;
+
+	value->string = text;
+	errno = 0;
+	value->integer = (int64_t)strtoll(text, &end, 10);
+	if (end != text && !*end && errno == 0) {
+		value->type = Mustach_Wrap_Int;
+		value->real = (double)value->integer;
+	}
+	else if (parse_real(text, &value->real))
+		value->type = Mustach_Wrap_Double;
+	else if (!strcmp(text, "true") || !strcmp(text, "false")) {
+		value->type = Mustach_Wrap_Bool;
+		value->integer = text[0] == 't';
+		value->real = (double)value->integer;
+	}
+	else if (!strcmp(text, "null"))
+		value->type = Mustach_Wrap_Null;
+	else
+		value->type = Mustach_Wrap_String;
+}
+
+/*
+ * parses the selection 'copy' with 'flags' to 'path'. The keys are
+ * recorded in 'keys' that must have at least 1 + strlen(copy) / 2 entries
+ */
+static void path_parse(struct path *path, char *copy, struct mustach_wrap_atom *keys, int flags)
+{
+	int sflags;
 	char *key, *value;
 	enum comp k;
 
-	/* make a local writeable copy */
-	size_t lenname = 1 + strlen(name);
-	char buffer[lenname];
-	char *copy = buffer;
-	memcpy(copy, name, lenname);
-
 	/* check if matches json pointer selection */
-	sflags = w->flags;
+	sflags = flags;
 	if (sflags & Mustach_With_JsonPointer) {
 		if (copy[0] == '/')
 			copy++;
@@ -163,126 +328,223 @@ static enum sel sel(struct wrap *w, const char *name)
 		k = C_no;
 		value = NULL;
 	}
+	path->comp = k;
+	path->negate = value != NULL && value[0] == '!';
+	path->value = value == NULL ? NULL : &value[path->negate];
+	if (path->value != NULL)
+		parse_value(&path->typed, path->value);
 
 	/* case of . alone if Mustach_With_SingleDot? */
-	if (copy[0] == '.' && copy[1] == 0 /*&& (sflags & Mustach_With_SingleDot)*/)
-		/* yes, select current */
+	path->dot = copy[0] == '.' && copy[1] == 0 /*&& (sflags & Mustach_With_SingleDot)*/;
+
+	/* extract the keys */
+	path->keys = keys;
+	path->count = 0;
+	if (!path->dot)
+		while ((key = getkey(&copy, sflags)) != NULL)
+			mustach_wrap_make_atom(&keys[path->count++], key);
+
+	/* is the last key '*' of object iteration? */
+	path->objiter = path->count
+		&& !value
+		&& (flags & Mustach_With_ObjectIter)
+		&& keys[path->count - 1].name[0] == '*'
+		&& !keys[path->count - 1].name[1];
+}
+
+/* get the parsed path of 'name', parsing it the first time, NULL if out of memory */
+static struct path *path_get(struct wrap *w, const char *name)
+{
+	struct path *path, **prev;
+	size_t length, nkeys;
+	char *text;
+
+	/* search in the cache */
+	prev = &w->paths[hash_name(name) % PATH_CACHE_BUCKETS];
+	while ((path = *prev) != NULL) {
+		if (!strcmp(path->name, name))
+			return path;
+		prev = &path->next;
+	}
+
+	/* create the entry holding keys, name and parsed text */
+	length = 1 + strlen(name);
+	nkeys = 1 + length / 2;
+	path = malloc(sizeof *path + nkeys * sizeof *path->keys + 2 * length);
+	if (path != NULL) {
+		path->keys = (struct mustach_wrap_atom*)&path[1];
+		text = (char*)&path->keys[nkeys];
+		path->name = memcpy(&text[length], name, length);
+		memcpy(text, name, length);
+		path_parse(path, text, path->keys, w->flags);
+		path->next = NULL;
+		*prev = path;
+	}
+	return path;
+}
+
+/* releases the parsed paths */
+static void path_release(struct wrap *w)
+{
+	struct path *path;
+	int i;
+
+	for (i = 0 ; i < PATH_CACHE_BUCKETS ; i++)
+		while ((path = w->paths[i]) != NULL) {
+			w->paths[i] = path->next;
+			free(path);
+		}
+}
+
+/* selects the item of 'key', using its atom if the interface accepts it */
+static int sel_key(struct wrap *w, const struct mustach_wrap_atom *key)
+{
+	return w->itf->sel_atom ? w->itf->sel_atom(w->closure, key) : w->itf->sel(w->closure, key->name);
+}
+
+/* selects the field 'key' of the selection, using its atom if the interface accepts it */
+static int subsel_key(struct wrap *w, const struct mustach_wrap_atom *key)
+{
+	return w->itf->subsel_atom ? w->itf->subsel_atom(w->closure, key) : w->itf->subsel(w->closure, key->name);
+}
+
+static enum sel sel_path(struct wrap *w, const struct path *path)
+{
+	enum sel result;
+	unsigned i;
+	int j, scmp;
+
+	if (path->dot)
+		/* select current */
 		result = w->itf->sel(w->closure, NULL) ? S_ok : S_none;
+	else if (path->count == 0)
+		return S_none;
 	else
 	{
-		/* not the single dot, extract the first key */
-		key = getkey(&copy, sflags);
-		if (key == NULL)
-			return 0;
-
 		/* select the root item */
-		if (w->itf->sel(w->closure, key))
+		if (sel_key(w, &path->keys[0]))
 			result = S_ok;
-		else if (key[0] == '*'
-		      && !key[1]
-		      && !value
-		      && !*copy
-		      && (w->flags & Mustach_With_ObjectIter)
+		else if (path->objiter
+		      && path->count == 1
 		      && w->itf->sel(w->closure, NULL))
 			result = S_ok_or_objiter;
 		else
 			result = S_none;
-		if (result == S_ok) {
-			/* iterate the selection of sub items */
-			key = getkey(&copy, sflags);
-			while(result == S_ok && key) {
-				if (w->itf->subsel(w->closure, key))
-					/* nothing */;
-				else if (key[0] == '*'
-				      && !key[1]
-				      && !value
-				      && !*copy
-				      && (w->flags & Mustach_With_ObjectIter))
-					result = S_objiter;
-				else
-					result = S_none;
-				key = getkey(&copy, sflags);
-			}
+		/* iterate the selection of sub items */
+		for (i = 1 ; result == S_ok && i < path->count ; i++) {
+			if (subsel_key(w, &path->keys[i]))
+				/* nothing */;
+			else if (path->objiter && i + 1 == path->count)
+				result = S_objiter;
+			else
+				result = S_none;
 		}
 	}
 	/* should it be compared? */
-	if (result == S_ok && value) {
-		if (!w->itf->compare)
+	if (result == S_ok && path->value) {
+		if (!w->itf->compare && !w->itf->compare_value)
 			result = S_none;
 		else {
-			i = value[0] == '!';
-			scmp = w->itf->compare(w->closure, &value[i]);
-			switch (k) {
+			if (w->itf->compare_value)
+				scmp = w->itf->compare_value(w->closure, &path->typed);
+			else
+				scmp = w->itf->compare(w->closure, path->value);
+			switch (path->comp) {
 			case C_eq: j = scmp == 0; break;
 			case C_lt: j = scmp < 0; break;
 			case C_le: j = scmp <= 0; break;
 			case C_gt: j = scmp > 0; break;
 			case C_ge: j = scmp >= 0; break;
-			default: j = i; break;
+			default: j = path->negate; break;
 			}
-			if (i == j)
+			if (path->negate == j)
 				result = S_none;
 		}
 	}
 	return result;
 }
 
+static enum sel sel(struct wrap *w, const char *name)
+{
+	struct path *path = path_get(w, name);
+	if (path != NULL)
+		return sel_path(w, path);
+	else {
+		/* out of memory, parse a local writeable copy */
+		struct path local;
+		size_t length = 1 + strlen(name);
+		char copy[length];
+		struct mustach_wrap_atom keys[1 + length / 2];
+		memcpy(copy, name, length);
+		path_parse(&local, copy, keys, w->flags);
+		return sel_path(w, &local);
+	}
+}
+
 static int start(void *closure)
 {
 	struct wrap *w = closure;
+	w->started = 1;
 	return w->itf->start ? w->itf->start(w->closure) : MUSTACH_OK;
 }
 
 static void stop(void *closure, int status)
 {
 	struct wrap *w = closure;
-	if (w->itf->stop)
+	if (!w->keep)
+		path_release(w);
+	if (w->itf->stop && w->started)
 		w->itf->stop(w->closure, status);
+	if (w->owned)
+		free(w);
 }
 
-static int write(struct wrap *w, const char *buffer, size_t size, FILE *file)
+static int flush(struct wrap *w, FILE *file)
 {
-	int r;
+	size_t n = w->oused;
 
-	if (w->writecb)
-		r = w->writecb(file, buffer, size);
-	else
-		r = fwrite(buffer, 1, size, file) == size ? MUSTACH_OK : MUSTACH_ERROR_SYSTEM;
-	return r;
+	w->oused = 0;
+	return n ? w->writecb(file, w->obuf, n) : MUSTACH_OK;
+}
+
+static int owrite(struct wrap *w, const char *buffer, size_t size, FILE *file)
+{
+	int rc;
+
+	if (!w->writecb)
+		return fwrite(buffer, 1, size, file) == size ? MUSTACH_OK : MUSTACH_ERROR_SYSTEM;
+	if (size > sizeof w->obuf - w->oused) {
+		rc = flush(w, file);
+		if (rc < 0)
+			return rc;
+		if (size >= sizeof w->obuf)
+			return w->writecb(file, buffer, size);
+	}
+	memcpy(&w->obuf[w->oused], buffer, size);
+	w->oused += size;
+	return MUSTACH_OK;
+}
+
+struct wrap_file { struct wrap *w; FILE *file; };
+
+static int write_cb(void *closure, const char *buffer, size_t size)
+{
+	struct wrap_file *wf = closure;
+	return owrite(wf->w, buffer, size, wf->file);
 }
 
 static int emit(void *closure, const char *buffer, size_t size, int escape, FILE *file)
 {
 	struct wrap *w = closure;
-	int r;
-	size_t s, i;
-	char car;
+	struct wrap_file wf;
 
 	if (w->emitcb)
-		r = w->emitcb(file, buffer, size, escape);
-	else if (!escape)
-		r = write(w, buffer, size, file);
-	else {
-		i = 0;
-		r = MUSTACH_OK;
-		while(i < size && r == MUSTACH_OK) {
-			s = i;
-			while (i < size && (car = buffer[i]) != '<' && car != '>' && car != '&' && car != '"')
-				i++;
-			if (i != s)
-				r = write(w, &buffer[s], i - s, file);
-			if (i < size && r == MUSTACH_OK) {
-				switch(car) {
-				case '<': r = write(w, "&lt;", 4, file); break;
-				case '>': r = write(w, "&gt;", 4, file); break;
-				case '&': r = write(w, "&amp;", 5, file); break;
-				case '"': r = write(w, "&quot;", 6, file); break;
-				}
-				i++;
-			}
-		}
-	}
-	return r;
+		return w->emitcb(file, buffer, size, escape);
+	if (!escape)
+		return owrite(w, buffer, size, file);
+	wf.w = w;
+	wf.file = file;
+	return mustach_escape_html(buffer, size, write_cb, &wf);
 }
 
 static int enter(void *closure, const char *name)
@@ -315,7 +577,10 @@ static int getoptional(struct wrap *w, const char *name, struct mustach_sbuf *sb
 static int get(void *closure, const char *name, struct mustach_sbuf *sbuf)
 {
 	struct wrap *w = closure;
-	if (getoptional(w, name, sbuf) <= 0) {
+	int rc = getoptional(w, name, sbuf);
+	if (rc < 0)
+		return rc;
+	if (rc == 0) {
 		if (w->flags & Mustach_With_ErrorUndefined)
 			return MUSTACH_ERROR_UNDEFINED_TAG;
 		sbuf->value = "";
@@ -323,62 +588,669 @@ static int get(void *closure, const char *name, struct mustach_sbuf *sbuf)
 	return MUSTACH_OK;
 }
 
-static int get_partial_from_file(const char *name, struct mustach_sbuf *sbuf)
+/*
+ * Cache of partials read from files
+ *
+ * The partials read from files are kept in a process wide cache of the
+ * files indexed by their resolved path, as given by 'realpath'. The
+ * cached text is shared by all renders, and by all the names resolved
+ * to the same file, using a reference count. The resolution of the
+ * names of partials is also cached: at most once per 'interval'
+ * milliseconds, the name is resolved again (with or without extension)
+ * and a call to 'stat' checks that the file is still the same (device,
+ * inode, size, modification time). Partials not found are also cached.
+ */
+
+/* shared text of a partial */
+struct partial_text {
+	unsigned refcount;
+	size_t length;
+	char value[];
+};
+
+/* file of the cache */
+struct partial_file {
+	struct partial_file *next;
+	struct partial_text *text;
+	unsigned refcount;         /* count of names resolved to the file */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	char path[];
+};
+
+/* resolution of a name */
+struct partial_entry {
+	struct partial_entry *next;
+	struct partial_file *file; /* NULL if not found */
+	long long checked;         /* time of last check in milliseconds */
+	char name[];
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	int interval;
+	struct partial_entry *buckets[PARTIAL_CACHE_BUCKETS];
+	struct partial_file *files[PARTIAL_CACHE_BUCKETS];
+} partial_cache = { PTHREAD_MUTEX_INITIALIZER, PARTIAL_CACHE_INTERVAL, { NULL }, { NULL } };
+
+static long long now_ms(void)
 {
-	static char extension[] = INCLUDE_PARTIAL_EXTENSION;
-	size_t s;
-	long pos;
-	FILE *file;
-	char *path, *buffer;
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	return (long long)time(NULL) * 1000;
+#endif
+}
 
-	/* allocate path */
-	s = strlen(name);
-	path = malloc(s + sizeof extension);
-	if (path == NULL)
-		return MUSTACH_ERROR_SYSTEM;
+/* modification time of the file of status 'st', seconds only when not available */
+static struct timespec stat_mtime(const struct stat *st)
+{
+	struct timespec ts;
+#if defined(__APPLE__)
+	ts = st->st_mtimespec;
+#elif defined(_WIN32)
+	ts.tv_sec = st->st_mtime;
+	ts.tv_nsec = 0;
+#else
+	ts = st->st_mtim;
+#endif
+	return ts;
+}
+
+/* tells whether the modification times 'a' and 'b' are the same */
+static int same_mtime(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void partial_text_unref(struct partial_text *text)
+{
+	if (text != NULL && __atomic_sub_fetch(&text->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+		free(text);
+}
+
+static void partial_text_release(const char *value, void *closure)
+{
+	(void)value; /* unused */
+	partial_text_unref(closure);
+}
+
+/* releases 'file' for one of its names, the cache being locked */
+static void partial_file_unref(struct partial_file *file)
+{
+	struct partial_file **prev;
+
+	if (file != NULL && --file->refcount == 0) {
+		prev = &partial_cache.files[hash_name(file->path) % PARTIAL_CACHE_BUCKETS];
+		while (*prev != file)
+			prev = &(*prev)->next;
+		*prev = file->next;
+		partial_text_unref(file->text);
+		free(file);
+	}
+}
+
+/* resolve the file of the partial 'name', returns 0 if not found */
+static int partial_stat(const char *name, char *path, struct stat *st)
+{
+	static char extension[] = INCLUDE_PARTIAL_EXTENSION;
+	size_t s = strlen(name);
 
 	/* try without extension first */
 	memcpy(path, name, s + 1);
+	if (stat(path, st) == 0 && S_ISREG(st->st_mode))
+		return 1;
+	memcpy(&path[s], extension, sizeof extension);
+	if (stat(path, st) == 0 && S_ISREG(st->st_mode))
+		return 1;
+	return 0;
+}
+
+/* read the file of 'path' of 'size' */
+static struct partial_text *partial_read(const char *path, size_t size)
+{
+	struct partial_text *text;
+	FILE *file;
+
 	file = fopen(path, "r");
-	if (file == NULL) {
-		memcpy(&path[s], extension, sizeof extension);
-		file = fopen(path, "r");
+	if (file == NULL)
+		return NULL;
+	text = malloc(sizeof *text + size + 1);
+	if (text != NULL) {
+		if (size == 0 || 1 == fread(text->value, size, 1, file)) {
+			text->refcount = 1;
+			text->length = size;
+			text->value[size] = 0;
+		}
+		else {
+			free(text);
+			text = NULL;
+		}
 	}
-	free(path);
+	fclose(file);
+	return text;
+}
 
-	/* if file opened */
-	if (file == NULL)
-		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+/*
+ * get in 'result' the file of the cache for 'path' of status 'st',
+ * reading it again if changed, the cache being locked
+ */
+static int partial_file_get(const char *path, const struct stat *st, struct partial_file **result)
+{
+	struct partial_file *file, **prev;
+	struct partial_text *text;
+	struct timespec mtime = stat_mtime(st);
+	char *real;
 
-	/* compute file size */
-	if (fseek(file, 0, SEEK_END) >= 0
-	 && (pos = ftell(file)) >= 0
-	 && fseek(file, 0, SEEK_SET) >= 0) {
-		/* allocate value */
-		s = (size_t)pos;
-		buffer = malloc(s + 1);
-		if (buffer != NULL) {
-			/* read value */
-			if (1 == fread(buffer, s, 1, file)) {
-				/* force zero at end */
-				sbuf->value = buffer;
-				buffer[s] = 0;
-				sbuf->freecb = free;
-				fclose(file);
-				return MUSTACH_OK;
+	/* search the file by its resolved path */
+#ifdef _WIN32
+	real = _fullpath(NULL, path, 0);
+#else
+	real = realpath(path, NULL);
+#endif
+	if (real == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	prev = &partial_cache.files[hash_name(real) % PARTIAL_CACHE_BUCKETS];
+	while ((file = *prev) != NULL && strcmp(file->path, real))
+		prev = &file->next;
+
+	/* check it */
+	if (file == NULL
+	 || file->dev != st->st_dev
+	 || file->ino != st->st_ino
+	 || file->size != st->st_size
+	 || !same_mtime(&file->mtime, &mtime)) {
+		/* read the file */
+		text = partial_read(path, (size_t)st->st_size);
+		if (text == NULL) {
+			free(real);
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		/* create the file */
+		if (file == NULL) {
+			file = malloc(sizeof *file + strlen(real) + 1);
+			if (file == NULL) {
+				free(real);
+				partial_text_unref(text);
+				return MUSTACH_ERROR_SYSTEM;
 			}
-			free(buffer);
+			strcpy(file->path, real);
+			file->text = NULL;
+			file->refcount = 0;
+			file->next = NULL;
+			*prev = file;
 		}
+		/* record */
+		partial_text_unref(file->text);
+		file->text = text;
+		file->dev = st->st_dev;
+		file->ino = st->st_ino;
+		file->size = st->st_size;
+		file->mtime = mtime;
 	}
-	fclose(file);
-	return MUSTACH_ERROR_SYSTEM;
+	free(real);
+	*result = file;
+	return MUSTACH_OK;
+}
+
+static int get_partial_from_file(const char *name, struct mustach_sbuf *sbuf)
+{
+	static char extension[] = INCLUDE_PARTIAL_EXTENSION;
+	struct partial_entry *entry, **prev;
+	struct partial_file *file;
+	struct partial_text *text;
+	struct stat st;
+	char path[strlen(name) + sizeof extension];
+	int rc;
+	long long now;
+
+	pthread_mutex_lock(&partial_cache.mutex);
+
+	/* search the entry */
+	prev = &partial_cache.buckets[hash_name(name) % PARTIAL_CACHE_BUCKETS];
+	while ((entry = *prev) != NULL && strcmp(entry->name, name))
+		prev = &entry->next;
+
+	/* check the entry */
+	now = now_ms();
+	if (entry == NULL || partial_cache.interval < 0 || now - entry->checked >= partial_cache.interval) {
+		/* resolve the name */
+		file = NULL;
+		if (partial_stat(name, path, &st)) {
+			rc = partial_file_get(path, &st, &file);
+			if (rc != MUSTACH_OK) {
+				pthread_mutex_unlock(&partial_cache.mutex);
+				return rc;
+			}
+			file->refcount++;
+		}
+		/* create the entry */
+		if (entry == NULL) {
+			entry = malloc(sizeof *entry + strlen(name) + 1);
+			if (entry == NULL) {
+				partial_file_unref(file);
+				pthread_mutex_unlock(&partial_cache.mutex);
+				return MUSTACH_ERROR_SYSTEM;
+			}
+			strcpy(entry->name, name);
+			entry->file = NULL;
+			entry->next = NULL;
+			*prev = entry;
+		}
+		/* record */
+		partial_file_unref(entry->file);
+		entry->file = file;
+		entry->checked = now;
+	}
+
+	/* answer */
+	if (entry->file == NULL)
+		rc = MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	else {
+		text = entry->file->text;
+		__atomic_add_fetch(&text->refcount, 1, __ATOMIC_RELAXED);
+		sbuf->value = text->value;
+		sbuf->length = text->length;
+		sbuf->releasecb = partial_text_release;
+		sbuf->closure = text;
+		rc = MUSTACH_OK;
+	}
+
+	/* without caching, forget the entry */
+	if (partial_cache.interval < 0) {
+		*prev = entry->next;
+		partial_file_unref(entry->file);
+		free(entry);
+	}
+
+	pthread_mutex_unlock(&partial_cache.mutex);
+	return rc;
+}
+
+void mustach_wrap_partial_cache_interval(int milliseconds)
+{
+	pthread_mutex_lock(&partial_cache.mutex);
+	partial_cache.interval = milliseconds;
+	pthread_mutex_unlock(&partial_cache.mutex);
+	if (milliseconds < 0)
+		mustach_wrap_partial_cache_invalidate(NULL);
+}
+
+void mustach_wrap_partial_cache_invalidate(const char *name)
+{
+	struct partial_entry *entry, **prev;
+	unsigned i;
+
+	pthread_mutex_lock(&partial_cache.mutex);
+	for (i = 0 ; i < PARTIAL_CACHE_BUCKETS ; i++) {
+		prev = &partial_cache.buckets[i];
+		while ((entry = *prev) != NULL) {
+			if (name != NULL && strcmp(entry->name, name))
+				prev = &entry->next;
+			else {
+				*prev = entry->next;
+				partial_file_unref(entry->file);
+				free(entry);
+			}
+		}
+	}
+	pthread_mutex_unlock(&partial_cache.mutex);
+}
+
+/*
+ * Registries of templates
+ *
+ * The entries of a registry are never removed from their bucket before
+ * the registry is destroyed: a removed template leaves its entry without
+ * template. So the lookups read the buckets without locking while the
+ * changes, serialized by the mutex, only add entries at the head of the
+ * buckets and exchange the template of entries.
+ *
+ * A lookup increments the counter of the current epoch, reads the template
+ * and gets a reference to it, then decrements the same counter. After
+ * exchanging a template, the change waits that the counters of the two
+ * epochs, switched in turn, are zero: every lookup that could have read
+ * the old template then got its reference, so the reference of the
+ * registry can be dropped.
+ */
+
+/* a version of a template */
+struct registry_template {
+	struct mustach_wrap_template pub; /* the part given to the users */
+	unsigned refcount;
+	struct mustach_compiled *compiled;
+	char text[];
+};
+
+/* entry of a registry */
+struct registry_entry {
+	struct registry_entry *next;        /* next entry of same hash */
+	struct registry_template *template; /* the current template or NULL */
+	char *filename;                     /* file of the template or NULL */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	char name[];
+};
+
+struct mustach_wrap_registry {
+	int flags;                 /* flags of compilation */
+	unsigned epoch;            /* the epoch of the lookups */
+	unsigned long lookups[2];  /* count of running lookups by epoch */
+	pthread_mutex_t mutex;     /* serializes the changes */
+	struct registry_entry *buckets[REGISTRY_BUCKETS];
+};
+
+static void registry_template_unref(struct registry_template *template)
+{
+	if (template != NULL && __atomic_sub_fetch(&template->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		mustach_compiled_free(template->compiled);
+		free(template);
+	}
+}
+
+static void registry_template_release(const char *value, void *closure)
+{
+	(void)value; /* unused */
+	registry_template_unref(closure);
+}
+
+/* compiles the 'text' of 'length' in a new template */
+static int registry_template_make(struct mustach_wrap_registry *registry, const char *text, size_t length, struct registry_template **result)
+{
+	struct registry_template *template;
+	int rc;
+
+	template = malloc(sizeof *template + length + 1);
+	if (template == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	memcpy(template->text, text, length);
+	template->text[length] = 0;
+	rc = mustach_compile(template->text, length, registry->flags, &template->compiled);
+	if (rc < 0) {
+		free(template);
+		return rc;
+	}
+	template->refcount = 1;
+	template->pub.compiled = template->compiled;
+	template->pub.text = template->text;
+	template->pub.length = length;
+	*result = template;
+	return MUSTACH_OK;
+}
+
+/* gets a reference to the template of 'name' or NULL */
+static struct registry_template *registry_lookup(struct mustach_wrap_registry *registry, const char *name)
+{
+	struct registry_entry *entry;
+	struct registry_template *template;
+	unsigned epoch;
+
+	epoch = __atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&registry->lookups[epoch], 1, __ATOMIC_SEQ_CST);
+	entry = __atomic_load_n(&registry->buckets[hash_name(name) % REGISTRY_BUCKETS], __ATOMIC_SEQ_CST);
+	while (entry != NULL && strcmp(entry->name, name))
+		entry = entry->next;
+	template = entry == NULL ? NULL : __atomic_load_n(&entry->template, __ATOMIC_SEQ_CST);
+	if (template != NULL)
+		__atomic_add_fetch(&template->refcount, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&registry->lookups[epoch], 1, __ATOMIC_SEQ_CST);
+	return template;
+}
+
+/* waits the end of the lookups started before, the mutex being locked */
+static void registry_synchronize(struct mustach_wrap_registry *registry)
+{
+	unsigned epoch;
+	int i;
+
+	for (i = 0 ; i < 2 ; i++) {
+		epoch = __atomic_fetch_xor(&registry->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+		while (__atomic_load_n(&registry->lookups[epoch], __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+	}
+}
+
+/* replaces the template of 'entry' by 'template', the mutex being locked */
+static void registry_replace(struct mustach_wrap_registry *registry, struct registry_entry *entry, struct registry_template *template)
+{
+	struct registry_template *old;
+
+	old = __atomic_exchange_n(&entry->template, template, __ATOMIC_SEQ_CST);
+	if (old != NULL) {
+		registry_synchronize(registry);
+		registry_template_unref(old);
+	}
+}
+
+/* search the entry of 'name', the mutex being locked */
+static struct registry_entry *registry_search(struct mustach_wrap_registry *registry, const char *name)
+{
+	struct registry_entry *entry;
+
+	entry = registry->buckets[hash_name(name) % REGISTRY_BUCKETS];
+	while (entry != NULL && strcmp(entry->name, name))
+		entry = entry->next;
+	return entry;
+}
+
+/* get the entry of 'name', adding it if needed, the mutex being locked */
+static struct registry_entry *registry_entry(struct mustach_wrap_registry *registry, const char *name)
+{
+	struct registry_entry *entry, **bucket;
+
+	entry = registry_search(registry, name);
+	if (entry == NULL) {
+		entry = malloc(sizeof *entry + strlen(name) + 1);
+		if (entry != NULL) {
+			strcpy(entry->name, name);
+			entry->template = NULL;
+			entry->filename = NULL;
+			bucket = &registry->buckets[hash_name(name) % REGISTRY_BUCKETS];
+			entry->next = *bucket;
+			__atomic_store_n(bucket, entry, __ATOMIC_SEQ_CST);
+		}
+	}
+	return entry;
+}
+
+/* reads and compiles the file 'filename' of status 'st' */
+static int registry_read(struct mustach_wrap_registry *registry, const char *filename, struct stat *st, struct registry_template **result)
+{
+	struct partial_text *text;
+	int rc;
+
+	if (stat(filename, st) < 0)
+		return MUSTACH_ERROR_SYSTEM;
+	text = partial_read(filename, (size_t)st->st_size);
+	if (text == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	rc = registry_template_make(registry, text->value, text->length, result);
+	partial_text_unref(text);
+	return rc;
+}
+
+int mustach_wrap_registry_create(int flags, struct mustach_wrap_registry **result)
+{
+	struct mustach_wrap_registry *registry;
+
+	*result = registry = calloc(1, sizeof *registry);
+	if (registry == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	registry->flags = flags;
+	pthread_mutex_init(&registry->mutex, NULL);
+	return MUSTACH_OK;
+}
+
+void mustach_wrap_registry_destroy(struct mustach_wrap_registry *registry)
+{
+	struct registry_entry *entry;
+	unsigned i;
+
+	if (registry != NULL) {
+		for (i = 0 ; i < REGISTRY_BUCKETS ; i++)
+			while ((entry = registry->buckets[i]) != NULL) {
+				registry->buckets[i] = entry->next;
+				registry_template_unref(entry->template);
+				free(entry->filename);
+				free(entry);
+			}
+		pthread_mutex_destroy(&registry->mutex);
+		free(registry);
+	}
+}
+
+int mustach_wrap_registry_set(struct mustach_wrap_registry *registry, const char *name, const char *template, size_t length)
+{
+	struct registry_template *t;
+	struct registry_entry *entry;
+	int rc;
+
+	rc = registry_template_make(registry, template, length ? length : strlen(template), &t);
+	if (rc < 0)
+		return rc;
+	pthread_mutex_lock(&registry->mutex);
+	entry = registry_entry(registry, name);
+	if (entry == NULL) {
+		registry_template_unref(t);
+		rc = MUSTACH_ERROR_SYSTEM;
+	}
+	else {
+		free(entry->filename);
+		entry->filename = NULL;
+		registry_replace(registry, entry, t);
+	}
+	pthread_mutex_unlock(&registry->mutex);
+	return rc;
+}
+
+int mustach_wrap_registry_set_file(struct mustach_wrap_registry *registry, const char *name, const char *filename)
+{
+	struct registry_template *t;
+	struct registry_entry *entry;
+	struct stat st;
+	char *copy;
+	int rc;
+
+	rc = registry_read(registry, filename, &st, &t);
+	if (rc < 0)
+		return rc;
+	pthread_mutex_lock(&registry->mutex);
+	copy = strdup(filename);
+	entry = copy == NULL ? NULL : registry_entry(registry, name);
+	if (entry == NULL) {
+		free(copy);
+		registry_template_unref(t);
+		rc = MUSTACH_ERROR_SYSTEM;
+	}
+	else {
+		free(entry->filename);
+		entry->filename = copy;
+		entry->dev = st.st_dev;
+		entry->ino = st.st_ino;
+		entry->size = st.st_size;
+		entry->mtime = stat_mtime(&st);
+		registry_replace(registry, entry, t);
+	}
+	pthread_mutex_unlock(&registry->mutex);
+	return rc;
+}
+
+int mustach_wrap_registry_remove(struct mustach_wrap_registry *registry, const char *name)
+{
+	struct registry_entry *entry;
+	int rc;
+
+	pthread_mutex_lock(&registry->mutex);
+	entry = registry_search(registry, name);
+	if (entry == NULL || entry->template == NULL)
+		rc = MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	else {
+		free(entry->filename);
+		entry->filename = NULL;
+		registry_replace(registry, entry, NULL);
+		rc = MUSTACH_OK;
+	}
+	pthread_mutex_unlock(&registry->mutex);
+	return rc;
+}
+
+int mustach_wrap_registry_refresh(struct mustach_wrap_registry *registry)
+{
+	struct registry_template *t;
+	struct registry_entry *entry;
+	struct stat st;
+	struct timespec mtime;
+	unsigned i;
+	int rc, count, error;
+
+	count = error = 0;
+	pthread_mutex_lock(&registry->mutex);
+	for (i = 0 ; i < REGISTRY_BUCKETS ; i++)
+		for (entry = registry->buckets[i] ; entry != NULL ; entry = entry->next) {
+			if (entry->filename == NULL)
+				continue;
+			if (stat(entry->filename, &st) == 0) {
+				mtime = stat_mtime(&st);
+				if (entry->dev == st.st_dev
+				 && entry->ino == st.st_ino
+				 && entry->size == st.st_size
+				 && same_mtime(&entry->mtime, &mtime))
+					continue;
+			}
+			rc = registry_read(registry, entry->filename, &st, &t);
+			if (rc < 0) {
+				if (error == 0)
+					error = rc;
+				continue;
+			}
+			entry->dev = st.st_dev;
+			entry->ino = st.st_ino;
+			entry->size = st.st_size;
+			entry->mtime = stat_mtime(&st);
+			registry_replace(registry, entry, t);
+			count++;
+		}
+	pthread_mutex_unlock(&registry->mutex);
+	return error < 0 ? error : count;
+}
+
+const struct mustach_wrap_template *mustach_wrap_registry_get(struct mustach_wrap_registry *registry, const char *name)
+{
+	struct registry_template *template = registry_lookup(registry, name);
+	return template == NULL ? NULL : &template->pub;
+}
+
+void mustach_wrap_registry_release(const struct mustach_wrap_template *template)
+{
+	registry_template_unref((struct registry_template*)template);
+}
+
+int mustach_wrap_registry_partial(void *closure, const char *name, struct mustach_sbuf *sbuf)
+{
+	struct registry_template *template = registry_lookup(closure, name);
+
+	if (template == NULL)
+		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	sbuf->value = template->text;
+	sbuf->length = template->pub.length;
+	sbuf->releasecb = registry_template_release;
+	sbuf->closure = template;
+	return MUSTACH_OK;
 }
 
 static int partial(void *closure, const char *name, struct mustach_sbuf *sbuf)
 {
 	struct wrap *w = closure;
 	int rc;
-	if (mustach_wrap_get_partial != NULL)
+	if (w->partialcb != NULL)
+		rc = w->partialcb(w->partialclosure, name, sbuf);
+	else if (mustach_wrap_get_partial != NULL)
 		rc = mustach_wrap_get_partial(name, sbuf);
 	else if (w->flags & Mustach_With_PartialDataFirst) {
 		if (getoptional(w, name, sbuf) > 0)
@@ -391,11 +1263,107 @@ static int partial(void *closure, const char *name, struct mustach_sbuf *sbuf)
 		if (rc != MUSTACH_OK &&  getoptional(w, name, sbuf) > 0)
 			rc = MUSTACH_OK;
 	}
-	if (rc != MUSTACH_OK)
+	if (rc != MUSTACH_OK) {
 		sbuf->value = "";
+		sbuf->length = 0;
+	}
 	return MUSTACH_OK;
 }
 
+static int compiled_partial(void *closure, const char *name, const struct mustach_compiled **compiled, struct mustach_sbuf *sbuf)
+{
+	struct wrap *w = closure;
+	struct registry_template *template;
+
+	if (w->partialcb != mustach_wrap_registry_partial)
+		return partial(closure, name, sbuf);
+	template = registry_lookup(w->partialclosure, name);
+	if (template == NULL)
+		sbuf->value = "";
+	else {
+		*compiled = template->compiled;
+		sbuf->releasecb = registry_template_release;
+		sbuf->closure = template;
+	}
+	return MUSTACH_OK;
+}
+
+/*
+ * Sections split between threads
+ * -------------------------------
+ * The copies of the wrap made for the other threads have their own copy
+ * of the closure of the backend and their own cache of selection names.
+ * They write their output to the memory files given by the core.
+ */
+
+/* settings of sections split between threads */
+static struct {
+	int threads;    /* count of threads, 0 for the count of processors */
+	size_t items;   /* minimal count of items */
+	pthread_mutex_t mutex;
+} parallel = { 0, PARALLEL_SECTION_ITEMS, PTHREAD_MUTEX_INITIALIZER };
+
+void mustach_wrap_parallel_sections(int threads, size_t items)
+{
+	pthread_mutex_lock(&parallel.mutex);
+	parallel.threads = threads < 1 ? 0 : threads;
+	parallel.items = items;
+	pthread_mutex_unlock(&parallel.mutex);
+}
+
+static int split(void *closure, int partials, size_t *items)
+{
+	struct wrap *w = closure;
+	int threads;
+	size_t min;
+	long n;
+
+	if (!(w->flags & Mustach_With_ParallelSections) || w->emitcb != NULL
+	 || !w->itf->items || !w->itf->clone || !w->itf->unclone
+	 || (partials && w->partialcb != mustach_wrap_registry_partial
+		&& (w->partialcb != NULL || mustach_wrap_get_partial != NULL)))
+		return 0;
+	pthread_mutex_lock(&parallel.mutex);
+	if (parallel.threads == 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		parallel.threads = n < 1 ? 1 : n > MUSTACH_MAX_DEPTH ? MUSTACH_MAX_DEPTH : (int)n;
+	}
+	threads = parallel.threads;
+	min = parallel.items;
+	pthread_mutex_unlock(&parallel.mutex);
+	if (threads < 2)
+		return 0;
+	*items = w->itf->items(w->closure);
+	return *items >= min ? threads : 0;
+}
+
+static void wrap_init(struct wrap *wrap, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, mustach_write_cb_t *writecb);
+
+static void *make_clone(void *closure, size_t index)
+{
+	struct wrap *w = closure, *c;
+	void *cl;
+
+	c = malloc(sizeof *c);
+	if (c != NULL) {
+		cl = w->itf->clone(w->closure, index);
+		if (cl == NULL) {
+			free(c);
+			return NULL;
+		}
+		wrap_init(c, w->itf, cl, w->flags, w->partialcb, w->partialclosure, NULL, NULL);
+	}
+	return c;
+}
+
+static void free_clone(void *clone)
+{
+	struct wrap *c = clone;
+	path_release(c);
+	c->itf->unclone(c->closure);
+	free(c);
+}
+
 const struct mustach_itf mustach_wrap_itf = {
 	.start = start,
 	.put = NULL,
@@ -405,10 +1373,31 @@ const struct mustach_itf mustach_wrap_itf = {
 	.partial = partial,
 	.get = get,
 	.emit = emit,
-	.stop = stop
+	.stop = stop,
+	.split = split,
+	.clone = make_clone,
+	.unclone = free_clone,
+	.compiled_partial = compiled_partial
 };
 
-static void wrap_init(struct wrap *wrap, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, mustach_write_cb_t *writecb)
+/* when writing to files, the default emitter of the core is used */
+static const struct mustach_itf wrap_itf_file = {
+	.start = start,
+	.put = NULL,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.partial = partial,
+	.get = get,
+	.emit = NULL,
+	.stop = stop,
+	.split = split,
+	.clone = make_clone,
+	.unclone = free_clone,
+	.compiled_partial = compiled_partial
+};
+
+static void wrap_init(struct wrap *wrap, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, mustach_write_cb_t *writecb)
 {
 	if (flags & Mustach_With_Compare)
 		flags |= Mustach_With_Equal;
@@ -417,40 +1406,421 @@ static void wrap_init(struct wrap *wrap, const struct mustach_wrap_itf *itf, voi
 	wrap->flags = flags;
 	wrap->emitcb = emitcb;
 	wrap->writecb = writecb;
+	wrap->partialcb = partialcb;
+	wrap->partialclosure = partialclosure;
+	wrap->oused = 0;
+	memset(wrap->paths, 0, sizeof wrap->paths);
+	wrap->keep = 0;
+	wrap->owned = 0;
+	wrap->started = 0;
+}
+
+int mustach_wrap_file_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, partialcb, partialclosure, NULL, NULL);
+	return mustach_file(template, length, &wrap_itf_file, &w, flags, file);
 }
 
 int mustach_wrap_file(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file)
+{
+	return mustach_wrap_file_partial(template, length, itf, closure, flags, NULL, NULL, file);
+}
+
+int mustach_wrap_fd_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
 {
 	struct wrap w;
-	wrap_init(&w, itf, closure, flags, NULL, NULL);
-	return mustach_file(template, length, &mustach_wrap_itf, &w, flags, file);
+	wrap_init(&w, itf, closure, flags, partialcb, partialclosure, NULL, NULL);
+	return mustach_fd(template, length, &wrap_itf_file, &w, flags, fd);
 }
 
 int mustach_wrap_fd(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, int fd)
+{
+	return mustach_wrap_fd_partial(template, length, itf, closure, flags, NULL, NULL, fd);
+}
+
+int mustach_wrap_mem_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
 {
 	struct wrap w;
-	wrap_init(&w, itf, closure, flags, NULL, NULL);
-	return mustach_fd(template, length, &mustach_wrap_itf, &w, flags, fd);
+	wrap_init(&w, itf, closure, flags, partialcb, partialclosure, NULL, NULL);
+	return mustach_mem(template, length, &wrap_itf_file, &w, flags, result, size);
 }
 
 int mustach_wrap_mem(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	return mustach_wrap_mem_partial(template, length, itf, closure, flags, NULL, NULL, result, size);
+}
+
+int mustach_wrap_write_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *writeclosure)
 {
 	struct wrap w;
-	wrap_init(&w, itf, closure, flags, NULL, NULL);
-	return mustach_mem(template, length, &mustach_wrap_itf, &w, flags, result, size);
+	int rc, rc2;
+	wrap_init(&w, itf, closure, flags, partialcb, partialclosure, NULL, writecb);
+	rc = mustach_file(template, length, &mustach_wrap_itf, &w, flags, writeclosure);
+	rc2 = flush(&w, writeclosure);
+	return rc < 0 ? rc : rc2;
 }
 
 int mustach_wrap_write(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_write_cb_t *writecb, void *writeclosure)
+{
+	return mustach_wrap_write_partial(template, length, itf, closure, flags, NULL, NULL, writecb, writeclosure);
+}
+
+int mustach_wrap_emit_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *emitclosure)
 {
 	struct wrap w;
-	wrap_init(&w, itf, closure, flags, NULL, writecb);
-	return mustach_file(template, length, &mustach_wrap_itf, &w, flags, writeclosure);
+	wrap_init(&w, itf, closure, flags, partialcb, partialclosure, emitcb, NULL);
+	return mustach_file(template, length, &mustach_wrap_itf, &w, flags, emitclosure);
 }
 
 int mustach_wrap_emit(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, void *emitclosure)
+{
+	return mustach_wrap_emit_partial(template, length, itf, closure, flags, NULL, NULL, emitcb, emitclosure);
+}
+
+
+int mustach_wrap_compiled_file_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file)
 {
 	struct wrap w;
-	wrap_init(&w, itf, closure, flags, emitcb, NULL);
-	return mustach_file(template, length, &mustach_wrap_itf, &w, flags, emitclosure);
+	wrap_init(&w, itf, closure, mustach_compiled_flags(compiled), partialcb, partialclosure, NULL, NULL);
+	return mustach_compiled_file(compiled, &wrap_itf_file, &w, file);
+}
+
+int mustach_wrap_compiled_file(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, FILE *file)
+{
+	return mustach_wrap_compiled_file_partial(compiled, itf, closure, NULL, NULL, file);
+}
+
+int mustach_wrap_compiled_fd_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, int fd)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, mustach_compiled_flags(compiled), partialcb, partialclosure, NULL, NULL);
+	return mustach_compiled_fd(compiled, &wrap_itf_file, &w, fd);
+}
+
+int mustach_wrap_compiled_fd(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, int fd)
+{
+	return mustach_wrap_compiled_fd_partial(compiled, itf, closure, NULL, NULL, fd);
+}
+
+int mustach_wrap_compiled_mem_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, mustach_compiled_flags(compiled), partialcb, partialclosure, NULL, NULL);
+	return mustach_compiled_mem(compiled, &wrap_itf_file, &w, result, size);
+}
+
+int mustach_wrap_compiled_mem(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, char **result, size_t *size)
+{
+	return mustach_wrap_compiled_mem_partial(compiled, itf, closure, NULL, NULL, result, size);
+}
+
+int mustach_wrap_compiled_write_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *writeclosure)
+{
+	struct wrap w;
+	int rc, rc2;
+	wrap_init(&w, itf, closure, mustach_compiled_flags(compiled), partialcb, partialclosure, NULL, writecb);
+	rc = mustach_compiled_file(compiled, &mustach_wrap_itf, &w, writeclosure);
+	rc2 = flush(&w, writeclosure);
+	return rc < 0 ? rc : rc2;
+}
+
+int mustach_wrap_compiled_write(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_write_cb_t *writecb, void *writeclosure)
+{
+	return mustach_wrap_compiled_write_partial(compiled, itf, closure, NULL, NULL, writecb, writeclosure);
+}
+
+int mustach_wrap_compiled_emit_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *emitclosure)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, mustach_compiled_flags(compiled), partialcb, partialclosure, emitcb, NULL);
+	return mustach_compiled_file(compiled, &mustach_wrap_itf, &w, emitclosure);
+}
+
+int mustach_wrap_compiled_emit(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_emit_cb_t *emitcb, void *emitclosure)
+{
+	return mustach_wrap_compiled_emit_partial(compiled, itf, closure, NULL, NULL, emitcb, emitclosure);
+}
+
+/* the wrap and the copy of the closure are released by 'stop' at the end of the render */
+int mustach_wrap_render_start_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, const void *closure, size_t closure_size, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	struct wrap *w;
+
+	*result = NULL;
+	w = malloc(sizeof *w + closure_size);
+	if (w == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	memcpy(w + 1, closure, closure_size);
+	wrap_init(w, itf, w + 1, mustach_compiled_flags(compiled), partialcb, partialclosure, NULL, NULL);
+	w->owned = 1;
+	return mustach_render_start(compiled, &wrap_itf_file, w, sinkcb, sinkclosure, result);
+}
+
+int mustach_wrap_render_start(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, const void *closure, size_t closure_size, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	return mustach_wrap_render_start_partial(compiled, itf, closure, closure_size, NULL, NULL, sinkcb, sinkclosure, result);
+}
+
+/*
+ * Batches
+ * -------
+ * The renders of a batch are shared by threads taking the next index
+ * to render. Each thread reuses its closure, its wrap (keeping the parsed
+ * selection names, the flags being the same) and its buffer of output.
+ * The results are delivered in the order of indexes by the thread that
+ * completes the next one to deliver, the ones completed before wait.
+ * The texts delivered to files are given back as buffers.
+ */
+
+/* result of a render */
+struct batch_result {
+	char *text;   /* the rendered text */
+	size_t size;  /* size of the text */
+	size_t alloc; /* allocated size of the text */
+	int status;   /* status of the render */
+	int done;     /* the render is completed */
+};
+
+/* state of a batch */
+struct batch {
+	const struct mustach_compiled *compiled;
+	mustach_wrap_batch_cb_t *setcb;
+	struct mustach_batch_output *outputs;
+	struct batch_result *results;
+	size_t count;      /* count of renders */
+	size_t next;       /* index of the next render to do */
+	size_t delivered;  /* count of results delivered */
+	int delivering;    /* a thread is delivering results */
+	pthread_mutex_t mutex;
+};
+
+/* a thread of a batch */
+struct batch_worker {
+	struct batch *batch;
+	void *closure;     /* closure of the interface */
+	pthread_t thread;
+	char *text;        /* buffer of output */
+	size_t alloc;      /* allocated size of the buffer */
+	size_t used;       /* used size of the buffer */
+	struct wrap wrap;
+};
+
+/* write callback appending to the buffer of the worker 'closure' */
+static int batch_append(void *closure, const char *buffer, size_t size)
+{
+	struct batch_worker *bw = closure;
+	size_t alloc;
+	char *text;
+
+	if (size >= bw->alloc - bw->used) {
+		alloc = bw->alloc ? bw->alloc : MUSTACH_OUTPUT_BUFFER_SIZE;
+		while (size >= alloc - bw->used)
+			alloc <<= 1;
+		text = realloc(bw->text, alloc);
+		if (text == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		bw->text = text;
+		bw->alloc = alloc;
+	}
+	memcpy(&bw->text[bw->used], buffer, size);
+	bw->used += size;
+	return MUSTACH_OK;
+}
+
+/* renders the 'index' of the batch in the buffer of 'bw', terminated with a nul */
+static int batch_render(struct batch_worker *bw, size_t index)
+{
+	FILE *file = (FILE*)bw;
+	int rc, rc2;
+
+	bw->used = 0;
+	rc = bw->batch->setcb(bw->closure, index);
+	if (rc >= 0) {
+		rc = mustach_compiled_file(bw->batch->compiled, &mustach_wrap_itf, &bw->wrap, file);
+		rc2 = flush(&bw->wrap, file);
+		if (rc >= 0)
+			rc = rc2;
+		if (rc >= 0 && (rc = batch_append(bw, "", 1)) >= 0)
+			bw->used--;
+	}
+	return rc;
+}
+
+/* gives the result 'r' to 'output', returns 1 if its text is taken or else 0 */
+static int batch_output(struct mustach_batch_output *output, struct batch_result *r)
+{
+	const char *text = r->text;
+	size_t size = r->size;
+	ssize_t n;
+
+	output->status = r->status;
+	if (r->status < 0)
+		return 0;
+	switch (output->kind) {
+	case Mustach_Batch_File:
+		if (size != 0 && fwrite(text, 1, size, output->file) != size)
+			output->status = MUSTACH_ERROR_SYSTEM;
+		return 0;
+	case Mustach_Batch_Fd:
+		while (size != 0) {
+			n = write(output->fd, text, size);
+			if (n >= 0) {
+				text += n;
+				size -= (size_t)n;
+			}
+			else if (errno != EINTR) {
+				output->status = MUSTACH_ERROR_SYSTEM;
+				break;
+			}
+		}
+		return 0;
+	default:
+		output->result = r->text;
+		output->size = r->size;
+		return 1;
+	}
+}
+
+/* delivers in order the results completed, called and returning with the mutex locked */
+static void batch_deliver(struct batch_worker *bw)
+{
+	struct batch *b = bw->batch;
+	struct batch_result *r;
+	size_t index;
+
+	b->delivering = 1;
+	while (b->delivered < b->count && b->results[b->delivered].done) {
+		index = b->delivered++;
+		r = &b->results[index];
+		pthread_mutex_unlock(&b->mutex);
+		if (!batch_output(&b->outputs[index], r)) {
+			/* reuse the text as buffer */
+			if (bw->text == NULL) {
+				bw->text = r->text;
+				bw->alloc = r->alloc;
+			}
+			else
+				free(r->text);
+		}
+		r->text = NULL;
+		pthread_mutex_lock(&b->mutex);
+	}
+	b->delivering = 0;
+}
+
+/* renders the batch until no render remains */
+static void *batch_run(void *arg)
+{
+	struct batch_worker *bw = arg;
+	struct batch *b = bw->batch;
+	struct batch_result *r;
+	size_t index;
+	int status;
+
+	pthread_mutex_lock(&b->mutex);
+	while (b->next < b->count) {
+		index = b->next++;
+		pthread_mutex_unlock(&b->mutex);
+		status = batch_render(bw, index);
+		pthread_mutex_lock(&b->mutex);
+		r = &b->results[index];
+		r->status = status;
+		if (status >= 0) {
+			r->text = bw->text;
+			r->size = bw->used;
+			r->alloc = bw->alloc;
+			bw->text = NULL;
+			bw->alloc = 0;
+		}
+		r->done = 1;
+		if (!b->delivering)
+			batch_deliver(bw);
+	}
+	pthread_mutex_unlock(&b->mutex);
+	return NULL;
 }
 
+int mustach_wrap_batch_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closures, size_t closure_size, int threads, mustach_wrap_batch_cb_t *setcb, size_t count, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs)
+{
+	struct batch b;
+	struct batch_worker *workers, *bw;
+	size_t i;
+	int n, started, rc;
+
+	/* prepare the outputs and the workers */
+	for (i = 0 ; i < count ; i++) {
+		switch (outputs[i].kind) {
+		case Mustach_Batch_Memory:
+			outputs[i].result = NULL;
+			outputs[i].size = 0;
+			break;
+		case Mustach_Batch_File:
+			if (outputs[i].file == NULL)
+				return MUSTACH_ERROR_INVALID_ITF;
+			break;
+		case Mustach_Batch_Fd:
+			if (outputs[i].fd < 0)
+				return MUSTACH_ERROR_INVALID_ITF;
+			break;
+		default:
+			return MUSTACH_ERROR_INVALID_ITF;
+		}
+		outputs[i].status = MUSTACH_ERROR_SYSTEM;
+	}
+	if (count == 0)
+		return MUSTACH_OK;
+	n = threads < 1 ? 1 : (size_t)threads > count ? (int)count : threads;
+	workers = malloc((size_t)n * sizeof *workers);
+	b.results = calloc(count, sizeof *b.results);
+	if (workers == NULL || b.results == NULL) {
+		free(workers);
+		free(b.results);
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	b.compiled = compiled;
+	b.setcb = setcb;
+	b.outputs = outputs;
+	b.count = count;
+	b.next = 0;
+	b.delivered = 0;
+	b.delivering = 0;
+	pthread_mutex_init(&b.mutex, NULL);
+	for (i = 0 ; i < (size_t)n ; i++) {
+		bw = &workers[i];
+		bw->batch = &b;
+		bw->closure = (char*)closures + i * closure_size;
+		bw->text = NULL;
+		bw->alloc = bw->used = 0;
+		wrap_init(&bw->wrap, itf, bw->closure, mustach_compiled_flags(compiled), partialcb, partialclosure, NULL, batch_append);
+		bw->wrap.keep = 1;
+	}
+
+	/* the calling thread is the first worker */
+	for (started = 1 ; started < n ; started++)
+		if (pthread_create(&workers[started].thread, NULL, batch_run, &workers[started]) != 0)
+			break;
+	batch_run(&workers[0]);
+	for (i = 1 ; i < (size_t)started ; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	/* release */
+	for (i = 0 ; i < (size_t)n ; i++) {
+		path_release(&workers[i].wrap);
+		free(workers[i].text);
+	}
+	pthread_mutex_destroy(&b.mutex);
+	free(b.results);
+	free(workers);
+
+	/* first error in order */
+	rc = MUSTACH_OK;
+	for (i = 0 ; i < count && rc == MUSTACH_OK ; i++)
+		rc = outputs[i].status;
+	return rc;
+}
+
+int mustach_wrap_batch(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closures, size_t closure_size, int threads, mustach_wrap_batch_cb_t *setcb, size_t count, struct mustach_batch_output *outputs)
+{
+	return mustach_wrap_batch_partial(compiled, itf, closures, closure_size, threads, setcb, count, NULL, NULL, outputs);
+}
@@ -19,6 +19,7 @@
  * level features coming with extensions implemented by
  * this high level wrapper.
  */
+#include <stdint.h>
 #include "mustach.h"
 /*
  * Definition of the writing callbacks for mustach functions
@@ -62,13 +63,155 @@ typedef int mustach_emit_cb_t(void *closure, const char *buffer, size_t size, in
 #define Mustach_With_EscFirstCmp        256
 #define Mustach_With_PartialDataFirst   512
 #define Mustach_With_ErrorUndefined    1024
+#define Mustach_With_ParallelSections  2048     /* see mustach_wrap_parallel_sections */
 
 #undef  Mustach_With_AllExtensions
-#define Mustach_With_AllExtensions     1023     /* don't include ErrorUndefined */
+#define Mustach_With_AllExtensions     1023     /* don't include ErrorUndefined nor ParallelSections */
+
+/**
+ * mustach_wrap_value - value of comparisons like {{#price>=100}}
+ *
+ * The value given after the comparator is parsed once to a typed constant.
+ *
+ * @type:    the type of the value
+ * @string:  the text of the value, always set
+ * @integer: the integer value for Mustach_Wrap_Int, 0 or 1 for
+ *           Mustach_Wrap_Bool, for other types the value of its
+ *           leading integer text as with atoll
+ * @real:    the floating value for Mustach_Wrap_Double and Mustach_Wrap_Int,
+ *           0 or 1 for Mustach_Wrap_Bool, for other types the value of
+ *           its leading floating text as with atof
+ *
+ * The floating values are parsed with the dot as decimal point, whatever
+ * is the locale.
+ */
+enum mustach_wrap_type {
+	Mustach_Wrap_String = 0,
+	Mustach_Wrap_Int    = 1,
+	Mustach_Wrap_Double = 2,
+	Mustach_Wrap_Bool   = 3,
+	Mustach_Wrap_Null   = 4
+};
+
+struct mustach_wrap_value {
+	enum mustach_wrap_type type;
+	const char *string;
+	int64_t integer;
+	double real;
+};
+
+/**
+ * mustach_wrap_atom - a key of selections, made once per render with its hash
+ *
+ * The hash is the one of the 'length' bytes of the key given by
+ * mustach_wrap_hash.
+ *
+ * @name:   the key, nul terminated
+ * @length: the length of the key
+ * @hash:   the hash of the key
+ */
+struct mustach_wrap_atom {
+	const char *name;
+	size_t length;
+	uint32_t hash;
+};
+
+/**
+ * mustach_wrap_hash - Computes the hash of the 'length' bytes of 'text'
+ * starting with 5381 and then h = h * 33 + c for each byte c (as unsigned
+ * char). It is the hash of atoms and the backends can use it for finding
+ * keys directly with the hash of atoms.
+ *
+ * @text:   the text to hash
+ * @length: the length of the text
+ *
+ * Returns the hash.
+ */
+extern uint32_t mustach_wrap_hash(const char *text, size_t length);
+
+/**
+ * mustach_wrap_make_atom - Makes in 'atom' the atom of the key 'name'.
+ * The atom refers to 'name' that must remain valid while 'atom' is used.
+ *
+ * @atom: the atom to set
+ * @name: the key, nul terminated
+ */
+extern void mustach_wrap_make_atom(struct mustach_wrap_atom *atom, const char *name);
+
+/**
+ * mustach_wrap_memo - search of a name in the frames of a backend,
+ * remembered for searching again only the frames changed since
+ *
+ * The frames of the backend have a stamp that increases when they are
+ * entered or advanced, so the stamps increase with the depth and the
+ * frames up to the last one not newer than the search are the same as
+ * when it was done (see mustach_wrap_memo_hit).
+ *
+ * @stamp: the stamp of the backend when the search was done
+ * @depth: the frame where the name was found, -1 if not found or
+ *         MUSTACH_WRAP_MEMO_NEW when the name was just recorded
+ * @value: the value found, opaque to the wrap
+ * @data:  more data of the value, opaque to the wrap
+ * @name:  the name searched or empty
+ */
+#define MUSTACH_WRAP_MEMO_NAME  32 /* size of the names remembered */
+#define MUSTACH_WRAP_MEMO_NEW   -2 /* depth of the memos of names just recorded */
+
+struct mustach_wrap_memo {
+	uint64_t stamp;
+	int depth;
+	const void *value;
+	uint64_t data;
+	char name[MUSTACH_WRAP_MEMO_NAME];
+};
+
+/**
+ * mustach_wrap_memo_get - Gets in the 'count' memos 'memos' the one of
+ * 'atom'. When it was not remembering 'atom', it records it and its
+ * depth is MUSTACH_WRAP_MEMO_NEW. The memos are initialised with zeros.
+ *
+ * @memos: the memos of the backend
+ * @count: the count of memos
+ * @atom:  the name searched
+ *
+ * Returns the memo or NULL when the name is empty or too long.
+ */
+extern struct mustach_wrap_memo *mustach_wrap_memo_get(struct mustach_wrap_memo *memos, unsigned count, const struct mustach_wrap_atom *atom);
+
+/**
+ * mustach_wrap_memo_hit - Tells whether the search remembered in 'memo'
+ * gives the result of the search from the frame of 'depth' and 'stamp',
+ * the frames being searched from the innermost. When it does, the search
+ * stops with the frame 'memo->depth' and the value of 'memo'.
+ *
+ * @memo:  the memo or NULL
+ * @depth: the depth of the frame to be searched
+ * @stamp: the stamp of that frame
+ *
+ * Returns 1 if the memo gives the result or else 0.
+ */
+extern int mustach_wrap_memo_hit(const struct mustach_wrap_memo *memo, int depth, uint64_t stamp);
+
+/**
+ * mustach_wrap_memo_set - Records in 'memo' the result of a search done
+ * at 'stamp': the name was found in the frame 'depth' (-1 if not found)
+ * with the 'value' and the 'data'.
+ *
+ * @memo:  the memo or NULL
+ * @stamp: the stamp of the backend
+ * @depth: the frame where the name was found or -1
+ * @value: the value found
+ * @data:  more data of the value
+ */
+extern void mustach_wrap_memo_set(struct mustach_wrap_memo *memo, uint64_t stamp, int depth, const void *value, uint64_t data);
 
 /**
  * mustach_wrap_itf - high level wrap of mustach - interface for callbacks
  *
+ * The members of the interface are only changed or added with a new
+ * major version (MUSTACH_VERSION_MAJOR and soname of the libraries):
+ * programs built for another major version must be compiled again.
+ *
  * The functions sel, subsel, enter and next should return 0 or 1.
  *
  * All other functions should normally return MUSTACH_OK (zero).
@@ -92,8 +235,8 @@ typedef int mustach_emit_cb_t(void *closure, const char *buffer, size_t size, in
  *           a negative value if current value is lesser, a positive
  *           value if the current value is greater or zero when
  *           values are equals.
- *           If 'compare' is NULL, any comparison in mustach
- *           is going to fails.
+ *           If 'compare' and 'compare_value' are NULL, any comparison
+ *           in mustach is going to fails.
  *
  * @sel: Selects the item of the given 'name'. If 'name' is NULL
  *       Selects the current item. Returns 1 if the selection is
@@ -121,7 +264,34 @@ typedef int mustach_emit_cb_t(void *closure, const char *buffer, size_t size, in
  *       is zero. Otherwise, when 'key' is not zero, return in 'sbuf'
  *       the name of key of the current selection, or if no such key
  *       exists, the empty string. Must return 1 if possible or
- *       0 when not possible or an error code.
+ *       0 when not possible or an error code. Setting the length
+ *       of the value in 'sbuf' avoids measuring it again and allows
+ *       values containing nul characters.
+ *
+ * @compare_value: If defined (can be NULL), it is used instead of
+ *                 'compare' and does the same with the typed 'value'
+ *                 parsed once per render. It avoids parsing the
+ *                 value at each comparison.
+ *
+ * @sel_atom: If defined (can be NULL), it is used instead of 'sel'
+ *            for selecting the item of the key 'atom', never NULL.
+ *            The atom gives the length and the hash of the key made
+ *            once per render.
+ *
+ * @subsel_atom: If defined (can be NULL), it is used instead of 'subsel'
+ *               for selecting the field of the key 'atom'.
+ *
+ * @items: If defined (can be NULL), returns the count of items of the
+ *         section just entered, or 0 if its items can't be rendered by
+ *         many threads (see mustach_wrap_parallel_sections).
+ *
+ * @clone: Required with 'items'. Returns a copy of 'closure' where the
+ *         item 'index' of the section just entered is active, 0 being the
+ *         first one, or NULL on error. The copy is used by another thread
+ *         at the same time as 'closure' so they can only share data that
+ *         is not modified.
+ *
+ * @unclone: Required with 'items'. Releases the copy 'clone' made by 'clone'.
  */
 struct mustach_wrap_itf {
 	int (*start)(void *closure);
@@ -133,6 +303,12 @@ struct mustach_wrap_itf {
 	int (*next)(void *closure);
 	int (*leave)(void *closure);
 	int (*get)(void *closure, struct mustach_sbuf *sbuf, int key);
+	int (*compare_value)(void *closure, const struct mustach_wrap_value *value);
+	int (*sel_atom)(void *closure, const struct mustach_wrap_atom *atom);
+	int (*subsel_atom)(void *closure, const struct mustach_wrap_atom *atom);
+	size_t (*items)(void *closure);
+	void *(*clone)(void *closure, size_t index);
+	void (*unclone)(void *clone);
 };
 
 /**
@@ -150,6 +326,250 @@ extern const struct mustach_itf mustach_wrap_itf;
  */
 extern int (*mustach_wrap_get_partial)(const char *name, struct mustach_sbuf *sbuf);
 
+/**
+ * Type of the per render providers of partials (see mustach_wrap_file_partial).
+ * The function receives the 'closure' given with it and must provide the
+ * partial of the given 'name' in 'sbuf'. It must return MUSTACH_OK when
+ * it filled 'sbuf' with value of partial or an error code if it failed.
+ */
+typedef int mustach_partial_cb_t(void *closure, const char *name, struct mustach_sbuf *sbuf);
+
+/**
+ * mustach_wrap_partial_cache_interval - Sets the interval of checks of the
+ * cache of partials read from files.
+ *
+ * Partials read from files are cached for the whole process, by the
+ * resolved path of their file, so names of the same file share it. The
+ * name of a cached partial is resolved again and checked against its file
+ * (device, inode, size and modification time) at most once every
+ * 'milliseconds'. The default is 1000 milliseconds
+ * (compile time setting PARTIAL_CACHE_INTERVAL). A value of zero checks the
+ * file at each use. A negative value disables the cache.
+ *
+ * @milliseconds: the interval between checks of files of partials
+ */
+extern void mustach_wrap_partial_cache_interval(int milliseconds);
+
+/**
+ * mustach_wrap_parallel_sections - Sets how the sections of many items
+ * are rendered by many threads.
+ *
+ * Renders of compiled templates with the flag Mustach_With_ParallelSections
+ * share the items of the sections having at least 'items' items between
+ * 'threads' threads, the calling thread included. Each thread renders
+ * consecutive items in memory and the texts are written in order. The
+ * defaults are the count of online processors and 1024 items (compile
+ * time setting PARALLEL_SECTION_ITEMS). A count of threads lower than 1
+ * restores the count of online processors.
+ *
+ * The items are rendered in sequence when the backend can't copy its state
+ * (items, clone and unclone of mustach_wrap_itf), for sections nested in
+ * a section rendered by many threads, when the output is given to an emit
+ * callback (mustach_wrap_emit) or when the section includes partials that
+ * are not provided by files, by the data or by a registry
+ * (mustach_wrap_get_partial or functions with the suffix _partial).
+ *
+ * @threads: the count of threads
+ * @items:   the minimal count of items of sections rendered by many threads
+ */
+extern void mustach_wrap_parallel_sections(int threads, size_t items);
+
+/**
+ * mustach_wrap_partial_cache_invalidate - Removes the partial of 'name'
+ * from the cache of partials read from files or all partials if 'name'
+ * is NULL.
+ *
+ * Renders using the removed partials are not affected.
+ *
+ * @name: the name of the partial as given in templates or NULL for all
+ */
+extern void mustach_wrap_partial_cache_invalidate(const char *name);
+
+/**
+ * mustach_wrap_registry - Opaque structure of registries of templates
+ *
+ * A registry maps names to templates compiled once and shared by the
+ * renders of all threads, for rendering them by name or as partials
+ * (see mustach_wrap_registry_partial). The templates are replaced when
+ * set again or when their file changed (see mustach_wrap_registry_refresh).
+ *
+ * Getting a template never locks: the lookups are counted in the current
+ * epoch of the registry. A replaced or removed template is released when
+ * the lookups of the previous epochs are done and the renders that got it
+ * released it. So the renders in flight keep the version they started with
+ * while the new renders get the new one. The changes of a registry are
+ * serialized by a mutex.
+ */
+struct mustach_wrap_registry;
+
+/**
+ * mustach_wrap_template - template got from a registry (see mustach_wrap_registry_get)
+ *
+ * @compiled: the compiled template, to give to the functions mustach_XXX_compiled_YYY
+ * @text:     the text of the template, zero terminated
+ * @length:   the length of the text
+ */
+struct mustach_wrap_template {
+	const struct mustach_compiled *compiled;
+	const char *text;
+	size_t length;
+};
+
+/**
+ * mustach_wrap_registry_create - Creates in 'result' an empty registry
+ * whose templates are compiled with 'flags'.
+ *
+ * @flags:  the flags for compiling the templates (see mustach_compile)
+ * @result: the pointer receiving the registry when 0 is returned
+ *
+ * Returns MUSTACH_OK or MUSTACH_ERROR_SYSTEM when out of memory.
+ */
+extern int mustach_wrap_registry_create(int flags, struct mustach_wrap_registry **result);
+
+/**
+ * mustach_wrap_registry_destroy - Destroys the 'registry'.
+ *
+ * It must not be used anymore, by any thread. The templates got from it
+ * and not yet released stay valid until released.
+ *
+ * @registry: the registry to destroy, can be NULL
+ */
+extern void mustach_wrap_registry_destroy(struct mustach_wrap_registry *registry);
+
+/**
+ * mustach_wrap_registry_set - Compiles the 'template' of 'length' and records
+ * it in 'registry' under 'name', replacing the template of that name if any.
+ *
+ * @registry: the registry
+ * @name:     the name of the template, as given to partial tags
+ * @template: the text of the template, copied
+ * @length:   length of the template or zero if unknown and template null terminated
+ *
+ * Returns MUSTACH_OK or the error of the compilation, the template of
+ * that name being left unchanged in that case.
+ */
+extern int mustach_wrap_registry_set(struct mustach_wrap_registry *registry, const char *name, const char *template, size_t length);
+
+/**
+ * mustach_wrap_registry_set_file - Same as mustach_wrap_registry_set for
+ * the template read from the file 'filename'. The file is remembered for
+ * reloading the template when the file changes (see mustach_wrap_registry_refresh).
+ *
+ * @registry: the registry
+ * @name:     the name of the template, as given to partial tags
+ * @filename: the name of the file of the template
+ *
+ * Returns MUSTACH_OK, MUSTACH_ERROR_SYSTEM with errno set when the file
+ * can't be read or the error of the compilation, the template of that
+ * name being left unchanged in case of error.
+ */
+extern int mustach_wrap_registry_set_file(struct mustach_wrap_registry *registry, const char *name, const char *filename);
+
+/**
+ * mustach_wrap_registry_remove - Removes the template of 'name' from 'registry'.
+ *
+ * @registry: the registry
+ * @name:     the name of the template
+ *
+ * Returns MUSTACH_OK or MUSTACH_ERROR_PARTIAL_NOT_FOUND when no template
+ * has that name.
+ */
+extern int mustach_wrap_registry_remove(struct mustach_wrap_registry *registry, const char *name);
+
+/**
+ * mustach_wrap_registry_refresh - Reloads the templates of 'registry' whose
+ * file changed (device, inode, size or modification time) since it was read.
+ *
+ * A template whose file can't be read or compiled is left unchanged and
+ * is checked again by the next refresh.
+ *
+ * @registry: the registry
+ *
+ * Returns the count of templates reloaded or the error of the first
+ * template that couldn't be reloaded.
+ */
+extern int mustach_wrap_registry_refresh(struct mustach_wrap_registry *registry);
+
+/**
+ * mustach_wrap_registry_get - Gets the template of 'name' from 'registry'.
+ *
+ * The template stays valid, even if replaced or removed from the registry,
+ * until released using mustach_wrap_registry_release.
+ *
+ * @registry: the registry
+ * @name:     the name of the template
+ *
+ * Returns the template or NULL when no template has that name.
+ */
+extern const struct mustach_wrap_template *mustach_wrap_registry_get(struct mustach_wrap_registry *registry, const char *name);
+
+/**
+ * mustach_wrap_registry_release - Releases the 'template' got by
+ * mustach_wrap_registry_get.
+ *
+ * @template: the template to release, can be NULL
+ */
+extern void mustach_wrap_registry_release(const struct mustach_wrap_template *template);
+
+/**
+ * mustach_wrap_registry_partial - Provider of partials (see mustach_partial_cb_t)
+ * getting the partials from the registry given as 'closure'.
+ *
+ * When given to the functions with the suffix _partial, the partials
+ * are rendered from their compiled template, without being scanned,
+ * and the sections including partials can be rendered by many threads
+ * (see mustach_wrap_parallel_sections). Partials not in the registry
+ * are empty.
+ *
+ * @closure: the registry
+ * @name:    the name of the partial
+ * @sbuf:    receives the text of the partial
+ *
+ * Returns MUSTACH_OK or MUSTACH_ERROR_PARTIAL_NOT_FOUND.
+ */
+extern int mustach_wrap_registry_partial(void *closure, const char *name, struct mustach_sbuf *sbuf);
+
+/**
+ * mustach_batch_output - output of one render of a batch (see mustach_wrap_batch)
+ *
+ * The result of the render is returned in 'result' and 'size' when 'kind'
+ * is Mustach_Batch_Memory, the default of outputs initialised with zeros.
+ * It is written to 'file' when 'kind' is Mustach_Batch_File and to the
+ * file descriptor 'fd' when 'kind' is Mustach_Batch_Fd. The results are
+ * written in the order of the renders, so many outputs can share the
+ * same file.
+ *
+ * @kind:   where the result goes
+ * @file:   the file where to write the result for Mustach_Batch_File
+ * @fd:     the file descriptor where to write the result for Mustach_Batch_Fd
+ * @result: receives the result, nul terminated, to be freed by the
+ *          caller, for Mustach_Batch_Memory, or NULL
+ * @size:   receives the size of 'result' without its terminating nul
+ * @status: receives the status of the render, MUSTACH_OK or an error
+ */
+enum mustach_batch_kind {
+	Mustach_Batch_Memory = 0,
+	Mustach_Batch_File   = 1,
+	Mustach_Batch_Fd     = 2
+};
+
+struct mustach_batch_output {
+	enum mustach_batch_kind kind;
+	FILE *file;
+	int fd;
+	char *result;
+	size_t size;
+	int status;
+};
+
+/**
+ * Type of the callbacks of batches (see mustach_wrap_batch). The function
+ * receives the 'closure' of the thread doing the render of 'index' and
+ * must set it up for that render. It must return MUSTACH_OK or an error
+ * code that becomes the status of the render.
+ */
+typedef int mustach_wrap_batch_cb_t(void *closure, size_t index);
+
 /**
  * mustach_wrap_file - Renders the mustache 'template' in 'file' for an abstract
  * wrapper of interface 'itf' and 'closure'.
@@ -230,5 +650,157 @@ extern int mustach_wrap_write(const char *template, size_t length, const struct
  */
 extern int mustach_wrap_emit(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, void *emitclosure);
 
-#endif
+/**
+ * mustach_wrap_compiled_file - Renders the 'compiled' template in 'file' for
+ * an abstract wrapper of interface 'itf' and 'closure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_file(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, FILE *file);
+
+/**
+ * mustach_wrap_compiled_fd - Renders the 'compiled' template in 'fd' for
+ * an abstract wrapper of interface 'itf' and 'closure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_fd(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, int fd);
 
+/**
+ * mustach_wrap_compiled_mem - Renders the 'compiled' template in 'result' for
+ * an abstract wrapper of interface 'itf' and 'closure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_mem(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, char **result, size_t *size);
+
+/**
+ * mustach_wrap_compiled_write - Renders the 'compiled' template for an abstract
+ * wrapper of interface 'itf' and 'closure' to custom writer 'writecb' with
+ * 'writeclosure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_write(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_write_cb_t *writecb, void *writeclosure);
+
+/**
+ * mustach_wrap_compiled_emit - Renders the 'compiled' template for an abstract
+ * wrapper of interface 'itf' and 'closure' to custom emiter 'emitcb' with
+ * 'emitclosure'.
+ *
+ * @compiled: the compiled template to instanciate (see mustach_compile)
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_emit(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_emit_cb_t *emitcb, void *emitclosure);
+
+/**
+ * mustach_wrap_batch - Renders the 'compiled' template 'count' times
+ * using up to 'threads' threads, the calling thread included. The
+ * result of the render of index i is given to outputs[i], the outputs
+ * are delivered in the order of indexes.
+ *
+ * Each thread has its closure of 'itf' taken in the array 'closures'
+ * of 'threads' items of 'closure_size' bytes. It reuses it for all its
+ * renders, after setting it up with 'setcb' for each index.
+ *
+ * @compiled:     the compiled template to instanciate (see mustach_compile)
+ * @itf:          the interface of the abstract wrapper
+ * @closures:     the closures of the threads
+ * @closure_size: the size of one closure
+ * @threads:      the count of threads and of closures
+ * @setcb:        the function setting up a closure for a render
+ * @count:        the count of renders
+ * @outputs:      the outputs of the renders (see mustach_batch_output)
+ *
+ * Returns MUSTACH_OK if all renders succeeded or else the status of
+ * the first one that failed, or MUSTACH_ERROR_INVALID_ITF without render
+ * if an output has no file or no file descriptor for its kind.
+ */
+extern int mustach_wrap_batch(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closures, size_t closure_size, int threads, mustach_wrap_batch_cb_t *setcb, size_t count, struct mustach_batch_output *outputs);
+
+/**
+ * mustach_wrap_render_start - Starts in 'result' the resumable render of
+ * the 'compiled' template for an abstract wrapper of interface 'itf' and
+ * the closure 'closure' of 'closure_size' bytes, giving its output to
+ * 'sinkcb' (see mustach_render_start).
+ *
+ * The closure is copied in the render, so the one given can be released
+ * at return. The render is continued with mustach_render_step and
+ * released with mustach_render_stop.
+ *
+ * @compiled:     the compiled template to instanciate (see mustach_compile)
+ * @itf:          the interface of the abstract wrapper
+ * @closure:      the closure of the abstract wrapper, copied
+ * @closure_size: the size of the closure
+ * @sinkcb:       the function receiving the output
+ * @sinkclosure:  the closure to pass to 'sinkcb'
+ * @result:       the pointer receiving the render when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_render_start(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, const void *closure, size_t closure_size, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result);
+
+/**
+ * mustach_wrap_file_partial, mustach_wrap_fd_partial, mustach_wrap_mem_partial,
+ * mustach_wrap_write_partial, mustach_wrap_emit_partial, their compiled
+ * counterparts, mustach_wrap_batch_partial and
+ * mustach_wrap_render_start_partial - Same as the functions
+ * without the suffix _partial but partials of the render are provided
+ * by 'partialcb' with 'partialclosure'.
+ *
+ * When 'partialcb' is not NULL, it replaces for that render the default
+ * behaviour and the global hook mustach_wrap_get_partial. This allows
+ * renders running at the same time to use distinct sources of partials.
+ * When 'partialcb' is NULL, the behaviour is the one of the functions
+ * without the suffix _partial.
+ *
+ * @partialcb:      the function providing partials or NULL for default
+ * @partialclosure: the closure for the partial function
+ */
+extern int mustach_wrap_file_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file);
+extern int mustach_wrap_fd_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, int fd);
+extern int mustach_wrap_mem_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size);
+extern int mustach_wrap_write_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *writeclosure);
+extern int mustach_wrap_emit_partial(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *emitclosure);
+extern int mustach_wrap_compiled_file_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, FILE *file);
+extern int mustach_wrap_compiled_fd_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, int fd);
+extern int mustach_wrap_compiled_mem_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, char **result, size_t *size);
+extern int mustach_wrap_compiled_write_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_write_cb_t *writecb, void *writeclosure);
+extern int mustach_wrap_compiled_emit_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closure, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_emit_cb_t *emitcb, void *emitclosure);
+extern int mustach_wrap_batch_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, void *closures, size_t closure_size, int threads, mustach_wrap_batch_cb_t *setcb, size_t count, mustach_partial_cb_t *partialcb, void *partialclosure, struct mustach_batch_output *outputs);
+extern int mustach_wrap_render_start_partial(const struct mustach_compiled *compiled, const struct mustach_wrap_itf *itf, const void *closure, size_t closure_size, mustach_partial_cb_t *partialcb, void *partialclosure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result);
+
+#endif
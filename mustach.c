@@ -13,12 +13,23 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
 #ifdef _WIN32
 #include <malloc.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
 #endif
 
 #include "mustach.h"
 
+#if !defined(MUSTACH_ESCAPE_BUFFER_SIZE)
+#define MUSTACH_ESCAPE_BUFFER_SIZE 1024
+#endif
+
+struct mustach_render;
+
 struct iwrap {
 	int (*emit)(void *closure, const char *buffer, size_t size, int escape, FILE *file);
 	void *closure; /* closure for: enter, next, leave, emit, get */
@@ -30,7 +41,17 @@ struct iwrap {
 	int (*get)(void *closure, const char *name, struct mustach_sbuf *sbuf);
 	int (*partial)(void *closure, const char *name, struct mustach_sbuf *sbuf);
 	void *closure_partial; /* closure for partial */
+	int (*split)(void *closure, int partials, size_t *items);
+	void *(*clone)(void *closure, size_t index);
+	void (*unclone)(void *clone);
+	int (*compiled_partial)(void *closure, const char *name, const struct mustach_compiled **compiled, struct mustach_sbuf *sbuf);
 	int flags;
+	FILE *file;   /* the output of the render */
+	int fd;       /* the output of the render if not negative */
+	struct mustach_render *render; /* the output of a resumable render if not NULL */
+	int suspend;  /* the render stops when its sink waits (see mustach_render_step) */
+	size_t oused; /* count of bytes gathered in obuf */
+	char obuf[MUSTACH_OUTPUT_BUFFER_SIZE]; /* gathers the output */
 };
 
 struct prefix {
@@ -39,6 +60,140 @@ struct prefix {
 	struct prefix *prefix;
 };
 
+/*
+ * Scanning text for the first occurence of some characters
+ *
+ * When not at the beginning of a line, the only characters that matter
+ * to the interpreter are the new line and the first character of the
+ * openning delimiter. The function 'scan2' quickly skips the others.
+ * The function 'scan_html' quickly skips characters not escaped for HTML.
+ * On x86-64, the strides use SSE2 or AVX2 when the processor has it.
+ * Elsewhere, the strides are words of 8 bytes (SWAR).
+ * Define NO_SIMD to disable use of SSE2 and AVX2.
+ */
+#define IS_HTML_SPECIAL(c) ((c) == '<' || (c) == '>' || (c) == '&' || (c) == '"')
+
+#if !defined(NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static const char *scan2_avx2(const char *s, const char *end, char a, char b)
+{
+	__m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), x;
+	unsigned m;
+
+	for ( ; end - s >= 32 ; s += 32) {
+		x = _mm256_loadu_si256((const __m256i*)s);
+		m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)));
+		if (m)
+			return s + __builtin_ctz(m);
+	}
+	return s;
+}
+
+static const char *scan2(const char *s, const char *end, char a, char b)
+{
+	__m128i va, vb, x;
+	unsigned m;
+
+	if (end - s >= 64 && __builtin_cpu_supports("avx2")) {
+		s = scan2_avx2(s, end, a, b);
+		if (s != end && (*s == a || *s == b))
+			return s;
+	}
+	va = _mm_set1_epi8(a);
+	vb = _mm_set1_epi8(b);
+	for ( ; end - s >= 16 ; s += 16) {
+		x = _mm_loadu_si128((const __m128i*)s);
+		m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)));
+		if (m)
+			return s + __builtin_ctz(m);
+	}
+	while (s != end && *s != a && *s != b)
+		s++;
+	return s;
+}
+
+__attribute__((target("avx2")))
+static const char *scan_html_avx2(const char *s, const char *end)
+{
+	__m256i lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>');
+	__m256i am = _mm256_set1_epi8('&'), qu = _mm256_set1_epi8('"'), x;
+	unsigned m;
+
+	for ( ; end - s >= 32 ; s += 32) {
+		x = _mm256_loadu_si256((const __m256i*)s);
+		m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, lt), _mm256_cmpeq_epi8(x, gt)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, am), _mm256_cmpeq_epi8(x, qu))));
+		if (m)
+			return s + __builtin_ctz(m);
+	}
+	return s;
+}
+
+static const char *scan_html(const char *s, const char *end)
+{
+	__m128i lt, gt, am, qu, x;
+	unsigned m;
+
+	if (end - s >= 64 && __builtin_cpu_supports("avx2")) {
+		s = scan_html_avx2(s, end);
+		if (s != end && IS_HTML_SPECIAL(*s))
+			return s;
+	}
+	lt = _mm_set1_epi8('<');
+	gt = _mm_set1_epi8('>');
+	am = _mm_set1_epi8('&');
+	qu = _mm_set1_epi8('"');
+	for ( ; end - s >= 16 ; s += 16) {
+		x = _mm_loadu_si128((const __m128i*)s);
+		m = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(x, lt), _mm_cmpeq_epi8(x, gt)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, am), _mm_cmpeq_epi8(x, qu))));
+		if (m)
+			return s + __builtin_ctz(m);
+	}
+	while (s != end && !IS_HTML_SPECIAL(*s))
+		s++;
+	return s;
+}
+#else
+#include <stdint.h>
+
+#define ONES  UINT64_C(0x0101010101010101)
+#define HIGHS UINT64_C(0x8080808080808080)
+#define HAS_BYTE(w,c) ((((w) ^ (ONES * (unsigned char)(c))) - ONES) & ~((w) ^ (ONES * (unsigned char)(c))) & HIGHS)
+
+static const char *scan2(const char *s, const char *end, char a, char b)
+{
+	uint64_t w;
+
+	for ( ; end - s >= 8 ; s += 8) {
+		memcpy(&w, s, 8);
+		if (HAS_BYTE(w, a) | HAS_BYTE(w, b))
+			break;
+	}
+	while (s != end && *s != a && *s != b)
+		s++;
+	return s;
+}
+
+static const char *scan_html(const char *s, const char *end)
+{
+	uint64_t w;
+
+	for ( ; end - s >= 8 ; s += 8) {
+		memcpy(&w, s, 8);
+		if (HAS_BYTE(w, '<') | HAS_BYTE(w, '>') | HAS_BYTE(w, '&') | HAS_BYTE(w, '"'))
+			break;
+	}
+	while (s != end && !IS_HTML_SPECIAL(*s))
+		s++;
+	return s;
+}
+#endif
+
 #if !defined(NO_OPEN_MEMSTREAM)
 static FILE *memfile_open(char **buffer, size_t *size)
 {
@@ -138,45 +293,292 @@ static inline size_t sbuf_length(struct mustach_sbuf *sbuf)
 	return length;
 }
 
-static int iwrap_emit(void *closure, const char *buffer, size_t size, int escape, FILE *file)
+/* class of characters for HTML escaping: index in html_entities */
+static const unsigned char html_class[256] = { ['"'] = 1, ['&'] = 2, ['<'] = 3, ['>'] = 4 };
+
+/* entities are copied by 8 bytes, their length follows the text */
+static const struct { char text[7]; unsigned char length; } html_entities[5] = {
+	{ "", 0 }, { "&quot;", 6 }, { "&amp;", 5 }, { "&lt;", 4 }, { "&gt;", 4 }
+};
+
+int mustach_escape_html(const char *buffer, size_t size, int (*writecb)(void *closure, const char *buffer, size_t size), void *closure)
+{
+	char out[MUSTACH_ESCAPE_BUFFER_SIZE];
+	const char *end, *run;
+	size_t len, n;
+	int rc;
+	unsigned char c;
+
+	/* fast path: nothing to escape */
+	end = buffer + size;
+	run = scan_html(buffer, end);
+	if (run == end)
+		return size ? writecb(closure, buffer, size) : MUSTACH_OK;
+
+	/* gather clean runs and entities */
+	n = 0;
+	while (buffer != end) {
+		len = (size_t)(run - buffer);
+		if (n + len + sizeof *html_entities > sizeof out) {
+			if (n) {
+				rc = writecb(closure, out, n);
+				if (rc < 0)
+					return rc;
+				n = 0;
+			}
+			if (len + sizeof *html_entities > sizeof out) {
+				rc = writecb(closure, buffer, len);
+				if (rc < 0)
+					return rc;
+				buffer = run;
+				len = 0;
+			}
+		}
+		memcpy(&out[n], buffer, len);
+		n += len;
+		buffer = run;
+		/* entities in sequence */
+		while (buffer != end && (c = html_class[(unsigned char)*buffer]) != 0) {
+			if (n + sizeof *html_entities > sizeof out) {
+				rc = writecb(closure, out, n);
+				if (rc < 0)
+					return rc;
+				n = 0;
+			}
+			memcpy(&out[n], &html_entities[c], sizeof *html_entities);
+			n += html_entities[c].length;
+			buffer++;
+		}
+		run = scan_html(buffer, end);
+	}
+	return n ? writecb(closure, out, n) : MUSTACH_OK;
+}
+
+static int fwrite_cb(void *closure, const char *buffer, size_t size)
 {
-	size_t i, j, r;
+	return fwrite(buffer, 1, size, (FILE*)closure) != size ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
+}
 
+static int iwrap_emit(void *closure, const char *buffer, size_t size, int escape, FILE *file)
+{
 	(void)closure; /* unused */
 
-	if (!escape)
-		return fwrite(buffer, 1, size, file) != size ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
-
-	r = i = 0;
-	while (i < size) {
-		j = i;
-		while (j < size && buffer[j] != '<' && buffer[j] != '>' && buffer[j] != '&' && buffer[j] != '"')
-			j++;
-		if (j != i && fwrite(&buffer[i], j - i, 1, file) != 1)
-			return MUSTACH_ERROR_SYSTEM;
-		if (j < size) {
-			switch(buffer[j++]) {
-			case '<':
-				r = fwrite("&lt;", 4, 1, file);
-				break;
-			case '>':
-				r = fwrite("&gt;", 4, 1, file);
-				break;
-			case '&':
-				r = fwrite("&amp;", 5, 1, file);
-				break;
-			case '"':
-				r = fwrite("&quot;", 6, 1, file);
-				break;
+	return escape ? mustach_escape_html(buffer, size, fwrite_cb, file) : fwrite_cb(file, buffer, size);
+}
+
+#ifndef _WIN32
+/*
+ * writes the 'count' buffers of 'iov' to 'fd' until done or error,
+ * waits when the descriptor is not blocking and is full
+ */
+static int fdwrite(int fd, struct iovec *iov, int count)
+{
+	ssize_t rc;
+	struct pollfd pfd;
+
+	while (count) {
+		rc = writev(fd, iov, count);
+		if (rc >= 0) {
+			while (count && (size_t)rc >= iov->iov_len) {
+				rc -= (ssize_t)iov->iov_len;
+				iov++;
+				count--;
 			}
-			if (r != 1)
+			if (count) {
+				iov->iov_base = (char*)iov->iov_base + rc;
+				iov->iov_len -= (size_t)rc;
+			}
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+				return MUSTACH_ERROR_SYSTEM;
+		}
+		else if (errno != EINTR)
+			return MUSTACH_ERROR_SYSTEM;
+	}
+	return MUSTACH_OK;
+}
+#endif
+
+/*
+ * Resumable renders
+ * -----------------
+ * The output of a resumable render is given to its sink as long as the
+ * sink takes it. The output that the sink doesn't take waits in 'pending'
+ * and the render stops before its next operation (see 'render'). The state
+ * of the render of the template and of each partial is kept in a frame.
+ */
+struct render_frame;
+
+struct mustach_render {
+	struct iwrap iwrap;
+	const struct mustach_itf *itf;
+	void *closure;
+	mustach_sink_cb_t *sinkcb;
+	void *sinkclosure;
+	const struct mustach_compiled *interpret; /* template not compiled to render at once */
+	struct render_frame *top;  /* frame of the template or partial rendered */
+	int frames;                /* count of frames */
+	int status;                /* status of the render, MUSTACH_AGAIN until its end */
+	char *pending;             /* output waiting for the sink */
+	size_t psize;              /* allocated size of pending */
+	size_t pused;              /* count of bytes in pending */
+	size_t pdone;              /* count of bytes of pending given to the sink */
+};
+
+/* tells whether output of 'render' waits for its sink */
+static inline int render_waiting(const struct mustach_render *render)
+{
+	return render->pused != 0;
+}
+
+/* gives 'buffer' of 'size' to the sink of 'render', keeping what it doesn't take */
+static int render_sink(struct mustach_render *render, const char *buffer, size_t size)
+{
+	size_t written, sz;
+	char *pending;
+	int rc;
+
+	if (size != 0 && render->pused == 0) {
+		written = 0;
+		rc = render->sinkcb(render->sinkclosure, buffer, size, &written);
+		if (rc < 0)
+			return rc;
+		buffer += written;
+		size -= written;
+	}
+	if (size != 0) {
+		if (size > render->psize - render->pused) {
+			sz = render->pused + size;
+			if (sz < 2 * MUSTACH_OUTPUT_BUFFER_SIZE)
+				sz = 2 * MUSTACH_OUTPUT_BUFFER_SIZE;
+			pending = realloc(render->pending, sz);
+			if (pending == NULL)
 				return MUSTACH_ERROR_SYSTEM;
+			render->pending = pending;
+			render->psize = sz;
 		}
-		i = j;
+		memcpy(&render->pending[render->pused], buffer, size);
+		render->pused += size;
+	}
+	return MUSTACH_OK;
+}
+
+/* gives the pending output of 'render' to its sink, returns MUSTACH_AGAIN if it still waits */
+static int render_drain(struct mustach_render *render)
+{
+	size_t written;
+	int rc;
+
+	while (render->pdone < render->pused) {
+		written = 0;
+		rc = render->sinkcb(render->sinkclosure, &render->pending[render->pdone], render->pused - render->pdone, &written);
+		if (rc < 0)
+			return rc;
+		if (written == 0)
+			return MUSTACH_AGAIN;
+		render->pdone += written;
+	}
+	render->pused = render->pdone = 0;
+	return MUSTACH_OK;
+}
+
+/*
+ * The output of a render is gathered in the buffer 'obuf' of the
+ * iwrap and given to 'emit' by large chunks. When 'emit' is the
+ * default one, even escaped values are gathered. Otherwise,
+ * escaped values are given to 'emit' after flushing the buffer.
+ * When the output is a file descriptor, the default 'emit' is
+ * replaced by direct writes of the buffer.
+ */
+static int osink(struct iwrap *iwrap, const char *buffer, size_t size, const char *more, size_t msize)
+{
+	int rc;
+#ifndef _WIN32
+	struct iovec iov[2];
+#endif
+
+	if (iwrap->render != NULL) {
+		rc = render_sink(iwrap->render, buffer, size);
+		return rc < 0 ? rc : render_sink(iwrap->render, more, msize);
+	}
+#ifndef _WIN32
+	if (iwrap->fd >= 0) {
+		iov[0].iov_base = (void*)buffer;
+		iov[0].iov_len = size;
+		iov[1].iov_base = (void*)more;
+		iov[1].iov_len = msize;
+		return size ? fdwrite(iwrap->fd, iov, 1 + !!msize) : fdwrite(iwrap->fd, &iov[1], 1);
+	}
+#endif
+	rc = size ? iwrap->emit(iwrap->closure, buffer, size, 0, iwrap->file) : MUSTACH_OK;
+	if (rc >= 0 && msize)
+		rc = iwrap->emit(iwrap->closure, more, msize, 0, iwrap->file);
+	return rc;
+}
+
+static int oflush(struct iwrap *iwrap)
+{
+	size_t n = iwrap->oused;
+
+	if (n == 0)
+		return MUSTACH_OK;
+	iwrap->oused = 0;
+	return osink(iwrap, iwrap->obuf, n, NULL, 0);
+}
+
+static int owrite(void *closure, const char *buffer, size_t size)
+{
+	struct iwrap *iwrap = closure;
+	size_t n;
+	int rc;
+
+	if (size > sizeof iwrap->obuf - iwrap->oused) {
+		n = iwrap->oused;
+		iwrap->oused = 0;
+		if (size >= sizeof iwrap->obuf)
+			/* gather the buffer and the big chunk */
+			return osink(iwrap, iwrap->obuf, n, buffer, size);
+		rc = osink(iwrap, iwrap->obuf, n, NULL, 0);
+		if (rc < 0)
+			return rc;
 	}
+	memcpy(&iwrap->obuf[iwrap->oused], buffer, size);
+	iwrap->oused += size;
 	return MUSTACH_OK;
 }
 
+static int oemit(struct iwrap *iwrap, const char *buffer, size_t size, int escape, FILE *file)
+{
+	int rc;
+
+	if (file != iwrap->file)
+		return iwrap->emit(iwrap->closure, buffer, size, escape, file);
+	if (!escape)
+		return owrite(iwrap, buffer, size);
+	if (iwrap->emit == iwrap_emit)
+		return mustach_escape_html(buffer, size, owrite, iwrap);
+	rc = oflush(iwrap);
+	return rc < 0 ? rc : iwrap->emit(iwrap->closure, buffer, size, escape, file);
+}
+
+static int iwrap_put(void *closure, const char *name, int escape, FILE *file);
+
+static int oput(struct iwrap *iwrap, const char *name, int escape, FILE *file)
+{
+	int rc;
+
+	if (iwrap->put != iwrap_put) {
+		/* the custom put writes directly */
+		rc = oflush(iwrap);
+		if (rc < 0)
+			return rc;
+	}
+	return iwrap->put(iwrap->closure_put, name, escape, file);
+}
+
 static int iwrap_put(void *closure, const char *name, int escape, FILE *file)
 {
 	struct iwrap *iwrap = closure;
@@ -189,7 +591,7 @@ static int iwrap_put(void *closure, const char *name, int escape, FILE *file)
 	if (rc >= 0) {
 		length = sbuf_length(&sbuf);
 		if (length)
-			rc = iwrap->emit(iwrap->closure, sbuf.value, length, escape, file);
+			rc = oemit(iwrap, sbuf.value, length, escape, file);
 		sbuf_release(&sbuf);
 	}
 	return rc;
@@ -223,6 +625,9 @@ static int iwrap_partial(void *closure, const char *name, struct mustach_sbuf *s
 	return rc;
 }
 
+static int process(const char *template, size_t length, struct iwrap *iwrap, FILE *file, struct prefix *prefix);
+static int include(const char *name, struct iwrap *iwrap, FILE *file, struct prefix *prefix);
+
 static int emitprefix(struct iwrap *iwrap, FILE *file, struct prefix *prefix)
 {
 	if (prefix->prefix) {
@@ -230,30 +635,317 @@ static int emitprefix(struct iwrap *iwrap, FILE *file, struct prefix *prefix)
 		if (rc < 0)
 			return rc;
 	}
-	return prefix->len ? iwrap->emit(iwrap->closure, prefix->start, prefix->len, 0, file) : 0;
+	return prefix->len ? oemit(iwrap, prefix->start, prefix->len, 0, file) : 0;
 }
 
-static int process(const char *template, size_t length, struct iwrap *iwrap, FILE *file, struct prefix *prefix)
-{
-	struct mustach_sbuf sbuf;
+struct delim {
+	size_t oplen, cllen;
 	char opstr[MUSTACH_MAX_DELIM_LENGTH], clstr[MUSTACH_MAX_DELIM_LENGTH];
+};
+
+struct tag {
+	char kind;          /* first character of the tag or '&' for unescaped */
+	char clear;         /* the tag can't be standalone */
+	const char *name;   /* name of the tag, not zero terminated */
+	size_t length;      /* length of the name */
+	const char *next;   /* text following the tag */
+};
+
+static void delim_init(struct delim *delim)
+{
+	delim->opstr[0] = delim->opstr[1] = '{';
+	delim->clstr[0] = delim->clstr[1] = '}';
+	delim->oplen = delim->cllen = 2;
+}
+
+static int delim_same(const struct delim *a, const struct delim *b)
+{
+	return a->oplen == b->oplen && a->cllen == b->cllen
+		&& !memcmp(a->opstr, b->opstr, a->oplen)
+		&& !memcmp(a->clstr, b->clstr, a->cllen);
+}
+
+/* defines delimiters from the content 'beg' of 'len' of the tag {{=...=}} */
+static int delim_set(struct delim *delim, const char *beg, size_t len)
+{
+	size_t l;
+
+	if (len < 5 || beg[len - 1] != '=')
+		return MUSTACH_ERROR_BAD_SEPARATORS;
+	beg++;
+	len -= 2;
+	while (len && isspace(*beg))
+		beg++, len--;
+	while (len && isspace(beg[len - 1]))
+		len--;
+	for (l = 0; l < len && !isspace(beg[l]) ; l++);
+	if (l == len || l > MUSTACH_MAX_DELIM_LENGTH)
+		return MUSTACH_ERROR_BAD_SEPARATORS;
+	delim->oplen = l;
+	memcpy(delim->opstr, beg, l);
+	while (l < len && isspace(beg[l])) l++;
+	if (l == len || len - l > MUSTACH_MAX_DELIM_LENGTH)
+		return MUSTACH_ERROR_BAD_SEPARATORS;
+	delim->cllen = len - l;
+	memcpy(delim->clstr, beg + l, delim->cllen);
+	return MUSTACH_OK;
+}
+
+/*
+ * reads the tag whose content starts at 'beg', just after the
+ * openning delimiter. For the tag '=', the name is the full content.
+ */
+static int read_tag(const char *beg, const char *end, const struct delim *delim, int flags, struct tag *tag)
+{
+	const char *term;
+	size_t len, l;
+	char c;
+
+	/* search next closing delimiter */
+	for (term = beg ; ; term++) {
+		term = memchr(term, *delim->clstr, (size_t)(end - term));
+		if (term == NULL)
+			return MUSTACH_ERROR_UNEXPECTED_END;
+		if (end - term >= (ssize_t)delim->cllen) {
+			for (l = 1 ; l < delim->cllen && term[l] == delim->clstr[l] ; l++);
+			if (l == delim->cllen)
+				break;
+		}
+	}
+	tag->next = term + delim->cllen;
+	tag->clear = 0;
+	len = (size_t)(term - beg);
+	c = *beg;
+	switch(c) {
+	case ':':
+		tag->clear = 1;
+		if (flags & Mustach_With_Colon)
+			goto exclude_first;
+		goto get_name;
+	case '!':
+	case '=':
+		break;
+	case '{':
+		for (l = 0 ; l < delim->cllen && delim->clstr[l] == '}' ; l++);
+		if (l < delim->cllen) {
+			if (!len || beg[len-1] != '}')
+				return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
+			len--;
+		} else {
+			if (term[l] != '}')
+				return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
+			tag->next++;
+		}
+		c = '&';
+		/*@fallthrough@*/
+	case '&':
+		tag->clear = 1;
+		/*@fallthrough@*/
+	case '^':
+	case '#':
+	case '/':
+	case '>':
+exclude_first:
+		beg++;
+		len--;
+		goto get_name;
+	default:
+		tag->clear = 1;
+get_name:
+		while (len && isspace(beg[0])) { beg++; len--; }
+		while (len && isspace(beg[len-1])) len--;
+		if (len == 0 && !(flags & Mustach_With_EmptyTag))
+			return MUSTACH_ERROR_EMPTY_TAG;
+		if (len > MUSTACH_MAX_LENGTH)
+			return MUSTACH_ERROR_TAG_TOO_LONG;
+		break;
+	}
+	tag->kind = c;
+	tag->name = beg;
+	tag->length = len;
+	return MUSTACH_OK;
+}
+
+/*
+ * Skip index of disabled sections
+ *
+ * When a section is disabled, 'process' only has to track the delimiters
+ * and the standalone state until its closing tag. The result of that
+ * scan is recorded, indexed by the offset of the section's content, so
+ * that next times the section is disabled (in loops) it is skipped at once.
+ */
+struct skip {
+	size_t from;        /* offset of the content of the section */
+	size_t seg;         /* offset of the text preceding the closing tag */
+	size_t to;          /* offset of the closing tag */
+	struct delim in;    /* delimiters at 'from' */
+	struct delim out;   /* delimiters at 'to' */
+	unsigned char keep; /* keep stdalone */
+	unsigned char stdalone; /* stdalone if not kept */
+};
+
+struct skiptab {
+	const char *base;   /* the template */
+	unsigned count;     /* count of skips */
+	unsigned alloc;     /* allocated count of skips */
+	struct skip *skips; /* skips sorted by 'from' */
+	struct skip tmp;    /* for skips that can't be recorded */
+};
+
+/*
+ * scans the disabled content of the section of 'name' and 'length',
+ * starting at 'template' with 'depth' sections opened. Returns 1 on success
+ * or 0 if an error prevents to reach the closing tag, in that case,
+ * the error is left to 'process'.
+ */
+static int skip_scan(const char *template, const char *end, const char *name, size_t length, int depth, int flags, struct skip *skip)
+{
+	struct { const char *name; size_t length; } stack[MUSTACH_MAX_DEPTH];
+	const char *beg, *base;
+	struct tag tag;
+	int nest, keep, stdalone;
+	size_t l;
+	char c;
+
+	base = template - skip->from;
+	skip->out = skip->in;
+	keep = 1;
+	nest = stdalone = 0;
+	for (;;) {
+		/* search next openning delimiter */
+		for (beg = template ; ; beg++) {
+			if (!keep && !stdalone)
+				beg = scan2(beg, end, '\n', *skip->out.opstr);
+			if (beg == end)
+				return 0;
+			c = *beg;
+			if (c == '\n') {
+				template = beg + 1;
+				keep = 0;
+				stdalone = 1;
+			}
+			else if (!isspace(c)) {
+				if (c == *skip->out.opstr && end - beg >= (ssize_t)skip->out.oplen) {
+					for (l = 1 ; l < skip->out.oplen && beg[l] == skip->out.opstr[l] ; l++);
+					if (l == skip->out.oplen)
+						break;
+				}
+				keep = 0;
+				stdalone = 0;
+			}
+		}
+		if (read_tag(beg + skip->out.oplen, end, &skip->out, flags, &tag) < 0)
+			return 0;
+		switch (tag.kind) {
+		case '=':
+			if (delim_set(&skip->out, tag.name, tag.length) < 0)
+				return 0;
+			break;
+		case '^':
+		case '#':
+			if (depth + nest == MUSTACH_MAX_DEPTH)
+				return 0;
+			stack[nest].name = tag.name;
+			stack[nest++].length = tag.length;
+			break;
+		case '/':
+			if (nest == 0) {
+				if (tag.length != length || memcmp(tag.name, name, length))
+					return 0;
+				skip->seg = (size_t)(template - base);
+				skip->to = (size_t)(beg - base);
+				skip->keep = (unsigned char)keep;
+				skip->stdalone = (unsigned char)stdalone;
+				return 1;
+			}
+			nest--;
+			if (tag.length != stack[nest].length || memcmp(tag.name, stack[nest].name, tag.length))
+				return 0;
+			break;
+		}
+		if (tag.clear) {
+			keep = 0;
+			stdalone = 0;
+		}
+		else if (stdalone)
+			stdalone = 2;
+		template = tag.next;
+	}
+}
+
+/*
+ * get in 'result' the skip of the disabled section of 'name' and 'length'
+ * whose content starts at 'template'. Returns 1 if the section can be
+ * skipped, 0 if not or a negative error code.
+ */
+static int skip_get(struct skiptab *tab, const char *template, const char *end, const char *name, size_t length, int depth, int flags, const struct delim *delim, const struct skip **result)
+{
+	unsigned low, up, mid;
+	size_t from;
+	struct skip *skip;
+
+	/* search */
+	from = (size_t)(template - tab->base);
+	low = 0;
+	up = tab->count;
+	while (low < up) {
+		mid = (low + up) >> 1;
+		if (tab->skips[mid].from < from)
+			low = mid + 1;
+		else
+			up = mid;
+	}
+	if (low < tab->count && tab->skips[low].from == from && delim_same(&tab->skips[low].in, delim)) {
+		*result = &tab->skips[low];
+		return 1;
+	}
+
+	/* compute */
+	skip = &tab->tmp;
+	skip->from = from;
+	skip->in = *delim;
+	if (!skip_scan(template, end, name, length, depth, flags, skip))
+		return 0;
+
+	/* record */
+	if (low == tab->count || tab->skips[low].from != from) {
+		if (tab->count == tab->alloc) {
+			skip = realloc(tab->skips, (tab->alloc ? tab->alloc << 1 : 16) * sizeof *skip);
+			if (skip == NULL)
+				return MUSTACH_ERROR_SYSTEM;
+			tab->skips = skip;
+			tab->alloc = tab->alloc ? tab->alloc << 1 : 16;
+		}
+		skip = &tab->skips[low];
+		memmove(skip + 1, skip, (tab->count - low) * sizeof *skip);
+		*skip = tab->tmp;
+		tab->count++;
+	}
+	*result = skip;
+	return 1;
+}
+
+static int interpret(const char *template, const char *end, struct iwrap *iwrap, FILE *file, struct prefix *prefix, struct skiptab *skiptab)
+{
+	struct delim delim;
+	struct tag tag;
+	const struct skip *skip;
 	char name[MUSTACH_MAX_LENGTH + 1], c;
-	const char *beg, *term, *end;
+	const char *beg;
 	struct { const char *name, *again; size_t length; unsigned enabled: 1, entered: 1; } stack[MUSTACH_MAX_DEPTH];
-	size_t oplen, cllen, len, l;
+	size_t l;
 	int depth, rc, enabled, stdalone;
 	struct prefix pref;
 
 	pref.prefix = prefix;
-	end = template + (length ? length : strlen(template));
-	opstr[0] = opstr[1] = '{';
-	clstr[0] = clstr[1] = '}';
-	oplen = cllen = 2;
+	delim_init(&delim);
 	stdalone = enabled = 1;
 	depth = pref.len = 0;
 	for (;;) {
 		/* search next openning delimiter */
 		for (beg = template ; ; beg++) {
+			if (!stdalone)
+				beg = scan2(beg, end, '\n', *delim.opstr);
 			c = beg == end ? '\n' : *beg;
 			if (c == '\n') {
 				l = (beg != end) + (size_t)(beg - template);
@@ -263,7 +955,7 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
 						if (rc < 0)
 							return rc;
 					}
-					rc = iwrap->emit(iwrap->closure, template, l, 0, file);
+					rc = oemit(iwrap, template, l, 0, file);
 					if (rc < 0)
 						return rc;
 				}
@@ -281,111 +973,48 @@ static int process(const char *template, size_t length, struct iwrap *iwrap, FIL
 					pref.len = 0;
 					stdalone = 0;
 				}
-				if (c == *opstr && end - beg >= (ssize_t)oplen) {
-					for (l = 1 ; l < oplen && beg[l] == opstr[l] ; l++);
-					if (l == oplen)
+				if (c == *delim.opstr && end - beg >= (ssize_t)delim.oplen) {
+					for (l = 1 ; l < delim.oplen && beg[l] == delim.opstr[l] ; l++);
+					if (l == delim.oplen)
 						break;
 				}
 				stdalone = 0;
 			}
 		}
 
+skipped:
 		pref.start = template;
 		pref.len = enabled ? (size_t)(beg - template) : 0;
-		beg += oplen;
-
-		/* search next closing delimiter */
-		for (term = beg ; ; term++) {
-			if (term == end)
-				return MUSTACH_ERROR_UNEXPECTED_END;
-			if (*term == *clstr && end - term >= (ssize_t)cllen) {
-				for (l = 1 ; l < cllen && term[l] == clstr[l] ; l++);
-				if (l == cllen)
-					break;
-			}
+
+		rc = read_tag(beg + delim.oplen, end, &delim, iwrap->flags, &tag);
+		if (rc < 0)
+			return rc;
+		template = tag.next;
+		c = tag.kind;
+		if (tag.clear)
+			stdalone = 0;
+		if (c != '!' && c != '=') {
+			memcpy(name, tag.name, tag.length);
+			name[tag.length] = 0;
+		}
+		if (stdalone)
+			stdalone = 2;
+		else if (enabled) {
+			rc = emitprefix(iwrap, file, &pref);
+			if (rc < 0)
+				return rc;
+			pref.len = 0;
 		}
-		template = term + cllen;
-		len = (size_t)(term - beg);
-		c = *beg;
 		switch(c) {
-		case ':':
-			stdalone = 0;
-			if (iwrap->flags & Mustach_With_Colon)
-				goto exclude_first;
-			goto get_name;
 		case '!':
+			/* comment */
+			/* nothing to do */
+			break;
 		case '=':
-			break;
-		case '{':
-			for (l = 0 ; l < cllen && clstr[l] == '}' ; l++);
-			if (l < cllen) {
-				if (!len || beg[len-1] != '}')
-					return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
-				len--;
-			} else {
-				if (term[l] != '}')
-					return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
-				template++;
-			}
-			c = '&';
-			/*@fallthrough@*/
-		case '&':
-			stdalone = 0;
-			/*@fallthrough@*/
-		case '^':
-		case '#':
-		case '/':
-		case '>':
-exclude_first:
-			beg++;
-			len--;
-			goto get_name;
-		default:
-			stdalone = 0;
-get_name:
-			while (len && isspace(beg[0])) { beg++; len--; }
-			while (len && isspace(beg[len-1])) len--;
-			if (len == 0 && !(iwrap->flags & Mustach_With_EmptyTag))
-				return MUSTACH_ERROR_EMPTY_TAG;
-			if (len > MUSTACH_MAX_LENGTH)
-				return MUSTACH_ERROR_TAG_TOO_LONG;
-			memcpy(name, beg, len);
-			name[len] = 0;
-			break;
-		}
-		if (stdalone)
-			stdalone = 2;
-		else if (enabled) {
-			rc = emitprefix(iwrap, file, &pref);
-			if (rc < 0)
-				return rc;
-			pref.len = 0;
-		}
-		switch(c) {
-		case '!':
-			/* comment */
-			/* nothing to do */
-			break;
-		case '=':
-			/* defines delimiters */
-			if (len < 5 || beg[len - 1] != '=')
-				return MUSTACH_ERROR_BAD_SEPARATORS;
-			beg++;
-			len -= 2;
-			while (len && isspace(*beg))
-				beg++, len--;
-			while (len && isspace(beg[len - 1]))
-				len--;
-			for (l = 0; l < len && !isspace(beg[l]) ; l++);
-			if (l == len || l > MUSTACH_MAX_DELIM_LENGTH)
-				return MUSTACH_ERROR_BAD_SEPARATORS;
-			oplen = l;
-			memcpy(opstr, beg, l);
-			while (l < len && isspace(beg[l])) l++;
-			if (l == len || len - l > MUSTACH_MAX_DELIM_LENGTH)
-				return MUSTACH_ERROR_BAD_SEPARATORS;
-			cllen = len - l;
-			memcpy(clstr, beg + l, cllen);
+			/* defines delimiters */
+			rc = delim_set(&delim, tag.name, tag.length);
+			if (rc < 0)
+				return rc;
 			break;
 		case '^':
 		case '#':
@@ -398,18 +1027,31 @@ get_name:
 				if (rc < 0)
 					return rc;
 			}
-			stack[depth].name = beg;
+			stack[depth].name = tag.name;
 			stack[depth].again = template;
-			stack[depth].length = len;
+			stack[depth].length = tag.length;
 			stack[depth].enabled = enabled != 0;
 			stack[depth].entered = rc != 0;
-			if ((c == '#') == (rc == 0))
-				enabled = 0;
 			depth++;
+			if ((c == '#') == (rc == 0) && enabled) {
+				/* disabled, go directly to the closing tag if possible */
+				enabled = 0;
+				rc = skip_get(skiptab, template, end, tag.name, tag.length, depth, iwrap->flags, &delim, &skip);
+				if (rc < 0)
+					return rc;
+				if (rc) {
+					template = skiptab->base + skip->seg;
+					beg = skiptab->base + skip->to;
+					delim = skip->out;
+					if (!skip->keep)
+						stdalone = skip->stdalone;
+					goto skipped;
+				}
+			}
 			break;
 		case '/':
 			/* end section */
-			if (depth-- == 0 || len != stack[depth].length || memcmp(stack[depth].name, name, len))
+			if (depth-- == 0 || tag.length != stack[depth].length || memcmp(stack[depth].name, name, tag.length))
 				return MUSTACH_ERROR_CLOSING;
 			rc = enabled && stack[depth].entered ? iwrap->next(iwrap->closure) : 0;
 			if (rc < 0)
@@ -425,12 +1067,7 @@ get_name:
 		case '>':
 			/* partials */
 			if (enabled) {
-				sbuf_reset(&sbuf);
-				rc = iwrap->partial(iwrap->closure_partial, name, &sbuf);
-				if (rc >= 0) {
-					rc = process(sbuf.value, sbuf_length(&sbuf), iwrap, file, &pref);
-					sbuf_release(&sbuf);
-				}
+				rc = include(name, iwrap, file, &pref);
 				if (rc < 0)
 					return rc;
 			}
@@ -438,7 +1075,7 @@ get_name:
 		default:
 			/* replacement */
 			if (enabled) {
-				rc = iwrap->put(iwrap->closure_put, name, c != '&', file);
+				rc = oput(iwrap, name, c != '&', file);
 				if (rc < 0)
 					return rc;
 			}
@@ -447,66 +1084,1020 @@ get_name:
 	}
 }
 
-int mustach_file(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, FILE *file)
+static int process(const char *template, size_t length, struct iwrap *iwrap, FILE *file, struct prefix *prefix)
 {
 	int rc;
-	struct iwrap iwrap;
+	struct skiptab skiptab;
+
+	skiptab.base = template;
+	skiptab.count = skiptab.alloc = 0;
+	skiptab.skips = NULL;
+	rc = interpret(template, template + (length ? length : strlen(template)), iwrap, file, prefix, &skiptab);
+	free(skiptab.skips);
+	return rc;
+}
+
+/*
+ * Operations of compiled templates
+ *
+ * Each operation is preceded by a text, the text that 'process'
+ * would have scanned before reaching the operation: for tags, it is
+ * the text between the previous tag or end of line and the opening
+ * delimiter, for end of lines, it is the text of the line including
+ * the new line character.
+ */
+enum opcode {
+	O_line,         /* end of line */
+	O_end,          /* end of the template */
+	O_none,         /* tag without action: comment or delimiters */
+	O_section,      /* {{#name}} */
+	O_inverted,     /* {{^name}} */
+	O_close,        /* {{/name}} */
+	O_partial,      /* {{>name}} */
+	O_escaped,      /* {{name}} */
+	O_raw           /* {{&name}} or {{{name}}} */
+};
+
+struct op {
+	const char *start;     /* start of the text preceding the operation */
+	size_t length;         /* length of that text */
+	const char *name;      /* name of the tag, zero terminated */
+	unsigned jump;         /* index of the matching section/close operation */
+	unsigned char opcode;  /* the opcode */
+	unsigned char nonspace: 1; /* the text has a not space character */
+	unsigned char clear: 1;    /* tag not standalone or line not empty */
+	unsigned char keep: 1;     /* close when skipped: keep stdalone */
+	unsigned char stdalone: 2; /* close when skipped: stdalone to set */
+	unsigned char partials: 1; /* section: its content includes partials */
+};
+
+struct mustach_compiled {
+	int flags;             /* flags used for compiling */
+	size_t length;         /* length of the template */
+	char *text;            /* private copy of the template */
+	struct op *ops;        /* operations, last is O_end, NULL if interpreted */
+};
 
+static int add_op(struct mustach_compiled *compiled, unsigned *count, unsigned *alloc, const char *start, size_t length, int nonspace)
+{
+	struct op *ops;
+	unsigned n = *count;
+
+	if (n == *alloc) {
+		*alloc = n ? n << 1 : 32;
+		ops = realloc(compiled->ops, *alloc * sizeof *ops);
+		if (ops == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		compiled->ops = ops;
+	}
+	ops = &compiled->ops[n];
+	memset(ops, 0, sizeof *ops);
+	ops->start = start;
+	ops->length = length;
+	ops->nonspace = nonspace != 0;
+	*count = n + 1;
+	return MUSTACH_OK;
+}
+
+/*
+ * compute the state 'stdalone' that is reached at the closing tag 'close'
+ * when the operations following 'open' are skipped because disabled
+ */
+static void skip_state(struct op *open, struct op *close)
+{
+	int keep = 1, stdalone = 0;
+	struct op *op;
+
+	for (op = open + 1 ; op != close ; op++) {
+		if (op->opcode == O_line) {
+			keep = 0;
+			stdalone = 1;
+		}
+		else if (op->nonspace || op->clear) {
+			keep = 0;
+			stdalone = 0;
+		}
+		else if (stdalone)
+			stdalone = 2;
+	}
+	close->keep = keep;
+	close->stdalone = stdalone;
+}
+
+static int compile(struct mustach_compiled *compiled, size_t length)
+{
+	char *template, *beg, *end, c;
+	struct { unsigned index; struct delim delim; } stack[MUSTACH_MAX_DEPTH];
+	struct delim delim;
+	struct tag tag;
+	unsigned count, alloc, index;
+	size_t l;
+	int depth, rc, nonspace, i;
+	struct op *op;
+
+	template = compiled->text;
+	end = template + length;
+	delim_init(&delim);
+	depth = nonspace = 0;
+	count = alloc = 0;
+	for (;;) {
+		/* search next openning delimiter */
+		for (beg = template ; ; beg++) {
+			if (nonspace)
+				beg += scan2(beg, end, '\n', *delim.opstr) - beg;
+			c = beg == end ? '\n' : *beg;
+			if (c == '\n') {
+				l = (beg != end) + (size_t)(beg - template);
+				rc = add_op(compiled, &count, &alloc, template, l, nonspace);
+				if (rc < 0)
+					return rc;
+				op = &compiled->ops[count - 1];
+				op->clear = beg != template; /* prefix not empty lines */
+				if (beg == end) { /* no more mustach */
+					op->opcode = O_end;
+					return depth ? MUSTACH_ERROR_UNEXPECTED_END : MUSTACH_OK;
+				}
+				op->opcode = O_line;
+				template += l;
+				nonspace = 0;
+			}
+			else if (!isspace(c)) {
+				if (c == *delim.opstr && end - beg >= (ssize_t)delim.oplen) {
+					for (l = 1 ; l < delim.oplen && beg[l] == delim.opstr[l] ; l++);
+					if (l == delim.oplen)
+						break;
+				}
+				nonspace = 1;
+			}
+		}
+
+		rc = add_op(compiled, &count, &alloc, template, (size_t)(beg - template), nonspace);
+		if (rc < 0)
+			return rc;
+		index = count - 1;
+		op = &compiled->ops[index];
+
+		rc = read_tag(beg + delim.oplen, end, &delim, compiled->flags, &tag);
+		if (rc < 0)
+			return rc;
+		template = compiled->text + (tag.next - compiled->text);
+		op->clear = tag.clear;
+		c = tag.kind;
+		if (c != '!' && c != '=') {
+			/* the tag is never read again, terminate the name in place */
+			beg = compiled->text + (tag.name - compiled->text);
+			beg[tag.length] = 0;
+			op->name = beg;
+		}
+		switch(c) {
+		case '!':
+			op->opcode = O_none;
+			break;
+		case '=':
+			/* defines delimiters */
+			op->opcode = O_none;
+			rc = delim_set(&delim, tag.name, tag.length);
+			if (rc < 0)
+				return rc;
+			break;
+		case '^':
+		case '#':
+			/* begin section */
+			if (depth == MUSTACH_MAX_DEPTH)
+				return MUSTACH_ERROR_TOO_DEEP;
+			op->opcode = c == '#' ? O_section : O_inverted;
+			stack[depth].index = index;
+			stack[depth].delim = delim;
+			depth++;
+			break;
+		case '/':
+			/* end section */
+			if (depth-- == 0 || strcmp(compiled->ops[stack[depth].index].name, op->name))
+				return MUSTACH_ERROR_CLOSING;
+			/*
+			 * when iterating, 'process' scans the section again with the
+			 * delimiters of its end, that can't be compiled statically
+			 */
+			if (!delim_same(&delim, &stack[depth].delim))
+				return 1;
+			op->opcode = O_close;
+			op->jump = stack[depth].index;
+			compiled->ops[op->jump].jump = index;
+			skip_state(&compiled->ops[op->jump], op);
+			break;
+		case '>':
+			op->opcode = O_partial;
+			for (i = 0 ; i < depth ; i++)
+				compiled->ops[stack[i].index].partials = 1;
+			break;
+		default:
+			op->opcode = c == '&' ? O_raw : O_escaped;
+			break;
+		}
+		nonspace = 0;
+	}
+}
+
+static int split(const struct mustach_compiled *compiled, const struct op *open, struct iwrap *iwrap, FILE *file, int *stdalone, struct prefix *pref);
+
+/*
+ * State of the render of a compiled template. It is kept between
+ * the steps of resumable renders.
+ */
+struct frame {
+	const struct mustach_compiled *compiled;
+	const struct op *op;    /* the next operation */
+	const struct op *last;  /* closing of the section rendered or NULL */
+	size_t count;           /* count of items of the section to render */
+	int stdalone;           /* state of lines */
+	int enabled;            /* the operations are not skipped */
+	int depth;              /* depth of sections */
+	struct prefix pref;     /* pending text */
+	struct { unsigned enabled: 1, entered: 1; } stack[MUSTACH_MAX_DEPTH];
+};
+
+/* internal status of resumable renders asking to include a partial */
+#define RENDER_INCLUDE 2
+
+/*
+ * init the 'frame' for rendering the operations from 'op' with the
+ * state of lines 'stdalone' and 'pending'. When 'last' is not NULL, it
+ * is the closing of a section whose 'count' items are rendered and the
+ * render stops after the last.
+ */
+static void frame_init(struct frame *frame, const struct mustach_compiled *compiled, const struct op *op, const struct op *last, size_t count, int stdalone, const struct prefix *pending)
+{
+	frame->compiled = compiled;
+	frame->op = op;
+	frame->last = last;
+	frame->count = count;
+	frame->stdalone = stdalone;
+	frame->enabled = 1;
+	frame->depth = 0;
+	frame->pref = *pending;
+}
+
+/* saves the state of a render in 'frame' and returns 'status' */
+static int frame_save(struct frame *frame, const struct op *op, size_t count, int stdalone, int enabled, int depth, const struct prefix *pref, int status)
+{
+	frame->op = op;
+	frame->count = count;
+	frame->stdalone = stdalone;
+	frame->enabled = enabled;
+	frame->depth = depth;
+	frame->pref = *pref;
+	return status;
+}
+
+/*
+ * renders the operations of the 'frame'. When the render can be
+ * suspended, returns MUSTACH_AGAIN when output waits for the sink
+ * or RENDER_INCLUDE for including the partial of the operation
+ * preceding the next one, the state being saved in 'frame'.
+ */
+static int render(struct frame *frame, struct iwrap *iwrap, FILE *file)
+{
+	const struct mustach_compiled *compiled = frame->compiled;
+	const struct op *op = frame->op, *last = frame->last;
+	size_t count = frame->count;
+	int depth, rc, enabled, stdalone;
+	struct prefix pref;
+
+	stdalone = frame->stdalone;
+	enabled = frame->enabled;
+	depth = frame->depth;
+	pref = frame->pref;
+	for ( ; ; op++) {
+		/* output waiting for the sink of a resumable render */
+		if (iwrap->suspend && render_waiting(iwrap->render))
+			return frame_save(frame, op, count, stdalone, enabled, depth, &pref, MUSTACH_AGAIN);
+
+		/* a not space character of the preceding text */
+		if (op->nonspace) {
+			if (stdalone == 2 && enabled) {
+				rc = emitprefix(iwrap, file, &pref);
+				if (rc < 0)
+					return rc;
+				pref.len = 0;
+			}
+			stdalone = 0;
+		}
+
+		/* end of lines */
+		if (op->opcode <= O_end) {
+			if (stdalone != 2 && enabled) {
+				if (op->clear) {
+					rc = emitprefix(iwrap, file, &pref);
+					if (rc < 0)
+						return rc;
+				}
+				rc = oemit(iwrap, op->start, op->length, 0, file);
+				if (rc < 0)
+					return rc;
+			}
+			if (op->opcode == O_end)
+				return MUSTACH_OK;
+			stdalone = 1;
+			pref.len = 0;
+			continue;
+		}
+
+		/* opening delimiter */
+		if (stdalone == 2 && enabled) {
+			rc = emitprefix(iwrap, file, &pref);
+			if (rc < 0)
+				return rc;
+			stdalone = 0;
+		}
+		pref.start = op->start;
+		pref.len = enabled ? op->length : 0;
+		if (op->clear)
+			stdalone = 0;
+		if (stdalone)
+			stdalone = 2;
+		else if (enabled) {
+			rc = emitprefix(iwrap, file, &pref);
+			if (rc < 0)
+				return rc;
+			pref.len = 0;
+		}
+
+		switch(op->opcode) {
+		case O_section:
+		case O_inverted:
+			rc = enabled;
+			if (rc) {
+				rc = iwrap->enter(iwrap->closure, op->name);
+				if (rc < 0)
+					return rc;
+				if (rc && op->opcode == O_section && iwrap->split != NULL) {
+					/* render the items by many threads if possible */
+					rc = split(compiled, op, iwrap, file, &stdalone, &pref);
+					if (rc < 0)
+						return rc;
+					if (rc) {
+						iwrap->leave(iwrap->closure);
+						op = &compiled->ops[op->jump];
+						break;
+					}
+					rc = 1;
+				}
+			}
+			frame->stack[depth].enabled = enabled != 0;
+			frame->stack[depth].entered = rc != 0;
+			depth++;
+			if ((op->opcode == O_section) == (rc == 0)) {
+				/* skip the disabled content up to its closing */
+				enabled = 0;
+				op = &compiled->ops[op->jump];
+				if (!op->keep)
+					stdalone = op->stdalone;
+				op--;
+			}
+			break;
+		case O_close:
+			if (op == last) {
+				/* end of an item of the section rendered */
+				if (--count == 0)
+					return MUSTACH_OK;
+				rc = iwrap->next(iwrap->closure);
+				if (rc <= 0)
+					return rc < 0 ? rc : MUSTACH_ERROR_ITEM_NOT_FOUND;
+				op = &compiled->ops[op->jump];
+				break;
+			}
+			depth--;
+			rc = enabled && frame->stack[depth].entered ? iwrap->next(iwrap->closure) : 0;
+			if (rc < 0)
+				return rc;
+			if (rc) {
+				op = &compiled->ops[op->jump];
+				depth++;
+			} else {
+				enabled = frame->stack[depth].enabled;
+				if (enabled && frame->stack[depth].entered)
+					iwrap->leave(iwrap->closure);
+			}
+			break;
+		case O_partial:
+			if (enabled) {
+				if (iwrap->suspend)
+					return frame_save(frame, op + 1, count, stdalone, enabled, depth, &pref, RENDER_INCLUDE);
+				rc = include(op->name, iwrap, file, &pref);
+				if (rc < 0)
+					return rc;
+			}
+			break;
+		case O_escaped:
+		case O_raw:
+			if (enabled) {
+				rc = oput(iwrap, op->name, op->opcode == O_escaped, file);
+				if (rc < 0)
+					return rc;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * renders the partial of 'name' with the indentation 'prefix', compiled
+ * when the interface gives it so
+ */
+static int include(const char *name, struct iwrap *iwrap, FILE *file, struct prefix *prefix)
+{
+	const struct mustach_compiled *compiled = NULL;
+	struct mustach_sbuf sbuf;
+	struct prefix pending;
+	struct frame frame;
+	int rc;
+
+	sbuf_reset(&sbuf);
+	if (iwrap->compiled_partial != NULL)
+		rc = iwrap->compiled_partial(iwrap->closure, name, &compiled, &sbuf);
+	else
+		rc = iwrap->partial(iwrap->closure_partial, name, &sbuf);
+	if (rc >= 0) {
+		if (compiled == NULL)
+			rc = process(sbuf.value, sbuf_length(&sbuf), iwrap, file, prefix);
+		else if (compiled->ops == NULL)
+			rc = process(compiled->text, compiled->length, iwrap, file, prefix);
+		else {
+			pending.len = 0;
+			pending.prefix = prefix;
+			frame_init(&frame, compiled, compiled->ops, NULL, 0, 1, &pending);
+			rc = render(&frame, iwrap, file);
+		}
+		sbuf_release(&sbuf);
+	}
+	return rc;
+}
+
+/*
+ * Sections split between threads
+ * -------------------------------
+ * When the interface allows it, the items of a section just entered are
+ * shared in consecutive chunks between threads. The calling thread renders
+ * the first chunk to the output while each other thread renders its chunk
+ * in memory with its copy of the closure. The texts of the chunks are then
+ * emitted in order. Nested sections are not split again.
+ *
+ * The first item of a chunk starts with the state of lines that follows
+ * the closing tag of the section. That state must not depend on the data:
+ * it is the case when the closing tag or the operation before it has text
+ * or can't be standalone, or when it follows a new line. Otherwise, the
+ * items are rendered in sequence.
+ */
+
+/* a chunk of items rendered by a thread */
+struct chunk {
+	const struct mustach_compiled *compiled;
+	const struct op *open;  /* the opening of the section */
+	size_t count;           /* count of items of the chunk */
+	int stdalone;           /* state of lines at start */
+	struct prefix pref;     /* pending text at start */
+	pthread_t thread;
+	int started;            /* the thread is started */
+	int status;             /* status of the render */
+	char *text;             /* the rendered text */
+	size_t size;            /* size of the text */
+	struct iwrap iwrap;     /* with the copy of the closure */
+};
+
+/* renders the items of the chunk 'arg' in memory */
+static void *chunk_run(void *arg)
+{
+	struct chunk *chunk = arg;
+	const struct op *open = chunk->open;
+	struct frame frame;
+	FILE *file;
+	int rc, rc2;
+
+	file = memfile_open(&chunk->text, &chunk->size);
+	if (file == NULL)
+		rc = MUSTACH_ERROR_SYSTEM;
+	else {
+		chunk->iwrap.file = file;
+		frame_init(&frame, chunk->compiled, open + 1, &chunk->compiled->ops[open->jump], chunk->count, chunk->stdalone, &chunk->pref);
+		rc = render(&frame, &chunk->iwrap, file);
+		rc2 = oflush(&chunk->iwrap);
+		if (rc >= 0)
+			rc = rc2;
+		if (rc < 0)
+			memfile_abort(file, &chunk->text, &chunk->size);
+		else
+			rc = memfile_close(file, &chunk->text, &chunk->size);
+	}
+	chunk->status = rc;
+	return NULL;
+}
+
+/*
+ * renders the items of the section entered at 'open' by many threads if
+ * possible. Returns 1 when done, setting the state of lines 'stdalone'
+ * and 'pref' to the one after the section, or 0 when the items must be
+ * rendered in sequence or else a negative error code.
+ */
+static int split(const struct mustach_compiled *compiled, const struct op *open, struct iwrap *iwrap, FILE *file, int *stdalone, struct prefix *pref)
+{
+	const struct op *close = &compiled->ops[open->jump];
+	int (*splitcb)(void *closure, int partials, size_t *items);
+	struct chunk *chunks, *chunk;
+	struct prefix after;
+	struct frame frame;
+	int stdafter, threads, i, rc;
+	size_t items;
+	void *clone;
+
+	/* state of lines after an item */
+	if (close == open + 1)
+		return 0;
+	after.prefix = pref->prefix;
+	after.start = close->start;
+	after.len = 0;
+	if (close->nonspace || close->clear)
+		stdafter = 0;
+	else if (close[-1].opcode == O_line) {
+		stdafter = 2;
+		after.len = close->length;
+	}
+	else if (close[-1].nonspace || close[-1].clear)
+		stdafter = 0;
+	else
+		return 0;
+
+	/* count of threads */
+	items = 0;
+	threads = iwrap->split(iwrap->closure, open->partials, &items);
+	if (threads < 2 || items < 2)
+		return 0;
+	if ((size_t)threads > items)
+		threads = (int)items;
+	chunks = malloc((size_t)(threads - 1) * sizeof *chunks);
+	if (chunks == NULL)
+		return 0;
+
+	/* prepare the chunks of the other threads */
+	for (i = 1 ; i < threads ; i++) {
+		chunk = &chunks[i - 1];
+		clone = iwrap->clone(iwrap->closure, items * (size_t)i / (size_t)threads);
+		if (clone == NULL) {
+			while (--i)
+				iwrap->unclone(chunks[i - 1].iwrap.closure);
+			free(chunks);
+			return 0;
+		}
+		chunk->compiled = compiled;
+		chunk->open = open;
+		chunk->count = items * (size_t)(i + 1) / (size_t)threads - items * (size_t)i / (size_t)threads;
+		chunk->stdalone = stdafter;
+		chunk->pref = after;
+		chunk->text = NULL;
+		chunk->size = 0;
+		chunk->iwrap = *iwrap;
+		chunk->iwrap.closure = clone;
+		if (iwrap->put == iwrap_put)
+			chunk->iwrap.closure_put = &chunk->iwrap;
+		else
+			chunk->iwrap.closure_put = clone;
+		if (iwrap->partial == iwrap_partial)
+			chunk->iwrap.closure_partial = &chunk->iwrap;
+		else
+			chunk->iwrap.closure_partial = clone;
+		chunk->iwrap.split = NULL;
+		chunk->iwrap.fd = -1;
+		chunk->iwrap.oused = 0;
+	}
+
+	/* render the chunks, the first by this thread */
+	for (i = 1 ; i < threads ; i++)
+		chunks[i - 1].started = pthread_create(&chunks[i - 1].thread, NULL, chunk_run, &chunks[i - 1]) == 0;
+	splitcb = iwrap->split;
+	iwrap->split = NULL;
+	frame_init(&frame, compiled, open + 1, close, items / (size_t)threads, *stdalone, pref);
+	rc = render(&frame, iwrap, file);
+	iwrap->split = splitcb;
+
+	/* emit the texts of the chunks in order */
+	for (i = 1 ; i < threads ; i++) {
+		chunk = &chunks[i - 1];
+		if (chunk->started)
+			pthread_join(chunk->thread, NULL);
+		else
+			chunk_run(chunk);
+		if (rc >= 0) {
+			rc = chunk->status;
+			if (rc >= 0 && chunk->size != 0)
+				rc = oemit(iwrap, chunk->text, chunk->size, 0, file);
+		}
+		free(chunk->text);
+		iwrap->unclone(chunk->iwrap.closure);
+	}
+	free(chunks);
+	if (rc < 0)
+		return rc;
+	*stdalone = stdafter;
+	*pref = after;
+	return 1;
+}
+
+int mustach_compile(const char *template, size_t length, int flags, struct mustach_compiled **result)
+{
+	int rc;
+	struct mustach_compiled *compiled;
+
+	*result = NULL;
+	if (length == 0)
+		length = strlen(template);
+	compiled = malloc(sizeof *compiled);
+	if (compiled == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	compiled->flags = flags;
+	compiled->length = length;
+	compiled->ops = NULL;
+	compiled->text = malloc(length + 1);
+	if (compiled->text == NULL)
+		rc = MUSTACH_ERROR_SYSTEM;
+	else {
+		memcpy(compiled->text, template, length);
+		compiled->text[length] = 0;
+		rc = compile(compiled, length);
+		if (rc > 0) {
+			/* not compilable, restore the text for interpreting it */
+			free(compiled->ops);
+			compiled->ops = NULL;
+			memcpy(compiled->text, template, length);
+			rc = MUSTACH_OK;
+		}
+	}
+	if (rc < 0)
+		mustach_compiled_free(compiled);
+	else
+		*result = compiled;
+	return rc;
+}
+
+void mustach_compiled_free(struct mustach_compiled *compiled)
+{
+	if (compiled != NULL) {
+		free(compiled->ops);
+		free(compiled->text);
+		free(compiled);
+	}
+}
+
+int mustach_compiled_flags(const struct mustach_compiled *compiled)
+{
+	return compiled->flags;
+}
+
+static int iwrap_init(struct iwrap *iwrap, const struct mustach_itf *itf, void *closure, int flags, FILE *file, int fd)
+{
 	/* check validity */
 	if (!itf->enter || !itf->next || !itf->leave || (!itf->put && !itf->get))
 		return MUSTACH_ERROR_INVALID_ITF;
 
 	/* init wrap structure */
-	iwrap.closure = closure;
+	iwrap->closure = closure;
 	if (itf->put) {
-		iwrap.put = itf->put;
-		iwrap.closure_put = closure;
+		iwrap->put = itf->put;
+		iwrap->closure_put = closure;
 	} else {
-		iwrap.put = iwrap_put;
-		iwrap.closure_put = &iwrap;
+		iwrap->put = iwrap_put;
+		iwrap->closure_put = iwrap;
 	}
 	if (itf->partial) {
-		iwrap.partial = itf->partial;
-		iwrap.closure_partial = closure;
+		iwrap->partial = itf->partial;
+		iwrap->closure_partial = closure;
 	} else if (itf->get) {
-		iwrap.partial = itf->get;
-		iwrap.closure_partial = closure;
+		iwrap->partial = itf->get;
+		iwrap->closure_partial = closure;
 	} else {
-		iwrap.partial = iwrap_partial;
-		iwrap.closure_partial = &iwrap;
+		iwrap->partial = iwrap_partial;
+		iwrap->closure_partial = iwrap;
 	}
-	iwrap.emit = itf->emit ? itf->emit : iwrap_emit;
-	iwrap.enter = itf->enter;
-	iwrap.next = itf->next;
-	iwrap.leave = itf->leave;
-	iwrap.get = itf->get;
-	iwrap.flags = flags;
+	iwrap->emit = itf->emit ? itf->emit : iwrap_emit;
+	iwrap->enter = itf->enter;
+	iwrap->next = itf->next;
+	iwrap->leave = itf->leave;
+	iwrap->get = itf->get;
+	iwrap->split = itf->clone && itf->unclone ? itf->split : NULL;
+	iwrap->clone = itf->clone;
+	iwrap->unclone = itf->unclone;
+	iwrap->compiled_partial = itf->compiled_partial;
+	iwrap->flags = flags;
+	iwrap->file = file;
+	iwrap->fd = fd;
+	iwrap->render = NULL;
+	iwrap->suspend = 0;
+	iwrap->oused = 0;
+	return MUSTACH_OK;
+}
+
+/* renders the 'template' of 'length' or the 'compiled' one if not NULL */
+static int execute(struct iwrap *iwrap, const struct mustach_itf *itf, void *closure, const char *template, size_t length, const struct mustach_compiled *compiled)
+{
+	int rc, rc2;
+	struct prefix pref;
+	struct frame frame;
 
-	/* process */
 	rc = itf->start ? itf->start(closure) : 0;
-	if (rc == 0)
-		rc = process(template, length, &iwrap, file, 0);
+	if (rc == 0) {
+		if (compiled == NULL)
+			rc = process(template, length, iwrap, iwrap->file, 0);
+		else if (compiled->ops != NULL) {
+			pref.len = 0;
+			pref.prefix = NULL;
+			frame_init(&frame, compiled, compiled->ops, NULL, 0, 1, &pref);
+			rc = render(&frame, iwrap, iwrap->file);
+		}
+		else
+			rc = process(compiled->text, compiled->length, iwrap, iwrap->file, 0);
+		rc2 = oflush(iwrap);
+		if (rc == 0)
+			rc = rc2;
+	}
 	if (itf->stop)
 		itf->stop(closure, rc);
 	return rc;
 }
 
-int mustach_fd(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, int fd)
+/*
+ * renders to the file descriptor 'fd' without closing it. A FILE is only
+ * needed when the interface has its own 'put' or 'emit', it is then
+ * opened on a duplicate of 'fd'.
+ */
+static int execute_fd(const struct mustach_itf *itf, void *closure, int flags, const char *template, size_t length, const struct mustach_compiled *compiled, int fd)
 {
 	int rc;
 	FILE *file;
+	struct iwrap iwrap;
 
+#ifndef _WIN32
+	if (!itf->put && !itf->emit) {
+		rc = iwrap_init(&iwrap, itf, closure, flags, NULL, fd);
+		return rc < 0 ? rc : execute(&iwrap, itf, closure, template, length, compiled);
+	}
+	fd = dup(fd);
+	if (fd < 0)
+		return MUSTACH_ERROR_SYSTEM;
+#endif
 	file = fdopen(fd, "w");
 	if (file == NULL) {
 		rc = MUSTACH_ERROR_SYSTEM;
 		errno = ENOMEM;
 	} else {
-		rc = mustach_file(template, length, itf, closure, flags, file);
+		rc = iwrap_init(&iwrap, itf, closure, flags, file, -1);
+		if (rc == 0)
+			rc = execute(&iwrap, itf, closure, template, length, compiled);
 		fclose(file);
 	}
 	return rc;
 }
 
+int mustach_compiled_file(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, FILE *file)
+{
+	int rc;
+	struct iwrap iwrap;
+
+	rc = iwrap_init(&iwrap, itf, closure, compiled->flags, file, -1);
+	return rc < 0 ? rc : execute(&iwrap, itf, closure, NULL, 0, compiled);
+}
+
+int mustach_compiled_fd(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, int fd)
+{
+	return execute_fd(itf, closure, compiled->flags, NULL, 0, compiled, fd);
+}
+
+int mustach_compiled_mem(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, char **result, size_t *size)
+{
+	int rc;
+	FILE *file;
+	size_t s;
+
+	*result = NULL;
+	if (size == NULL)
+		size = &s;
+	file = memfile_open(result, size);
+	if (file == NULL)
+		rc = MUSTACH_ERROR_SYSTEM;
+	else {
+		rc = mustach_compiled_file(compiled, itf, closure, file);
+		if (rc < 0)
+			memfile_abort(file, result, size);
+		else
+			rc = memfile_close(file, result, size);
+	}
+	return rc;
+}
+
+/* frame of the template or of a partial of a resumable render */
+struct render_frame {
+	struct frame frame;
+	struct render_frame *parent;
+	struct mustach_compiled *owned; /* the partial compiled for the frame or NULL */
+	struct mustach_sbuf sbuf;        /* the partial */
+};
+
+/*
+ * pushes the frame rendering 'compiled' with the indentation 'prefix'.
+ * When done, the frame owns 'owned' and 'sbuf'.
+ */
+static int render_push(struct mustach_render *mr, const struct mustach_compiled *compiled, struct mustach_compiled *owned, const struct mustach_sbuf *sbuf, struct prefix *prefix)
+{
+	struct render_frame *rf;
+	struct prefix pending;
+
+	if (mr->frames == MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+	rf = malloc(sizeof *rf);
+	if (rf == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	pending.len = 0;
+	pending.prefix = prefix;
+	frame_init(&rf->frame, compiled, compiled->ops, NULL, 0, 1, &pending);
+	rf->parent = mr->top;
+	rf->owned = owned;
+	rf->sbuf = *sbuf;
+	mr->top = rf;
+	mr->frames++;
+	return MUSTACH_OK;
+}
+
+static void render_pop(struct mustach_render *mr)
+{
+	struct render_frame *rf = mr->top;
+
+	mr->top = rf->parent;
+	mr->frames--;
+	mustach_compiled_free(rf->owned);
+	sbuf_release(&rf->sbuf);
+	free(rf);
+}
+
+/* ends the render 'mr' with 'status' */
+static void render_end(struct mustach_render *mr, int status)
+{
+	while (mr->top != NULL)
+		render_pop(mr);
+	mr->status = status;
+	if (mr->itf->stop)
+		mr->itf->stop(mr->closure, status);
+}
+
+/*
+ * includes the partial of the operation preceding the next one of the
+ * top frame, pushing its frame. The partials given as text are compiled
+ * and the ones that can't be compiled are rendered at once.
+ */
+static int render_include(struct mustach_render *mr)
+{
+	struct iwrap *iwrap = &mr->iwrap;
+	struct frame *frame = &mr->top->frame;
+	const char *name = frame->op[-1].name;
+	const struct mustach_compiled *compiled = NULL;
+	struct mustach_compiled *owned = NULL;
+	struct mustach_sbuf sbuf;
+	size_t length;
+	int rc;
+
+	sbuf_reset(&sbuf);
+	if (iwrap->compiled_partial != NULL)
+		rc = iwrap->compiled_partial(iwrap->closure, name, &compiled, &sbuf);
+	else
+		rc = iwrap->partial(iwrap->closure_partial, name, &sbuf);
+	if (rc < 0)
+		return rc;
+	if (compiled == NULL && (length = sbuf_length(&sbuf)) != 0) {
+		rc = mustach_compile(sbuf.value, length, iwrap->flags, &owned);
+		compiled = owned;
+	}
+	if (rc >= 0 && compiled != NULL) {
+		if (compiled->ops != NULL) {
+			rc = render_push(mr, compiled, owned, &sbuf, &frame->pref);
+			if (rc >= 0)
+				return rc;
+		}
+		else {
+			iwrap->suspend = 0;
+			rc = process(compiled->text, compiled->length, iwrap, NULL, &frame->pref);
+			iwrap->suspend = 1;
+		}
+	}
+	mustach_compiled_free(owned);
+	sbuf_release(&sbuf);
+	return rc;
+}
+
+int mustach_render_start(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result)
+{
+	struct mustach_render *mr;
+	struct mustach_sbuf sbuf;
+	int rc;
+
+	*result = NULL;
+	mr = malloc(sizeof *mr);
+	if (mr == NULL) {
+		if (itf->stop)
+			itf->stop(closure, MUSTACH_ERROR_SYSTEM);
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	mr->itf = itf;
+	mr->closure = closure;
+	mr->sinkcb = sinkcb;
+	mr->sinkclosure = sinkclosure;
+	mr->interpret = NULL;
+	mr->top = NULL;
+	mr->frames = 0;
+	mr->pending = NULL;
+	mr->psize = mr->pused = mr->pdone = 0;
+	rc = itf->put || itf->emit ? MUSTACH_ERROR_INVALID_ITF
+		: iwrap_init(&mr->iwrap, itf, closure, compiled->flags, NULL, -1);
+	if (rc == 0) {
+		mr->iwrap.render = mr;
+		mr->iwrap.suspend = 1;
+		mr->iwrap.split = NULL;
+		if (compiled->ops == NULL)
+			mr->interpret = compiled;
+		else {
+			sbuf_reset(&sbuf);
+			rc = render_push(mr, compiled, NULL, &sbuf, NULL);
+		}
+		if (rc == 0 && itf->start)
+			rc = itf->start(closure);
+	}
+	if (rc < 0) {
+		render_end(mr, rc);
+		free(mr);
+		return rc;
+	}
+	mr->status = MUSTACH_AGAIN;
+	*result = mr;
+	return MUSTACH_OK;
+}
+
+int mustach_render_step(struct mustach_render *mr)
+{
+	struct iwrap *iwrap = &mr->iwrap;
+	int rc;
+
+	if (mr->status != MUSTACH_AGAIN)
+		return mr->status;
+	for (;;) {
+		rc = render_drain(mr);
+		if (rc != MUSTACH_OK)
+			break;
+		if (mr->interpret != NULL) {
+			iwrap->suspend = 0;
+			rc = process(mr->interpret->text, mr->interpret->length, iwrap, NULL, NULL);
+			iwrap->suspend = 1;
+			mr->interpret = NULL;
+		}
+		else if (mr->top != NULL) {
+			rc = render(&mr->top->frame, iwrap, NULL);
+			if (rc == RENDER_INCLUDE)
+				rc = render_include(mr);
+			else if (rc == MUSTACH_OK)
+				render_pop(mr);
+		}
+		else if (iwrap->oused != 0)
+			rc = oflush(iwrap);
+		else
+			break;
+		if (rc < 0)
+			break;
+	}
+	if (rc != MUSTACH_AGAIN)
+		render_end(mr, rc);
+	return rc;
+}
+
+void mustach_render_stop(struct mustach_render *mr)
+{
+	if (mr != NULL) {
+		if (mr->status == MUSTACH_AGAIN)
+			render_end(mr, MUSTACH_AGAIN);
+		free(mr->pending);
+		free(mr);
+	}
+}
+
+int mustach_file(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, FILE *file)
+{
+	int rc;
+	struct iwrap iwrap;
+
+	rc = iwrap_init(&iwrap, itf, closure, flags, file, -1);
+	return rc < 0 ? rc : execute(&iwrap, itf, closure, template, length, NULL);
+}
+
+int mustach_fd(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, int fd)
+{
+	return execute_fd(itf, closure, flags, template, length, NULL, fd);
+}
+
 int mustach_mem(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size)
 {
 	int rc;
@@ -10,11 +10,12 @@
 #define _mustach_h_included_
 
 struct mustach_sbuf; /* see below */
+struct mustach_compiled; /* see below */
 
 /**
  * Current version of mustach and its derivates
  */
-#define MUSTACH_VERSION 102
+#define MUSTACH_VERSION 200
 #define MUSTACH_VERSION_MAJOR (MUSTACH_VERSION / 100)
 #define MUSTACH_VERSION_MINOR (MUSTACH_VERSION % 100)
 
@@ -33,6 +34,13 @@ struct mustach_sbuf; /* see below */
  */
 #define MUSTACH_MAX_DELIM_LENGTH 8
 
+/**
+ * Size of the buffer gathering the output of renders before emitting it
+ */
+#ifndef MUSTACH_OUTPUT_BUFFER_SIZE
+#define MUSTACH_OUTPUT_BUFFER_SIZE 4096
+#endif
+
 /**
  * Flags specific to mustach core
  */
@@ -58,6 +66,12 @@ struct mustach_sbuf; /* see below */
 #define MUSTACH_ERROR_PARTIAL_NOT_FOUND -11
 #define MUSTACH_ERROR_UNDEFINED_TAG     -12
 
+/*
+ * Status of a resumable render whose output waits for its sink
+ * (see mustach_render_step)
+ */
+#define MUSTACH_AGAIN                    1
+
 /*
  * You can use definition below for user specific error
  *
@@ -71,6 +85,10 @@ struct mustach_sbuf; /* see below */
 /**
  * mustach_itf - pure abstract mustach - interface for callbacks
  *
+ * The members of the interface are only changed or added with a new
+ * major version (MUSTACH_VERSION_MAJOR and soname of the libraries):
+ * programs built for another major version must be compiled again.
+ *
  * The functions enter and next should return 0 or 1.
  *
  * All other functions should normally return MUSTACH_OK (zero).
@@ -121,6 +139,10 @@ struct mustach_sbuf; /* see below */
  *        then you can use 'FILE*file' pass any kind of pointer (including NULL)
  *        to the function 'fmustach'. An example of a such behaviour is given by
  *        the implementation of 'mustach_json_c_write'.
+ *        The text not escaped is gathered in a buffer of size
+ *        MUSTACH_OUTPUT_BUFFER_SIZE and given by chunks as large as
+ *        possible. When 'emit' is NULL, escaped text is gathered too.
+ *        The buffer is flushed before calling 'put' and at end.
  *
  * @get: If defined (can be NULL), returns in 'sbuf' the value of 'name'.
  *       As an extension (see NO_ALLOW_EMPTY_TAG), the 'name' can be
@@ -134,9 +156,35 @@ struct mustach_sbuf; /* see below */
  *        processing occurered. The status returned by the processing
  *        is passed to the stop.
  *
+ * @split: If defined (can be NULL), called by renders of compiled templates
+ *         just after entering a section, for sharing the rendering of its
+ *         items between threads. Returns the count of threads to use, 0 or 1
+ *         for rendering the items in sequence, and sets in 'items' the count
+ *         of items of the section. The flag 'partials' tells if the content
+ *         of the section includes partials. The texts rendered by the other
+ *         threads are given in order to 'emit' (not escaped) by the calling
+ *         thread. It is not called for sections nested in split sections
+ *         nor when the end of the items could be standalone or not depending
+ *         on their content.
+ *         Ignored if 'clone' or 'unclone' is NULL.
+ *
+ * @clone: Returns a copy of 'closure' to be used by another thread with the
+ *         item 'index' of the section just entered active, 0 being the first
+ *         one, or NULL on error. The copy must write its output to the FILE
+ *         given to 'emit' or 'put', it is a memory file of the core.
+ *
+ * @unclone: Releases the copy 'clone' made by 'clone'.
+ *
+ * @compiled_partial: If defined (can be NULL), replaces 'partial' and returns
+ *           in 'compiled' the compiled template of the partial of 'name',
+ *           rendered without being scanned, or NULL for using the content of
+ *           'sbuf' as for 'partial'. In both cases, 'sbuf' is released after
+ *           the partial is rendered. The partial is rendered with the flags
+ *           of the render, not the ones of its compilation.
+ *
  * The array below summarize status of callbacks:
  *
- *    FULLY OPTIONAL:   start partial
+ *    FULLY OPTIONAL:   start partial split clone unclone compiled_partial
  *    MANDATORY:        enter next leave
  *    COMBINATORIAL:    put emit get
  *
@@ -172,6 +220,10 @@ struct mustach_itf {
 	int (*emit)(void *closure, const char *buffer, size_t size, int escape, FILE *file);
 	int (*get)(void *closure, const char *name, struct mustach_sbuf *sbuf);
 	void (*stop)(void *closure, int status);
+	int (*split)(void *closure, int partials, size_t *items);
+	void *(*clone)(void *closure, size_t index);
+	void (*unclone)(void *clone);
+	int (*compiled_partial)(void *closure, const char *name, const struct mustach_compiled **compiled, struct mustach_sbuf *sbuf);
 };
 
 /**
@@ -232,6 +284,10 @@ extern int mustach_file(const char *template, size_t length, const struct mustac
  * @closure:  the closure to pass to functions called
  * @fd:       the file descriptor number where to write the result
  *
+ * The file descriptor is not closed. When 'itf' has neither 'put' nor
+ * 'emit', the output is written directly to 'fd' using 'writev', waiting
+ * if 'fd' is not blocking. Otherwise, a FILE is opened on a duplicate of 'fd'.
+ *
  * Returns 0 in case of success, -1 with errno set in case of system error
  * a other negative value in case of error.
  */
@@ -252,6 +308,194 @@ extern int mustach_fd(const char *template, size_t length, const struct mustach_
  */
 extern int mustach_mem(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size);
 
+/**
+ * mustach_compiled - Opaque structure of compiled templates
+ *
+ * A compiled template is the result of parsing a template once. It records
+ * the text, the tags and the sections of the template in a way that can be
+ * rendered many times without scanning the template again.
+ *
+ * Compiled templates are never modified by rendering. The same compiled
+ * template can be rendered by many threads at the same time.
+ */
+struct mustach_compiled;
+
+/**
+ * mustach_compile - Compiles the mustache 'template' for 'flags'.
+ *
+ * @template: the template string to compile
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @flags:    the flags to use, they are recorded in the compiled template
+ * @result:   the pointer receiving the compiled template when 0 is returned
+ *
+ * The template is copied so it can be released after compilation.
+ * The syntax errors that rendering the template would report are
+ * reported by the compilation.
+ *
+ * A section whose closing tag is not scanned with the delimiters of its
+ * opening tag (because delimiters changed within it) can't be compiled.
+ * Such template is still accepted but it is interpreted at each rendering.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_compile(const char *template, size_t length, int flags, struct mustach_compiled **result);
+
+/**
+ * mustach_compiled_free - Releases the 'compiled' template.
+ *
+ * @compiled: the compiled template to release, can be NULL
+ */
+extern void mustach_compiled_free(struct mustach_compiled *compiled);
+
+/**
+ * mustach_compiled_flags - Returns the flags given to 'mustach_compile'
+ *
+ * @compiled: the compiled template
+ */
+extern int mustach_compiled_flags(const struct mustach_compiled *compiled);
+
+/**
+ * mustach_compiled_file - Renders the 'compiled' template in 'file' for 'itf' and 'closure'.
+ *
+ * @compiled: the compiled template to instanciate
+ * @itf:      the interface to the functions that mustach calls
+ * @closure:  the closure to pass to functions called
+ * @file:     the file where to write the result
+ *
+ * The flags are the one given at compilation.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_compiled_file(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, FILE *file);
+
+/**
+ * mustach_compiled_fd - Renders the 'compiled' template in 'fd' for 'itf' and 'closure'.
+ *
+ * @compiled: the compiled template to instanciate
+ * @itf:      the interface to the functions that mustach calls
+ * @closure:  the closure to pass to functions called
+ * @fd:       the file descriptor number where to write the result
+ *
+ * The flags are the one given at compilation.
+ * As for 'mustach_fd', the file descriptor is not closed.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_compiled_fd(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, int fd);
+
+/**
+ * mustach_compiled_mem - Renders the 'compiled' template in 'result' for 'itf' and 'closure'.
+ *
+ * @compiled: the compiled template to instanciate
+ * @itf:      the interface to the functions that mustach calls
+ * @closure:  the closure to pass to functions called
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * The flags are the one given at compilation.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_compiled_mem(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, char **result, size_t *size);
+
+/**
+ * mustach_sink_cb_t - Type of the functions receiving the output of
+ * resumable renders without blocking.
+ *
+ * @closure: the closure given to mustach_render_start
+ * @buffer:  the text to write
+ * @size:    the size of the text, never zero
+ * @written: receives the count of bytes written, zero when the sink
+ *           would block
+ *
+ * Returns MUSTACH_OK or a negative error code that ends the render.
+ */
+typedef int mustach_sink_cb_t(void *closure, const char *buffer, size_t size, size_t *written);
+
+/**
+ * mustach_render - Opaque structure of resumable renders
+ *
+ * A resumable render renders a compiled template by steps for event
+ * loops: when its sink can't take more output, the render keeps its
+ * state (sections, partials, indentation, closure of 'itf') and the step
+ * returns MUSTACH_AGAIN. The next step continues where the render stopped.
+ * The output that waits for the sink is at most the buffer of the render
+ * (MUSTACH_OUTPUT_BUFFER_SIZE) and the output of one tag.
+ *
+ * The partials are rendered by steps too. The partials given as text are
+ * compiled at each inclusion, the ones given compiled by 'compiled_partial'
+ * are not. The templates that can't be compiled (see mustach_compile)
+ * are rendered at once. The sections are never split between threads.
+ */
+struct mustach_render;
+
+/**
+ * mustach_render_start - Starts in 'result' the resumable render of the
+ * 'compiled' template for 'itf' and 'closure' to the sink 'sinkcb'.
+ *
+ * @compiled:    the compiled template to instanciate, kept until the end
+ * @itf:         the interface to the functions that mustach calls,
+ *               without 'put' and 'emit' as the output goes to the sink
+ * @closure:     the closure to pass to functions called, kept until the end
+ * @sinkcb:      the function receiving the output
+ * @sinkclosure: the closure to pass to 'sinkcb'
+ * @result:      the pointer receiving the render when 0 is returned
+ *
+ * The flags are the one given at compilation. The function 'start' of
+ * 'itf' is called here. When an error is returned, 'stop' is called
+ * with it, even when 'start' wasn't called.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_render_start(const struct mustach_compiled *compiled, const struct mustach_itf *itf, void *closure, mustach_sink_cb_t *sinkcb, void *sinkclosure, struct mustach_render **result);
+
+/**
+ * mustach_render_step - Continues the 'render' until its end or until
+ * its sink would block.
+ *
+ * @render: the render to continue
+ *
+ * The function 'stop' of the interface is called when the render ends,
+ * with its status. Steps after the end return that status again.
+ *
+ * Returns MUSTACH_AGAIN when the sink would block, 0 when the render
+ * is done, -1 with errno set in case of system error, a other negative
+ * value in case of error.
+ */
+extern int mustach_render_step(struct mustach_render *render);
+
+/**
+ * mustach_render_stop - Releases the 'render', ended or not.
+ *
+ * The function 'stop' of the interface of a render not ended is
+ * called with the status MUSTACH_AGAIN.
+ *
+ * @render: the render to release, can be NULL
+ */
+extern void mustach_render_stop(struct mustach_render *render);
+
+/**
+ * mustach_escape_html - Writes 'buffer' of 'size' with characters < > & "
+ * escaped as HTML entities.
+ *
+ * This is the escaping of the default emitter. Clean runs of text and
+ * entities are gathered so that 'writecb' is called with large chunks.
+ *
+ * @buffer:   the text to escape
+ * @size:     the size of the text
+ * @writecb:  the function that writes the escaped text
+ * @closure:  the closure to pass to 'writecb'
+ *
+ * Returns 0 in case of success or the first negative value returned
+ * by 'writecb'.
+ */
+extern int mustach_escape_html(const char *buffer, size_t size, int (*writecb)(void *closure, const char *buffer, size_t size), void *closure);
+
 /***************************************************************************
 * compatibility with version before 1.0
 */
@@ -0,0 +1,82 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mustach-json-c.h"
+
+static const char template[] = "[{{#list}}{{> part-cache}}{{/list}}]\n";
+static const char dotted[] = "[{{#list}}{{> ./part-cache}}{{/list}}]\n";
+
+static struct json_object *root;
+
+static void put(const char *path, const char *content)
+{
+	FILE *file = fopen(path, "w");
+	fputs(content, file);
+	fclose(file);
+}
+
+static void render_of(const char *title, const char *tmpl)
+{
+	printf("%-32s ", title);
+	fflush(stdout);
+	mustach_json_c_file(tmpl, 0, root, Mustach_With_AllExtensions, stdout);
+}
+
+static void render(const char *title)
+{
+	render_of(title, template);
+}
+
+int main(int ac, char **av)
+{
+	(void)ac;
+	(void)av;
+	root = json_tokener_parse("{\"list\":[1,2,3],\"v\":\"x\"}");
+	unlink("part-cache");
+	unlink("part-cache.mustache");
+
+	mustach_wrap_partial_cache_interval(3600000);
+	render("not found");
+	put("part-cache.mustache", "<{{.}}>");
+	render("negative lookup is cached");
+	mustach_wrap_partial_cache_invalidate("part-cache");
+	render("invalidated, with extension");
+	put("part-cache", "({{.}})");
+	render("cached, other file ignored");
+	mustach_wrap_partial_cache_invalidate(NULL);
+	render("all invalidated, no extension");
+	render_of("other name of the file", dotted);
+	put("part-cache", "{{.}}{{.}}");
+	mustach_wrap_partial_cache_invalidate("part-cache");
+	render("invalidated, changed file");
+	render_of("other name, same file", dotted);
+
+	mustach_wrap_partial_cache_interval(0);
+	put("part-cache", "{{{v}}}{{.}}");
+	render("checked at each use");
+	unlink("part-cache");
+	render("removed, with extension");
+	unlink("part-cache.mustache");
+	render("removed, not found");
+
+	mustach_wrap_partial_cache_interval(-1);
+	put("part-cache", "-{{.}}-");
+	render("not cached");
+	unlink("part-cache");
+
+	mustach_wrap_partial_cache_invalidate(NULL);
+	json_object_put(root);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../mustach-json-c.h"
+
+#define LOOPS 1000
+
+static const char template[] = "{{#list}}{{> item}}{{/list}}{{> missing}}|";
+
+static const char data[] = "{\"list\":[1,2,3],\"item\":\"[{{.}}]\"}";
+
+static struct json_object *root;
+
+struct theme {
+	const char *name;
+	const char *item;
+	struct json_object *root;
+	unsigned calls;
+	int failures;
+};
+
+static int provide(void *closure, const char *name, struct mustach_sbuf *sbuf)
+{
+	struct theme *theme = closure;
+	theme->calls++;
+	if (strcmp(name, "item"))
+		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	sbuf->value = theme->item;
+	return MUSTACH_OK;
+}
+
+static void *run(void *closure)
+{
+	struct theme *theme = closure;
+	struct json_object *root = theme->root;
+	char *expected, *result;
+	size_t esize, size;
+	int i;
+
+	mustach_json_c_mem_partial(template, 0, root, Mustach_With_AllExtensions, provide, theme, &expected, &esize);
+	for (i = 0 ; i < LOOPS ; i++) {
+		if (mustach_json_c_mem_partial(template, 0, root, Mustach_With_AllExtensions, provide, theme, &result, &size) != MUSTACH_OK
+		 || size != esize || memcmp(result, expected, size))
+			theme->failures++;
+		free(result);
+	}
+	free(expected);
+	return NULL;
+}
+
+int main(int ac, char **av)
+{
+	struct theme a = { "a", "<{{.}}>", NULL, 0, 0 }, b = { "b", "({{.}})", NULL, 0, 0 };
+	struct mustach_compiled *compiled;
+	pthread_t ta, tb;
+
+	(void)ac;
+	(void)av;
+	root = json_tokener_parse(data);
+
+	/* plain renders */
+	mustach_json_c_file_partial(template, 0, root, Mustach_With_AllExtensions, provide, &a, stdout);
+	mustach_json_c_file_partial(template, 0, root, Mustach_With_AllExtensions, provide, &b, stdout);
+	mustach_json_c_file_partial(template, 0, root, Mustach_With_AllExtensions, NULL, NULL, stdout);
+	printf("\ncalls a=%u b=%u\n", a.calls, b.calls);
+
+	/* compiled renders */
+	mustach_compile(template, 0, Mustach_With_AllExtensions, &compiled);
+	mustach_json_c_compiled_file_partial(compiled, root, provide, &b, stdout);
+	mustach_json_c_compiled_file_partial(compiled, root, provide, &a, stdout);
+	mustach_json_c_compiled_file(compiled, root, stdout);
+	mustach_compiled_free(compiled);
+	printf("\n");
+
+	/* concurrent renders with distinct providers */
+	a.calls = b.calls = 0;
+	a.root = json_tokener_parse(data);
+	b.root = json_tokener_parse(data);
+	pthread_create(&ta, NULL, run, &a);
+	pthread_create(&tb, NULL, run, &b);
+	pthread_join(ta, NULL);
+	pthread_join(tb, NULL);
+	printf("concurrent a: calls=%u failures=%d\n", a.calls, a.failures);
+	printf("concurrent b: calls=%u failures=%d\n", b.calls, b.failures);
+	json_object_put(a.root);
+	json_object_put(b.root);
+
+	json_object_put(root);
+	return 0;
+}
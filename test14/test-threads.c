@@ -0,0 +1,86 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../mustach-json-c.h"
+
+#define THREADS 32
+#define LOOPS   200
+
+static const char template[] =
+	"name={{name}} port={{port}} ratio={{ratio}} on={{enabled}} none={{none}}\n"
+	"servers={{servers}}\n"
+	"limits={{limits}}\n"
+	"{{#servers}}- {{host}}:{{port}} {{.}}\n{{/servers}}"
+	"{{#limits.*}}{{*}}={{.}}\n{{/limits.*}}"
+	"{{#port=8080}}port ok\n{{/port=8080}}"
+	"{{#limits=}}never\n{{/limits=}}"
+	"{{#enabled=true}}enabled ok\n{{/enabled=true}}";
+
+static const char data[] =
+	"{\"name\":\"conf \\\"main\\\"\",\"port\":8080,\"ratio\":0.25,\"enabled\":true,\"none\":null,"
+	"\"servers\":[{\"host\":\"alpha\",\"port\":1},{\"host\":\"beta/2\",\"port\":2,\"tags\":[\"a\\tb\",1.5e3,false]}],"
+	"\"limits\":{\"cpu\":4,\"mem\":\"2G\",\"ratio\":-1.0}}";
+
+static struct json_object *root;
+static const char *expected;
+static size_t esize;
+
+static void *run(void *closure)
+{
+	int *failures = closure;
+	char *result;
+	size_t size;
+	int i;
+
+	for (i = 0 ; i < LOOPS ; i++) {
+		if (mustach_json_c_mem(template, 0, root, Mustach_With_AllExtensions, &result, &size) != MUSTACH_OK
+		 || size != esize || memcmp(result, expected, size))
+			(*failures)++;
+		free(result);
+	}
+	return NULL;
+}
+
+int main(int ac, char **av)
+{
+	pthread_t threads[THREADS];
+	int failures[THREADS];
+	char *result;
+	int i, total;
+
+	(void)ac;
+	(void)av;
+	root = json_tokener_parse(data);
+
+	/* reference render */
+	mustach_json_c_mem(template, 0, root, Mustach_With_AllExtensions, &result, &esize);
+	expected = result;
+	fwrite(expected, 1, esize, stdout);
+
+	/* concurrent renders of the same tree */
+	for (i = 0 ; i < THREADS ; i++) {
+		failures[i] = 0;
+		pthread_create(&threads[i], NULL, run, &failures[i]);
+	}
+	for (total = i = 0 ; i < THREADS ; i++) {
+		pthread_join(threads[i], NULL);
+		total += failures[i];
+	}
+	printf("threads=%d loops=%d failures=%d\n", THREADS, LOOPS, total);
+
+	free(result);
+	json_object_put(root);
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../mustach-json-c.h"
+
+#define BIG     (4 << 20)
+#define PART    (2 << 20)
+
+static const char pattern[] = "0123456789 <abc> & \"def\" ";
+#define PATLEN  (sizeof pattern - 1)
+
+struct counter {
+	size_t size;
+	unsigned calls;
+};
+
+static int count(void *closure, const char *buffer, size_t size)
+{
+	struct counter *counter = closure;
+	(void)buffer;
+	counter->size += size;
+	counter->calls++;
+	return MUSTACH_OK;
+}
+
+/* appends to 'json' the json string of 'length' bytes of the pattern */
+static char *put_string(char *json, size_t length)
+{
+	size_t i;
+	char c;
+
+	*json++ = '"';
+	for (i = 0 ; i < length ; i++) {
+		c = pattern[i % PATLEN];
+		if (c == '"')
+			*json++ = '\\';
+		*json++ = c;
+	}
+	*json++ = '"';
+	return json;
+}
+
+/* checks that 'result' of 'size' is 'times' the pattern of 'length', escaped or not */
+static int check(const char *result, size_t size, size_t length, int times, int escaped)
+{
+	const char *entity;
+	size_t i, n;
+	char c;
+	int t;
+
+	for (t = 0 ; t < times ; t++)
+		for (i = 0 ; i < length ; i++) {
+			c = pattern[i % PATLEN];
+			entity = !escaped ? NULL
+				: c == '<' ? "&lt;"
+				: c == '>' ? "&gt;"
+				: c == '&' ? "&amp;"
+				: c == '"' ? "&quot;"
+				: NULL;
+			if (entity == NULL) {
+				if (size < 1 || *result != c)
+					return 0;
+				result++;
+				size--;
+			}
+			else {
+				n = strlen(entity);
+				if (size < n || memcmp(result, entity, n))
+					return 0;
+				result += n;
+				size -= n;
+			}
+		}
+	return size == 0;
+}
+
+static void render(const char *title, const char *template, struct json_object *root, size_t length, int times, int escaped)
+{
+	struct counter counter = { 0, 0 };
+	char *result;
+	size_t size;
+	int rc;
+
+	rc = mustach_json_c_mem(template, 0, root, Mustach_With_AllExtensions, &result, &size);
+	printf("%s: rc=%d size=%zu %s\n", title, rc, size,
+		rc == MUSTACH_OK && check(result, size, length, times, escaped) ? "ok" : "BAD");
+	if (rc == MUSTACH_OK)
+		free(result);
+	rc = mustach_json_c_write(template, 0, root, Mustach_With_AllExtensions, count, &counter);
+	printf("%s: rc=%d write=%zu %s\n", title, rc, counter.size, counter.size == size ? "ok" : "BAD");
+}
+
+int main(int ac, char **av)
+{
+	struct json_object *root;
+	char *json, *end, *result;
+	size_t size;
+	int rc;
+
+	(void)ac;
+	(void)av;
+
+	/* build the data */
+	json = malloc(2 * BIG + 2 * PART + 1000);
+	end = json + sprintf(json, "{\"big\":");
+	end = put_string(end, BIG);
+	end += sprintf(end, ",\"part\":");
+	end = put_string(end, PART);
+	end += sprintf(end, ",\"list\":[1,2,3],\"nul\":\"a\\u0000b\\u0000c\"}");
+	*end = 0;
+	root = json_tokener_parse(json);
+	free(json);
+
+	/* render them */
+	render("raw big", "{{{big}}}", root, BIG, 1, 0);
+	render("escaped big", "{{big}}", root, BIG, 1, 1);
+	render("raw big list", "{{#list}}{{&big}}{{/list}}", root, BIG, 3, 0);
+	render("partial", "{{>part}}", root, PART, 1, 0);
+
+	/* embedded nul */
+	rc = mustach_json_c_mem("[{{nul}}]", 0, root, Mustach_With_AllExtensions, &result, &size);
+	printf("nul: rc=%d size=%zu %s\n", rc, size,
+		rc == MUSTACH_OK && size == 7 && !memcmp(result, "[a\0b\0c]", 7) ? "ok" : "BAD");
+	if (rc == MUSTACH_OK)
+		free(result);
+
+	json_object_put(root);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../mustach-flat.h"
+
+static const char data[] =
+	"{\n"
+	"  \"name\": \"flat <json>\",\n"
+	"  \"numbers\": [ 0, -12, 3.50, 1e3, 9007199254740993, 18446744073709551616 ],\n"
+	"  \"unicode\": \"\\u00e9\\u4e2d\\ud83d\\ude00 \\\"q\\\" \\\\ \\/\",\n"
+	"  \"nul\": \"a\\u0000b\",\n"
+	"  \"twice\": 1, \"twice\": 2, \"a/b\": \"slash\",\n"
+	"  \"empty\": { }, \"none\": [ ], \"nothing\": null,\n"
+	"  \"big\": { \"k0\": 0, \"k1\": 1, \"k2\": 2, \"k3\": 3, \"k4\": 4, \"k5\": 5, \"k6\": 6,\n"
+	"           \"k7\": 7, \"k8\": 8, \"k9\": 9, \"k10\": 10, \"k11\": 11, \"k12\": 12 },\n"
+	"  \"list\": [ { \"x\": 1, \"y\": [true, false] }, { \"x\": 2, \"z\": {\"a/b\": \"\\t\"} } ]\n"
+	"}\n";
+
+static const char template[] =
+	"name={{name}}\n"
+	"numbers={{numbers}}\n"
+	"{{#numbers}}- {{.}}\n{{/numbers}}"
+	"unicode={{{unicode}}}\n"
+	"twice={{twice}}\n"
+	"empty={{empty}} none={{none}} nothing=[{{nothing}}]\n"
+	"{{#empty}}empty object is true\n{{/empty}}"
+	"{{^none}}empty array is false\n{{/none}}"
+	"big: {{big.k0}} {{big.k7}} {{big.k12}} [{{big.k13}}]\n"
+	"{{#big.*}}{{*}}={{.}} {{/big.*}}\n"
+	"{{#list}}x={{x}} y={{y}} z={{&z}} name={{name}}\n{{/list}}"
+	"{{#big.k3=3.0}}3 equals 3.0\n{{/big.k3=3.0}}"
+	"{{#big.k12>9}}k12 is greater than 9\n{{/big.k12>9}}"
+	"pointers={{:/big/k5}} {{:/a~1b}}\n";
+
+static const char *invalids[] = {
+	"", "[1,]", "{\"a\" 1}", "01", "\"abc", "[1 2]", "{\"a\":1} x", "\"\\ud800\"", NULL
+};
+
+int main(int ac, char **av)
+{
+	struct mustach_flat *flat;
+	char *result;
+	size_t size, pos;
+	int i, rc;
+
+	(void)ac;
+	(void)av;
+
+	/* render */
+	rc = mustach_flat_parse(data, 0, &flat, &pos);
+	if (rc < 0) {
+		printf("parse error %d at %zu\n", errno, pos);
+		return 1;
+	}
+	mustach_flat_file(template, 0, flat, Mustach_With_AllExtensions, stdout);
+
+	/* embedded nul */
+	rc = mustach_flat_mem("[{{nul}}]", 0, flat, Mustach_With_AllExtensions, &result, &size);
+	printf("nul: rc=%d size=%zu %s\n", rc, size, rc == 0 && size == 5 && !memcmp(result, "[a\0b]", 5) ? "ok" : "BAD");
+	if (rc == 0)
+		free(result);
+
+	/* packed file */
+	rc = mustach_flat_mem(template, 0, flat, Mustach_With_AllExtensions, &result, &size);
+	if (rc == 0 && mustach_flat_save(flat, "packed.mjb") == 0) {
+		mustach_flat_free(flat);
+		rc = mustach_flat_map("packed.mjb", &flat);
+		printf("map: rc=%d\n", rc);
+		if (rc == 0) {
+			char *presult;
+			size_t psize;
+			rc = mustach_flat_mem(template, 0, flat, Mustach_With_AllExtensions, &presult, &psize);
+			printf("packed: rc=%d %s\n", rc, rc == 0 && psize == size && !memcmp(presult, result, size) ? "same" : "DIFFERENT");
+			if (rc == 0)
+				free(presult);
+		}
+	}
+	else
+		printf("save: failed\n");
+	free(result);
+	mustach_flat_free(flat);
+	rc = mustach_flat_map("test-flat.c", &flat);
+	printf("map not packed: rc=%d %s\n", rc, rc < 0 && errno == EINVAL ? "EINVAL" : "??");
+	if (rc == 0)
+		mustach_flat_free(flat);
+
+	/* syntax errors */
+	for (i = 0 ; invalids[i] != NULL ; i++) {
+		pos = 0;
+		rc = mustach_flat_parse(invalids[i], strlen(invalids[i]) + !invalids[i][0], &flat, &pos);
+		printf("invalid '%s': rc=%d %s at %zu\n", invalids[i], rc, rc < 0 && errno == EINVAL ? "EINVAL" : "??", pos);
+		if (rc == 0)
+			mustach_flat_free(flat);
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../mustach-flat.h"
+
+static const char data[] =
+	"{\n"
+	"  \"title\": \"export <1>\",\n"
+	"  \"count\": 3,\n"
+	"  \"records\": [\n"
+	"    { \"id\": 1, \"name\": \"one\", \"tags\": [\"a\", \"b\"] },\n"
+	"    { \"id\": 2, \"name\": \"two\", \"tags\": [] },\n"
+	"    { \"id\": 3, \"title\": \"own title\", \"tags\": [\"c\"] }\n"
+	"  ],\n"
+	"  \"empty\": [],\n"
+	"  \"skipped\": [ 1, 2, 3 ],\n"
+	"  \"after\": { \"done\": true }\n"
+	"}\n";
+
+static const char template[] =
+	"{{title}} ({{count}} records)\n"
+	"{{#records}}"
+	"- {{id}} {{name}} {{title}} [{{#tags}}{{.}}{{/tags}}] after=[{{after.done}}]\n"
+	"{{/records}}"
+	"again [{{#records}}{{id}}{{/records}}]\n"
+	"{{^empty}}no empty\n{{/empty}}"
+	"{{^skipped}}never{{/skipped}}skipped=[{{skipped}}]\n"
+	"{{#after}}done={{done}}{{/after}}\n";
+
+static const char array[] = "[ {\"x\":1}, {\"x\":[2]}, \"three\", 4.0 ]";
+
+static const char array_template[] = "{{#.}}<{{x}}{{^x}}{{.}}{{/x}}>{{/.}} then {{.}}\n";
+
+static const char *invalids[] = {
+	"{\"a\":[1,2", "{\"a\":[1,]}", "{\"a\" 1}", "{1:2}", "{\"a\":1}}", "{\"a\":1", NULL
+};
+
+/* makes a document streamed from 'text' through a pipe */
+static int stream(const char *text, struct mustach_flat **result, int *fd)
+{
+	int fds[2];
+	size_t length = strlen(text);
+
+	if (pipe(fds) < 0 || write(fds[1], text, length) != (ssize_t)length)
+		return -1;
+	close(fds[1]);
+	*fd = fds[0];
+	return mustach_flat_stream(fds[0], result);
+}
+
+int main(int ac, char **av)
+{
+	struct mustach_flat *flat;
+	char *result;
+	size_t size;
+	int i, rc, fd;
+
+	(void)ac;
+	(void)av;
+
+	/* object */
+	if (stream(data, &flat, &fd) < 0) {
+		printf("stream error %d\n", errno);
+		return 1;
+	}
+	rc = mustach_flat_file(template, 0, flat, Mustach_With_AllExtensions, stdout);
+	printf("rc=%d\n", rc);
+	mustach_flat_free(flat);
+	close(fd);
+
+	/* array */
+	if (stream(array, &flat, &fd) < 0) {
+		printf("stream error %d\n", errno);
+		return 1;
+	}
+	rc = mustach_flat_file(array_template, 0, flat, Mustach_With_AllExtensions, stdout);
+	printf("rc=%d\n", rc);
+	mustach_flat_free(flat);
+	close(fd);
+
+	/* syntax errors */
+	for (i = 0 ; invalids[i] != NULL ; i++) {
+		if (stream(invalids[i], &flat, &fd) < 0)
+			printf("invalid '%s': stream error %d\n", invalids[i], errno);
+		else {
+			rc = mustach_flat_mem("[{{#a}}{{.}}{{/a}}][{{z}}]", 0, flat, Mustach_With_AllExtensions, &result, &size);
+			printf("invalid '%s': rc=%d %s\n", invalids[i], rc, rc == MUSTACH_ERROR_SYSTEM && errno == EINVAL ? "EINVAL" : "??");
+			if (rc == 0)
+				free(result);
+			mustach_flat_free(flat);
+		}
+		close(fd);
+	}
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../mustach-flat.h"
+
+#define FILENAME "lazy.json"
+
+static const char data[] =
+	"{\n"
+	"  \"title\": \"export <1>\",\n"
+	"  \"count\": 3,\n"
+	"  \"records\": [\n"
+	"    { \"id\": 1, \"name\": \"one\", \"tags\": [\"a\", \"b\"], \"id\": 11 },\n"
+	"    { \"id\": 2, \"name\": \"t\\u00e9o\", \"tags\": [] },\n"
+	"    { \"id\": 3, \"title\": \"own title\", \"tags\": [\"c\", {\"d\": [\"}\"]}] }\n"
+	"  ],\n"
+	"  \"empty\": [],\n"
+	"  \"deep\": { \"a\": { \"b\": { \"c\": [ 1.50, -2, null, true ] } } },\n"
+	"  \"after\": { \"done\": true }\n"
+	"}\n";
+
+static const char bad[] = "{ \"title\": \"bad\", \"bad\": { \"k\" 1 } }";
+
+static const char template[] =
+	"{{title}} ({{count}} records)\n"
+	"{{#records}}"
+	"- {{id}} {{name}} {{title}} [{{#tags}}{{.}}{{/tags}}] after=[{{after.done}}]\n"
+	"{{/records}}"
+	"{{^empty}}no empty\n{{/empty}}"
+	"deep={{deep}} c={{deep.a.b.c}} {{#deep.a.b.c}}<{{.}}>{{/deep.a.b.c}}\n"
+	"{{#deep.*}}{{*}}={{b.c}}{{/deep.*}}\n"
+	"{{#after}}done={{done}}{{/after}}\n";
+
+static const char *invalids[] = {
+	"", "  \n", "{\"a\":[1,2}", "{\"a\":\"}", "{\"a\":1}}", "[[[", NULL
+};
+
+/* writes the file FILENAME with 'text' */
+static int put(const char *text)
+{
+	FILE *file = fopen(FILENAME, "w");
+
+	if (file == NULL)
+		return -1;
+	fputs(text, file);
+	return fclose(file);
+}
+
+/* renders 'tmpl' for 'text' parsed and lazy, prints the lazy result */
+static void render(const char *name, const char *text, const char *tmpl, int print)
+{
+	struct mustach_flat *parsed, *lazy;
+	char *r1, *r2;
+	size_t s1, s2;
+	int rc1, rc2;
+
+	if (put(text) < 0 || mustach_flat_lazy(FILENAME, &lazy) < 0) {
+		printf("%s: lazy error %d\n", name, errno);
+		return;
+	}
+	if (mustach_flat_parse(text, 0, &parsed, NULL) < 0) {
+		rc2 = mustach_flat_mem(tmpl, 0, lazy, Mustach_With_AllExtensions, &r2, &s2);
+		printf("%s: not parsed, lazy rc=%d %s\n", name, rc2, rc2 == MUSTACH_ERROR_SYSTEM && errno == EINVAL ? "EINVAL" : "");
+		if (rc2 == 0) {
+			printf("%.*s", (int)s2, r2);
+			free(r2);
+		}
+		mustach_flat_free(lazy);
+		return;
+	}
+	rc1 = mustach_flat_mem(tmpl, 0, parsed, Mustach_With_AllExtensions, &r1, &s1);
+	rc2 = mustach_flat_mem(tmpl, 0, lazy, Mustach_With_AllExtensions, &r2, &s2);
+	printf("%s: rc=%d %s (%zu bytes)\n", name, rc2,
+		rc1 == rc2 && (rc1 != 0 || (s1 == s2 && !memcmp(r1, r2, s1))) ? "same" : "DIFFERENT", s2);
+	if (rc2 == 0 && print)
+		printf("%.*s", (int)s2, r2);
+	if (rc1 == 0)
+		free(r1);
+	if (rc2 == 0)
+		free(r2);
+	rc2 = mustach_flat_save(lazy, FILENAME);
+	printf("%s: save rc=%d %s\n", name, rc2, rc2 < 0 && errno == EINVAL ? "EINVAL" : "");
+	mustach_flat_free(parsed);
+	mustach_flat_free(lazy);
+}
+
+int main(int ac, char **av)
+{
+	struct mustach_flat *flat;
+	char *big, *p;
+	int i;
+
+	(void)ac;
+	(void)av;
+
+	render("data", data, template, 1);
+
+	/* syntax errors are found in the values used */
+	render("unused", bad, "{{title}}\n", 1);
+	render("bad", bad, "{{title}} {{bad.k}}\n", 0);
+
+	/* scalar root */
+	render("scalar", " 42 ", "{{.}}\n", 1);
+
+	/* big arrays and objects are indexed */
+	big = p = malloc(1000000);
+	p += sprintf(p, "{\"first\":[");
+	for (i = 0 ; i < 3000 ; i++)
+		p += sprintf(p, "%s{\"i\":%d,\"s\":\"[{\\\"\",\"o\":{\"a\":[%d]}}", i ? "," : "", i, -i);
+	p += sprintf(p, "],\"last\":{\"big\":{");
+	for (i = 0 ; i < 3000 ; i++)
+		p += sprintf(p, "%s\"k%d\":%d", i ? "," : "", i, i);
+	sprintf(p, "}},\"end\":\"fin\"}");
+	render("big", big, "{{end}} {{last.big.k2999}} {{#first}}{{i}}{{s}}{{o.a}}{{/first}}\n", 0);
+	render("big end", big, "{{end}} {{last.big.k1234}}\n", 1);
+	free(big);
+
+	/* invalid files */
+	for (i = 0 ; invalids[i] != NULL ; i++) {
+		if (put(invalids[i]) < 0 || mustach_flat_lazy(FILENAME, &flat) < 0)
+			printf("invalid '%s': lazy error %s\n", invalids[i], errno == EINVAL ? "EINVAL" : "??");
+		else {
+			printf("invalid '%s': accepted\n", invalids[i]);
+			mustach_flat_free(flat);
+		}
+	}
+	unlink(FILENAME);
+	return 0;
+}
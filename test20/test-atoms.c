@@ -0,0 +1,219 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../mustach-wrap.h"
+
+/* a tree of named values, the children end with a NULL name */
+struct node {
+	const char *name;
+	const char *value;
+	const struct node *children;
+};
+
+static const struct node dnode[] = {
+	{ "e", "deep", NULL },
+	{ NULL, NULL, NULL }
+};
+
+static const struct node bnode[] = {
+	{ "c", "inner c", NULL },
+	{ "d", NULL, dnode },
+	{ "a.b", "dotted", NULL },
+	{ NULL, NULL, NULL }
+};
+
+static const struct node rootnode[] = {
+	{ "a", "outer a", NULL },
+	{ "b", NULL, bnode },
+	{ "c", "outer c", NULL },
+	{ NULL, NULL, NULL }
+};
+
+static const struct node root = { "", NULL, rootnode };
+
+static const char template[] =
+	"a={{a}} b.c={{b.c}} b.d.e={{b.d.e}} x=[{{x}}] b.x=[{{b.x}}] a\\.b=[{{b.a\\.b}}]\n"
+	"{{#b}}in b: c={{c}} a={{a}} d.e={{d.e}}{{#d}} in d: e={{e}} c={{c}} a={{a}}{{/d}}{{/b}}\n"
+	"{{#x}}never{{/x}}{{^x}}no x{{/x}} {{#b.d}}e={{e}}{{/b.d}}\n";
+
+struct expl {
+	const struct node *stack[8];
+	int depth;
+	const struct node *selection;
+	int atoms;
+	int names;
+	int bad;
+};
+
+static const struct node *child(const struct node *node, const char *name)
+{
+	const struct node *n;
+
+	if (node != NULL && node->children != NULL)
+		for (n = node->children ; n->name != NULL ; n++)
+			if (!strcmp(n->name, name))
+				return n;
+	return NULL;
+}
+
+static int start(void *closure)
+{
+	struct expl *e = closure;
+	e->depth = 0;
+	e->stack[0] = &root;
+	e->selection = NULL;
+	return MUSTACH_OK;
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	const struct node *n = NULL;
+	int i;
+
+	if (name == NULL)
+		n = e->stack[e->depth];
+	else {
+		e->names++;
+		for (i = e->depth ; i >= 0 && n == NULL ; i--)
+			n = child(e->stack[i], name);
+	}
+	e->selection = n;
+	return n != NULL;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	const struct node *n = child(e->selection, name);
+
+	e->names++;
+	if (n == NULL)
+		return 0;
+	e->selection = n;
+	return 1;
+}
+
+/* checks the atom and counts it */
+static void check(struct expl *e, const struct mustach_wrap_atom *atom)
+{
+	struct mustach_wrap_atom ref;
+
+	mustach_wrap_make_atom(&ref, atom->name);
+	if (ref.length != atom->length || ref.hash != atom->hash) {
+		printf("bad atom %s length %zu hash %u\n", atom->name, atom->length, (unsigned)atom->hash);
+		e->bad++;
+	}
+	e->atoms++;
+	e->names--;
+}
+
+static int sel_atom(void *closure, const struct mustach_wrap_atom *atom)
+{
+	check(closure, atom);
+	return sel(closure, atom->name);
+}
+
+static int subsel_atom(void *closure, const struct mustach_wrap_atom *atom)
+{
+	check(closure, atom);
+	return subsel(closure, atom->name);
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct expl *e = closure;
+
+	if (objiter || e->selection == NULL || e->selection->children == NULL)
+		return 0;
+	e->stack[++e->depth] = e->selection;
+	return 1;
+}
+
+static int next(void *closure)
+{
+	(void)closure;
+	return 0;
+}
+
+static int leave(void *closure)
+{
+	struct expl *e = closure;
+	e->depth--;
+	return MUSTACH_OK;
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct expl *e = closure;
+
+	if (key)
+		sbuf->value = e->selection ? e->selection->name : "";
+	else
+		sbuf->value = e->selection && e->selection->value ? e->selection->value : "";
+	return 1;
+}
+
+static const struct mustach_wrap_itf names_itf = {
+	.start = start,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get
+};
+
+static const struct mustach_wrap_itf atoms_itf = {
+	.start = start,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get,
+	.sel_atom = sel_atom,
+	.subsel_atom = subsel_atom
+};
+
+static void render(const char *title, const struct mustach_wrap_itf *itf)
+{
+	struct expl e;
+	char *result;
+	size_t size;
+	int rc;
+
+	memset(&e, 0, sizeof e);
+	rc = mustach_wrap_mem(template, 0, itf, &e, Mustach_With_AllExtensions, &result, &size);
+	printf("%s: rc=%d names=%d atoms=%d bad=%d\n", title, rc, e.names, e.atoms, e.bad);
+	if (rc == MUSTACH_OK) {
+		fwrite(result, 1, size, stdout);
+		free(result);
+	}
+}
+
+int main(int ac, char **av)
+{
+	struct mustach_wrap_atom atom;
+
+	(void)ac;
+	(void)av;
+	mustach_wrap_make_atom(&atom, "");
+	printf("atom of empty: length %zu hash %u\n", atom.length, (unsigned)atom.hash);
+	mustach_wrap_make_atom(&atom, "key");
+	printf("atom of key: length %zu hash %u\n", atom.length, (unsigned)atom.hash);
+	render("names", &names_itf);
+	render("atoms", &atoms_itf);
+	return 0;
+}
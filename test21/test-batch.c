@@ -0,0 +1,174 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mustach-json-c.h"
+
+#define COUNT   200
+#define THREADS 4
+
+static const char template[] =
+	"{{id}}: {{name}}{{#tags}} [{{.}}]{{/tags}}"
+	"{{#limits.*}} {{*}}={{.}}{{/limits.*}}"
+	"{{#big}} {{big}}{{/big}}\n";
+
+static struct json_object *roots[COUNT];
+static char *expected[COUNT];
+static size_t esizes[COUNT];
+static struct mustach_batch_output outputs[COUNT];
+
+/* makes the root of index i, some have big values, some have no name */
+static struct json_object *make(int i)
+{
+	char *data, *big;
+	size_t blen;
+	struct json_object *o;
+
+	blen = i % 37 == 5 ? 9000 + 100 * (size_t)i : 0;
+	big = malloc(blen + 1);
+	memset(big, 'a' + i % 26, blen);
+	big[blen] = 0;
+	if (asprintf(&data, "{\"id\":%d,%s\"tags\":[%d,\"t%d\",%s],\"limits\":{\"cpu\":%d,\"mem\":\"%dM\"}%s%s%s}",
+			i, i % 50 == 7 ? "" : "\"name\":\"n<&>\",", i, i * 3, i % 2 ? "true" : "null",
+			i % 8, i * 16, blen ? ",\"big\":\"" : "", big, blen ? "\"" : "") < 0)
+		exit(1);
+	o = json_tokener_parse(data);
+	free(data);
+	free(big);
+	return o;
+}
+
+/* compares the outputs in memory with the expected results */
+static int check_mem(void)
+{
+	int i, diffs = 0;
+
+	for (i = 0 ; i < COUNT ; i++) {
+		if (outputs[i].status != MUSTACH_OK
+		 || outputs[i].size != esizes[i]
+		 || memcmp(outputs[i].result, expected[i], esizes[i])
+		 || outputs[i].result[esizes[i]] != 0)
+			diffs++;
+		free(outputs[i].result);
+	}
+	return diffs;
+}
+
+/* compares the content of 'file' with the concatenation of the expected results */
+static int check_file(FILE *file)
+{
+	int i, diffs = 0;
+	char *buffer;
+
+	fflush(file);
+	rewind(file);
+	for (i = 0 ; i < COUNT ; i++) {
+		buffer = malloc(esizes[i]);
+		if (fread(buffer, 1, esizes[i], file) != esizes[i] || memcmp(buffer, expected[i], esizes[i]))
+			diffs++;
+		free(buffer);
+	}
+	if (fgetc(file) != EOF)
+		diffs++;
+	fclose(file);
+	return diffs;
+}
+
+/* sets the outputs to 'kind', 'file' and 'fd' */
+static void set_outputs(enum mustach_batch_kind kind, FILE *file, int fd)
+{
+	int i;
+
+	for (i = 0 ; i < COUNT ; i++) {
+		outputs[i].kind = kind;
+		outputs[i].file = file;
+		outputs[i].fd = fd;
+	}
+}
+
+int main(int ac, char **av)
+{
+	struct mustach_compiled *compiled, *strict;
+	FILE *file;
+	int i, rc, threads, failed, first;
+
+	(void)ac;
+	(void)av;
+	for (i = 0 ; i < COUNT ; i++)
+		roots[i] = make(i);
+	mustach_compile(template, 0, Mustach_With_AllExtensions, &compiled);
+	mustach_compile(template, 0, Mustach_With_AllExtensions | Mustach_With_ErrorUndefined, &strict);
+
+	/* reference renders */
+	for (i = 0 ; i < COUNT ; i++)
+		mustach_json_c_compiled_mem(compiled, roots[i], &expected[i], &esizes[i]);
+	fwrite(expected[0], 1, esizes[0], stdout);
+	fwrite(expected[1], 1, esizes[1], stdout);
+
+	/* results in memory */
+	for (threads = 0 ; threads < 3 * COUNT ; threads = threads ? threads * 3 : 1) {
+		set_outputs(Mustach_Batch_Memory, NULL, -1);
+		rc = mustach_json_c_batch(compiled, roots, COUNT, threads, outputs);
+		printf("mem threads=%d status=%d differences=%d\n", threads, rc, check_mem());
+	}
+
+	/* results in a shared file */
+	file = tmpfile();
+	set_outputs(Mustach_Batch_File, file, -1);
+	rc = mustach_json_c_batch(compiled, roots, COUNT, THREADS, outputs);
+	printf("file status=%d differences=%d\n", rc, check_file(file));
+
+	/* results in a shared file descriptor */
+	file = tmpfile();
+	set_outputs(Mustach_Batch_Fd, NULL, fileno(file));
+	rc = mustach_json_c_batch(compiled, roots, COUNT, THREADS, outputs);
+	printf("fd status=%d differences=%d\n", rc, check_file(file));
+
+	/* renders failing because of undefined names */
+	set_outputs(Mustach_Batch_Memory, NULL, -1);
+	rc = mustach_json_c_batch(strict, roots, COUNT, THREADS, outputs);
+	for (failed = 0, first = -1, i = 0 ; i < COUNT ; i++) {
+		if (outputs[i].status == MUSTACH_OK)
+			free(outputs[i].result);
+		else {
+			if (first < 0)
+				first = i;
+			if (outputs[i].result == NULL)
+				failed++;
+		}
+	}
+	printf("strict status=%d failed=%d first=%d\n", rc, failed, first);
+
+	/* outputs initialised with zeros are in memory */
+	memset(outputs, 0, sizeof outputs);
+	rc = mustach_json_c_batch(compiled, roots, COUNT, THREADS, outputs);
+	printf("zeroed status=%d differences=%d\n", rc, check_mem());
+
+	/* outputs to files need a file */
+	set_outputs(Mustach_Batch_File, NULL, -1);
+	rc = mustach_json_c_batch(compiled, roots, COUNT, THREADS, outputs);
+	printf("no file status=%d\n", rc);
+
+	/* empty batch */
+	rc = mustach_json_c_batch(compiled, roots, 0, THREADS, outputs);
+	printf("empty status=%d\n", rc);
+
+	for (i = 0 ; i < COUNT ; i++) {
+		free(expected[i]);
+		json_object_put(roots[i]);
+	}
+	mustach_compiled_free(compiled);
+	mustach_compiled_free(strict);
+	return 0;
+}
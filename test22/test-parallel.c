@@ -0,0 +1,273 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mustach-json-c.h"
+
+#define ROWS 3000
+
+/*
+ * A minimal interface of the core iterating the numbers of 'rows'
+ * and recording the copies made for the other threads.
+ */
+struct numbers {
+	int depth;
+	size_t index, count;
+	size_t failing;
+	char text[32];
+};
+
+static size_t clones[16];
+static int nclones;
+
+static int n_enter(void *closure, const char *name)
+{
+	struct numbers *n = closure;
+
+	if (n->depth == 0 && !strcmp(name, "rows")) {
+		n->depth = 1;
+		n->index = 0;
+		return 1;
+	}
+	/* nested section entered for odd numbers */
+	return n->depth == 1 && !strcmp(name, "odd") && (n->index & 1) ? (n->depth = 2) : 0;
+}
+
+static int n_next(void *closure)
+{
+	struct numbers *n = closure;
+	return n->depth == 1 && ++n->index < n->count;
+}
+
+static int n_leave(void *closure)
+{
+	struct numbers *n = closure;
+	n->depth--;
+	return MUSTACH_OK;
+}
+
+static int n_get(void *closure, const char *name, struct mustach_sbuf *sbuf)
+{
+	struct numbers *n = closure;
+
+	(void)name;
+	if (n->depth > 0 && n->index == n->failing)
+		return MUSTACH_ERROR_USER(1);
+	sbuf->length = (size_t)snprintf(n->text, sizeof n->text, "%zu", n->depth > 0 ? n->index : n->count);
+	sbuf->value = n->text;
+	return MUSTACH_OK;
+}
+
+static int n_split(void *closure, int partials, size_t *items)
+{
+	struct numbers *n = closure;
+
+	(void)partials;
+	if (n->depth != 1)
+		return 0;
+	*items = n->count;
+	return 3;
+}
+
+static void *n_clone(void *closure, size_t index)
+{
+	struct numbers *n = closure, *c = malloc(sizeof *c);
+
+	if (c != NULL) {
+		*c = *n;
+		c->index = index;
+		clones[nclones++] = index;
+	}
+	return c;
+}
+
+static void n_unclone(void *clone)
+{
+	free(clone);
+}
+
+static const struct mustach_itf numbers_itf = {
+	.enter = n_enter,
+	.next = n_next,
+	.leave = n_leave,
+	.get = n_get,
+	.split = n_split,
+	.clone = n_clone,
+	.unclone = n_unclone
+};
+
+static void numbers(const char *template, size_t count, size_t failing)
+{
+	struct mustach_compiled *compiled;
+	struct numbers n;
+	char *result;
+	size_t size;
+	int i, rc;
+
+	n.depth = 0;
+	n.count = count;
+	n.failing = failing;
+	nclones = 0;
+	mustach_compile(template, 0, Mustach_With_AllExtensions, &compiled);
+	rc = mustach_compiled_mem(compiled, &numbers_itf, &n, &result, &size);
+	printf("status=%d clones=", rc);
+	for (i = 0 ; i < nclones ; i++)
+		printf("%s%zu", i ? "," : "", clones[i]);
+	printf("\n");
+	if (rc == MUSTACH_OK) {
+		fwrite(result, 1, size, stdout);
+		free(result);
+	}
+	mustach_compiled_free(compiled);
+}
+
+/*
+ * Renders of json-c documents with and without the flag
+ * Mustach_With_ParallelSections give the same results.
+ */
+static const char *templates[] = {
+	"{{#rows}}{{id}},{{/rows}}\n",
+	"{{#rows}}{{id}}{{/rows}}\n",
+	"<table>\n  {{#rows}}\n  <tr><td>{{id}}</td><td>{{name}}</td></tr>\n  {{/rows}}\n</table>\n",
+	"{{#rows}}\n{{#odd}}\n  {{id}} is odd\n{{/odd}}\n{{^odd}}\n  {{id}} is even\n{{/odd}}\n{{/rows}}\n",
+	"{{#rows}}\n  {{#tags}}[{{mod}}]{{/tags}}\n  {{/rows}}\n",
+	"{{#rows}}\n{{#odd}}\n{{id}}\n{{/odd}}{{/rows}}\n",
+	"{{#rows}}{{#tags.*}}{{*}}={{.}} {{/tags.*}}{{/rows}}\n",
+	"{{#rows}}\n  {{> part-parallel}}\n{{/rows}}\n",
+	"{{#rows}}{{name}}{{/rows}}{{undefined}}\n",
+	"{{#rows}}{{#odd}}{{undefined}}{{/odd}}{{/rows}}\n"
+};
+
+static int partial_cb(void *closure, const char *name, struct mustach_sbuf *sbuf)
+{
+	(void)closure;
+	(void)name;
+	sbuf->value = "<{{id}}>";
+	return MUSTACH_OK;
+}
+
+static int write_cb(void *closure, const char *buffer, size_t size)
+{
+	return fwrite(buffer, 1, size, closure) == size ? MUSTACH_OK : MUSTACH_ERROR_SYSTEM;
+}
+
+static int emit_cb(void *closure, const char *buffer, size_t size, int escape)
+{
+	(void)escape;
+	return write_cb(closure, buffer, size);
+}
+
+/* renders 'compiled' in a file in the ways given by 'how' and returns its content */
+static int render(const struct mustach_compiled *compiled, struct json_object *root, int how, char **result, size_t *size)
+{
+	FILE *file;
+	int rc;
+
+	file = open_memstream(result, size);
+	switch (how) {
+	case 0:
+		rc = mustach_json_c_compiled_file(compiled, root, file);
+		break;
+	case 1:
+		rc = mustach_json_c_compiled_write(compiled, root, write_cb, file);
+		break;
+	case 2:
+		rc = mustach_json_c_compiled_emit(compiled, root, emit_cb, file);
+		break;
+	default:
+		rc = mustach_json_c_compiled_file_partial(compiled, root, partial_cb, NULL, file);
+		break;
+	}
+	fclose(file);
+	return rc;
+}
+
+static void compare(struct json_object *root, const char *template, int flags)
+{
+	struct mustach_compiled *sequential, *parallel;
+	char *r1, *r2;
+	size_t s1, s2;
+	int how, rc1, rc2, diffs;
+	FILE *file;
+
+	mustach_compile(template, 0, flags, &sequential);
+	mustach_compile(template, 0, flags | Mustach_With_ParallelSections, &parallel);
+	diffs = 0;
+	for (how = 0 ; how < 5 ; how++) {
+		if (how < 4) {
+			rc1 = render(sequential, root, how, &r1, &s1);
+			rc2 = render(parallel, root, how, &r2, &s2);
+		}
+		else {
+			/* output to a file descriptor */
+			file = tmpfile();
+			rc1 = mustach_json_c_compiled_fd(sequential, root, fileno(file));
+			s1 = (size_t)lseek(fileno(file), 0, SEEK_CUR);
+			rc2 = mustach_json_c_compiled_fd(parallel, root, fileno(file));
+			s2 = (size_t)lseek(fileno(file), 0, SEEK_CUR) - s1;
+			r1 = malloc(s1 + 1);
+			r2 = malloc(s2 + 1);
+			if (pread(fileno(file), r1, s1, 0) != (ssize_t)s1 || pread(fileno(file), r2, s2, (off_t)s1) != (ssize_t)s2)
+				diffs++;
+			fclose(file);
+		}
+		if (rc1 != rc2 || (rc1 == MUSTACH_OK && (s1 != s2 || memcmp(r1, r2, s1))))
+			diffs++;
+		free(r1);
+		free(r2);
+	}
+	printf("status=%d size=%zu differences=%d\n", rc1, s1, diffs);
+	mustach_compiled_free(sequential);
+	mustach_compiled_free(parallel);
+}
+
+int main(int ac, char **av)
+{
+	struct json_object *root;
+	char *data;
+	size_t len;
+	unsigned i;
+	FILE *file;
+
+	(void)ac;
+	(void)av;
+
+	/* the core */
+	numbers("{{#rows}}{{.}} {{/rows}}\n", 10, 99);
+	numbers("{{#rows}}\n  {{.}}{{#odd}} odd{{/odd}}\n{{/rows}}\n{{.}}\n", 8, 99);
+	numbers("{{#rows}}{{.}}\n{{/rows}}", 2, 99);
+	numbers("{{#rows}}{{.}} {{/rows}}\n", 9, 7);
+	numbers("{{#rows}}\n{{#odd}}\n{{.}}\n{{/odd}}{{/rows}}\n", 6, 99);
+
+	/* the json-c backend */
+	data = malloc(ROWS * 100);
+	len = (size_t)sprintf(data, "{\"rows\":[");
+	for (i = 0 ; i < ROWS ; i++)
+		len += (size_t)sprintf(&data[len], "%s{\"id\":%u,\"name\":\"row <%u>\",\"odd\":%s,\"tags\":{\"mod\":%u,\"half\":%u}}",
+				i ? "," : "", i, i, i & 1 ? "true" : "false", i % 7, i / 2);
+	strcpy(&data[len], "]}");
+	root = json_tokener_parse(data);
+	free(data);
+	file = fopen("part-parallel.mustache", "w");
+	fputs("<{{name}}>\n", file);
+	fclose(file);
+	mustach_wrap_parallel_sections(4, 16);
+	for (i = 0 ; i < sizeof templates / sizeof *templates ; i++)
+		compare(root, templates[i], Mustach_With_AllExtensions);
+	compare(root, templates[8], Mustach_With_AllExtensions | Mustach_With_ErrorUndefined);
+	compare(root, templates[9], Mustach_With_AllExtensions | Mustach_With_ErrorUndefined);
+	unlink("part-parallel.mustache");
+	json_object_put(root);
+	return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../mustach-json-c.h"
+
+#define READERS 4
+#define ROUNDS  200
+#define ITEMS   1100 /* more than the default PARALLEL_SECTION_ITEMS */
+
+static struct mustach_wrap_registry *registry;
+static struct json_object *root;
+
+static void write_file(const char *filename, const char *text, time_t mtime)
+{
+	struct timespec times[2];
+	FILE *file;
+
+	file = fopen(filename, "w");
+	fputs(text, file);
+	fclose(file);
+	times[0].tv_sec = times[1].tv_sec = mtime;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	utimensat(AT_FDCWD, filename, times, 0);
+}
+
+/* renders the template 'name' of the registry */
+static void show(const char *name)
+{
+	const struct mustach_wrap_template *t;
+	char *result;
+	size_t size;
+	int rc;
+
+	t = mustach_wrap_registry_get(registry, name);
+	if (t == NULL) {
+		printf("%s: not found\n", name);
+		return;
+	}
+	rc = mustach_json_c_compiled_mem_partial(t->compiled, root, mustach_wrap_registry_partial, registry, &result, &size);
+	printf("%s: status=%d\n", name, rc);
+	if (rc == MUSTACH_OK) {
+		fwrite(result, 1, size, stdout);
+		free(result);
+	}
+	mustach_wrap_registry_release(t);
+}
+
+/* the renders with the registry are the renders with the files */
+static void compare(const char *name, const char *filename)
+{
+	const struct mustach_wrap_template *t;
+	struct mustach_compiled *compiled;
+	char *r1, *r2, text[1000];
+	size_t s1, s2, length;
+	int rc1, rc2;
+	FILE *file;
+
+	t = mustach_wrap_registry_get(registry, name);
+	rc1 = mustach_json_c_compiled_mem_partial(t->compiled, root, mustach_wrap_registry_partial, registry, &r1, &s1);
+	mustach_wrap_registry_release(t);
+	file = fopen(filename, "r");
+	length = fread(text, 1, sizeof text, file);
+	fclose(file);
+	mustach_compile(text, length, Mustach_With_AllExtensions, &compiled);
+	rc2 = mustach_json_c_compiled_mem(compiled, root, &r2, &s2);
+	mustach_compiled_free(compiled);
+	printf("%s: status=%d,%d same=%d\n", name, rc1, rc2, rc1 == rc2 && s1 == s2 && !memcmp(r1, r2, s1));
+	free(r1);
+	free(r2);
+}
+
+/* renders the template "main" while the other thread replaces "item" */
+static void *reader(void *arg)
+{
+	const struct mustach_wrap_template *t;
+	char *result;
+	size_t size;
+	int i, bad = 0;
+
+	(void)arg;
+	for (i = 0 ; i < ROUNDS ; i++) {
+		t = mustach_wrap_registry_get(registry, "main");
+		if (mustach_json_c_compiled_mem_partial(t->compiled, root, mustach_wrap_registry_partial, registry, &result, &size) != MUSTACH_OK)
+			bad++;
+		else {
+			/* each row is rendered by a whole version of "item" */
+			if (strcmp(result, "A 1\nA 2\n") && strcmp(result, "A 1\nB 2\n")
+			 && strcmp(result, "B 1\nA 2\n") && strcmp(result, "B 1\nB 2\n"))
+				bad++;
+			free(result);
+		}
+		mustach_wrap_registry_release(t);
+	}
+	return (void*)(long)bad;
+}
+
+static void concurrency()
+{
+	pthread_t threads[READERS];
+	void *bad;
+	long total = 0;
+	int i;
+
+	mustach_wrap_registry_set(registry, "main", "{{#rows}}{{> item}}{{/rows}}", 0);
+	mustach_wrap_registry_set(registry, "item", "A {{id}}\n", 0);
+	for (i = 0 ; i < READERS ; i++)
+		pthread_create(&threads[i], NULL, reader, NULL);
+	for (i = 0 ; i < ROUNDS ; i++)
+		mustach_wrap_registry_set(registry, "item", i & 1 ? "A {{id}}\n" : "B {{id}}\n", 0);
+	for (i = 0 ; i < READERS ; i++) {
+		pthread_join(threads[i], &bad);
+		total += (long)bad;
+	}
+	printf("concurrency: bad=%ld\n", total);
+}
+
+/* renders "top" of a registry created with 'flags' for 'data' */
+static int render_top(int flags, struct json_object *data, char **result, size_t *size)
+{
+	struct mustach_wrap_registry *reg;
+	const struct mustach_wrap_template *t;
+	int rc;
+
+	mustach_wrap_registry_create(flags, &reg);
+	mustach_wrap_registry_set(reg, "top", "top\n    {{>p}}\nend\n", 0);
+	mustach_wrap_registry_set(reg, "p", "A\n{{#l}}\nv{{x}}\n{{/l}}\nB\n", 0);
+	t = mustach_wrap_registry_get(reg, "top");
+	rc = mustach_json_c_compiled_mem_partial(t->compiled, data, mustach_wrap_registry_partial, reg, result, size);
+	mustach_wrap_registry_release(t);
+	mustach_wrap_registry_destroy(reg);
+	return rc;
+}
+
+/* indented partials of the registry with sections rendered by many threads */
+static void indented()
+{
+	struct json_object *data;
+	char *r1, *r2, json[20 * ITEMS], *end;
+	size_t s1, s2;
+	int i, rc1, rc2;
+
+	end = json + sprintf(json, "{\"l\":[");
+	for (i = 0 ; i < ITEMS ; i++)
+		end += sprintf(end, "%s{\"x\":%d}", i ? "," : "", i);
+	strcpy(end, "]}");
+	data = json_tokener_parse(json);
+	mustach_wrap_parallel_sections(4, ITEMS);
+	rc1 = render_top(Mustach_With_AllExtensions, data, &r1, &s1);
+	rc2 = render_top(Mustach_With_AllExtensions | Mustach_With_ParallelSections, data, &r2, &s2);
+	printf("indented: status=%d,%d same=%d\n", rc1, rc2, rc1 == rc2 && s1 == s2 && !memcmp(r1, r2, s1));
+	fwrite(r1, 1, 30, stdout);
+	putchar('\n');
+	free(r1);
+	free(r2);
+	json_object_put(data);
+}
+
+int main(int ac, char **av)
+{
+	const struct mustach_wrap_template *kept;
+
+	(void)ac;
+	(void)av;
+
+	root = json_tokener_parse("{\"title\":\"list\",\"rows\":[{\"id\":1,\"name\":\"one\"},{\"id\":2,\"name\":\"two\"}]}");
+	mustach_wrap_registry_create(Mustach_With_AllExtensions, &registry);
+
+	/* templates given by text and by file */
+	write_file("row.mustache", "- {{name}}\n", 1000000);
+	write_file("page.mustache", "<h1>{{title}}</h1>\n<ul>\n{{#rows}}\n  {{> row}}\n{{/rows}}\n</ul>\n{{> missing}}", 1000000);
+	printf("set=%d\n", mustach_wrap_registry_set(registry, "title", "[{{title}}]\n", 0));
+	printf("set_file=%d\n", mustach_wrap_registry_set_file(registry, "row", "row.mustache"));
+	printf("set_file=%d\n", mustach_wrap_registry_set_file(registry, "page", "page.mustache"));
+	printf("set_file=%d\n", mustach_wrap_registry_set_file(registry, "none", "none.mustache"));
+	printf("set=%d\n", mustach_wrap_registry_set(registry, "title", "{{#bad}}", 0));
+	show("title");
+	show("page");
+	compare("page", "page.mustache");
+
+	/* replacements keep the templates got before */
+	kept = mustach_wrap_registry_get(registry, "title");
+	printf("set=%d\n", mustach_wrap_registry_set(registry, "title", "({{title}})\n", 0));
+	show("title");
+	fwrite(kept->text, 1, kept->length, stdout);
+	mustach_wrap_registry_release(kept);
+
+	/* refresh reloads only the changed files */
+	printf("refresh=%d\n", mustach_wrap_registry_refresh(registry));
+	write_file("row.mustache", "* {{name}}\n", 1000001);
+	printf("refresh=%d\n", mustach_wrap_registry_refresh(registry));
+	show("page");
+	write_file("row.mustache", "- {{#id}}\n", 1000002);
+	printf("refresh=%d\n", mustach_wrap_registry_refresh(registry));
+	show("page");
+	unlink("row.mustache");
+	printf("refresh=%d\n", mustach_wrap_registry_refresh(registry));
+
+	/* removal */
+	printf("remove=%d\n", mustach_wrap_registry_remove(registry, "row"));
+	printf("remove=%d\n", mustach_wrap_registry_remove(registry, "row"));
+	show("row");
+	show("page");
+	unlink("page.mustache");
+
+	concurrency();
+	indented();
+
+	mustach_wrap_registry_destroy(registry);
+	json_object_put(root);
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../mustach-json-c.h"
+
+#define ROWS 500
+
+/*
+ * A sink of a slow client: it takes at most 'chunk' bytes and
+ * would block every other call. The text taken is kept in 'text'.
+ */
+struct slow {
+	size_t chunk;
+	int toggle;
+	size_t biggest;
+	char *text;
+	size_t size;
+	size_t alloc;
+};
+
+static int slow_sink(void *closure, const char *buffer, size_t size, size_t *written)
+{
+	struct slow *s = closure;
+
+	if (size > s->biggest)
+		s->biggest = size;
+	if ((s->toggle ^= 1) == 0) {
+		*written = 0;
+		return MUSTACH_OK;
+	}
+	if (size > s->chunk)
+		size = s->chunk;
+	if (s->size + size > s->alloc) {
+		s->alloc = 2 * (s->size + size);
+		s->text = realloc(s->text, s->alloc);
+	}
+	memcpy(&s->text[s->size], buffer, size);
+	s->size += size;
+	*written = size;
+	return MUSTACH_OK;
+}
+
+/* a sink writing to a non blocking file descriptor */
+static int fd_sink(void *closure, const char *buffer, size_t size, size_t *written)
+{
+	ssize_t rc;
+
+	do {
+		rc = write(*(int*)closure, buffer, size);
+	} while (rc < 0 && errno == EINTR);
+	if (rc >= 0)
+		*written = (size_t)rc;
+	else if (errno == EAGAIN)
+		*written = 0;
+	else
+		return MUSTACH_ERROR_SYSTEM;
+	return MUSTACH_OK;
+}
+
+/* a sink failing after some bytes */
+static int failing_sink(void *closure, const char *buffer, size_t size, size_t *written)
+{
+	size_t *remain = closure;
+
+	(void)buffer;
+	if (*remain < size)
+		return MUSTACH_ERROR_USER(7);
+	*remain -= size;
+	*written = size;
+	return MUSTACH_OK;
+}
+
+static int partial_cb(void *closure, const char *name, struct mustach_sbuf *sbuf)
+{
+	(void)closure;
+	if (!strcmp(name, "row"))
+		sbuf->value = "<{{id}}>\n  {{> cell}}\n";
+	else if (!strcmp(name, "cell"))
+		sbuf->value = "[{{name}}]\n";
+	else if (!strcmp(name, "delims"))
+		sbuf->value = "{{#rows}}{{=<% %>=}}<%id%>,<%/rows%>\n";
+	else if (!strcmp(name, "self"))
+		sbuf->value = "{{> self}}";
+	else
+		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	return MUSTACH_OK;
+}
+
+static const char *templates[] = {
+	"{{#rows}}{{id}}:{{name}}\n{{/rows}}",
+	"<ul>\n  {{#rows}}\n  <li>{{{name}}}</li>\n  {{/rows}}\n</ul>\n{{^none}}end{{/none}}\n",
+	"{{#rows}}\n{{#odd}}\n  {{> row}}\n{{/odd}}\n{{/rows}}\n",
+	"before\n{{> delims}}after\n",
+	"{{#rows}}{{id}}{{/rows}}{{undefined}}\n"
+};
+
+/* renders 'compiled' by steps to a slow sink, returns the status */
+static int slow_render(const struct mustach_compiled *compiled, struct json_object *root, struct slow *s, int *steps)
+{
+	struct mustach_render *render;
+	int rc;
+
+	memset(s, 0, sizeof *s);
+	s->chunk = 1000;
+	*steps = 0;
+	rc = mustach_json_c_render_start_partial(compiled, root, partial_cb, NULL, slow_sink, s, &render);
+	if (rc != MUSTACH_OK)
+		return rc;
+	do {
+		rc = mustach_render_step(render);
+		++*steps;
+	} while (rc == MUSTACH_AGAIN);
+	if (mustach_render_step(render) != rc)
+		rc = MUSTACH_ERROR_USER(99);
+	mustach_render_stop(render);
+	return rc;
+}
+
+/* renders 'compiled' by steps to a pipe read when full */
+static int pipe_render(const struct mustach_compiled *compiled, struct json_object *root, char **text, size_t *size)
+{
+	struct mustach_render *render;
+	int rc, fds[2];
+	ssize_t n;
+	FILE *file;
+	char buffer[1000];
+
+	if (pipe2(fds, O_NONBLOCK) < 0)
+		return MUSTACH_ERROR_SYSTEM;
+	fcntl(fds[1], F_SETPIPE_SZ, 4096);
+	file = open_memstream(text, size);
+	rc = mustach_json_c_render_start_partial(compiled, root, partial_cb, NULL, fd_sink, &fds[1], &render);
+	while (rc >= 0) {
+		rc = mustach_render_step(render);
+		while ((n = read(fds[0], buffer, sizeof buffer)) > 0)
+			fwrite(buffer, 1, (size_t)n, file);
+		if (rc != MUSTACH_AGAIN)
+			break;
+	}
+	mustach_render_stop(render);
+	fclose(file);
+	close(fds[0]);
+	close(fds[1]);
+	return rc;
+}
+
+static void compare(struct json_object *root, const char *template, int flags)
+{
+	struct mustach_compiled *compiled;
+	struct slow s;
+	char *ref, *text;
+	size_t rsize, size;
+	int rc, rc1, rc2, steps;
+
+	mustach_compile(template, 0, flags, &compiled);
+	rc = mustach_json_c_compiled_mem_partial(compiled, root, partial_cb, NULL, &ref, &rsize);
+	rc1 = slow_render(compiled, root, &s, &steps);
+	rc2 = pipe_render(compiled, root, &text, &size);
+	printf("status=%d,%d,%d size=%zu steps>1=%d bounded=%d same=%d,%d\n", rc, rc1, rc2, rsize, steps > 1,
+		s.biggest <= 3 * MUSTACH_OUTPUT_BUFFER_SIZE,
+		rc != MUSTACH_OK || (s.size == rsize && !memcmp(s.text, ref, rsize)),
+		rc != MUSTACH_OK || (size == rsize && !memcmp(text, ref, rsize)));
+	if (rc == MUSTACH_OK)
+		free(ref);
+	free(s.text);
+	free(text);
+	mustach_compiled_free(compiled);
+}
+
+int main(int ac, char **av)
+{
+	struct mustach_compiled *compiled;
+	struct mustach_render *render;
+	struct json_object *root;
+	struct slow s;
+	size_t remain;
+	char *data;
+	size_t len;
+	unsigned i;
+	int rc, steps;
+
+	(void)ac;
+	(void)av;
+
+	data = malloc(ROWS * 100);
+	len = (size_t)sprintf(data, "{\"rows\":[");
+	for (i = 0 ; i < ROWS ; i++)
+		len += (size_t)sprintf(&data[len], "%s{\"id\":%u,\"name\":\"row <%u> & co\",\"odd\":%s}",
+				i ? "," : "", i, i, i & 1 ? "true" : "false");
+	strcpy(&data[len], "]}");
+	root = json_tokener_parse(data);
+	free(data);
+
+	for (i = 0 ; i < sizeof templates / sizeof *templates ; i++)
+		compare(root, templates[i], Mustach_With_AllExtensions);
+	compare(root, templates[4], Mustach_With_AllExtensions | Mustach_With_ErrorUndefined);
+
+	/* the partials are limited to MUSTACH_MAX_DEPTH levels */
+	mustach_compile("{{> self}}", 0, Mustach_With_AllExtensions, &compiled);
+	printf("recursive partial: status=%d\n", slow_render(compiled, root, &s, &steps));
+	free(s.text);
+	mustach_compiled_free(compiled);
+
+	/* errors of the sink end the render */
+	mustach_compile(templates[0], 0, Mustach_With_AllExtensions, &compiled);
+	remain = 10000;
+	rc = mustach_json_c_render_start(compiled, root, failing_sink, &remain, &render);
+	while (rc >= 0 && (rc = mustach_render_step(render)) == MUSTACH_AGAIN);
+	printf("failing sink: status=%d\n", rc);
+	mustach_render_stop(render);
+
+	/* renders can be stopped before their end */
+	memset(&s, 0, sizeof s);
+	s.chunk = 100;
+	rc = mustach_json_c_render_start(compiled, root, slow_sink, &s, &render);
+	for (i = 0 ; i < 5 && rc >= 0 ; i++)
+		rc = mustach_render_step(render);
+	mustach_render_stop(render);
+	printf("stopped: status=%d size=%zu\n", rc, s.size);
+	free(s.text);
+	mustach_compiled_free(compiled);
+
+	json_object_put(root);
+	return 0;
+}
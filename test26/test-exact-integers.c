@@ -0,0 +1,63 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../mustach-json-c.h"
+
+/*
+ * Integers of JSON are compared exactly, even beyond 2^53 where
+ * doubles can't distinguish consecutive values: 9007199254740993
+ * and 9007199254740992 are the same double.
+ */
+static const char json[] =
+	"{\"big\":9007199254740993,"
+	"\"huge\":9223372036854775807,"
+	"\"low\":-9007199254740993}";
+
+static const struct {
+	const char *template;
+	const char *expected;
+} cases[] = {
+	{ "{{#big>9007199254740992}}yes{{/big>9007199254740992}}", "yes" },
+	{ "{{#big=9007199254740992}}yes{{/big=9007199254740992}}", "" },
+	{ "{{#big=9007199254740993}}yes{{/big=9007199254740993}}", "yes" },
+	{ "{{#big<9007199254740994}}yes{{/big<9007199254740994}}", "yes" },
+	{ "{{#huge>9223372036854775806}}yes{{/huge>9223372036854775806}}", "yes" },
+	{ "{{#huge=9223372036854775806}}yes{{/huge=9223372036854775806}}", "" },
+	{ "{{#low<-9007199254740992}}yes{{/low<-9007199254740992}}", "yes" },
+	{ "{{#low>=-9007199254740993}}yes{{/low>=-9007199254740993}}", "yes" },
+	{ "{{#low>-9007199254740993}}yes{{/low>-9007199254740993}}", "" },
+};
+
+int main(int ac, char **av)
+{
+	struct json_object *root;
+	char *result;
+	size_t size, i;
+	int rc;
+
+	(void)ac;
+	(void)av;
+
+	root = json_tokener_parse(json);
+	for (i = 0 ; i < sizeof cases / sizeof *cases ; i++) {
+		rc = mustach_json_c_mem(cases[i].template, 0, root, Mustach_With_AllExtensions, &result, &size);
+		printf("%s: rc=%d %s\n", cases[i].template, rc,
+			rc == MUSTACH_OK && size == strlen(cases[i].expected)
+				&& !memcmp(result, cases[i].expected, size) ? "ok" : "BAD");
+		if (rc == MUSTACH_OK)
+			free(result);
+	}
+	json_object_put(root);
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "../mustach-json-c.h"
+
+static const size_t BLOCKSIZE = 8192;
+
+static char *readfile(const char *filename, size_t *length)
+{
+	int f;
+	struct stat s;
+	char *result, *ptr;
+	size_t size, pos;
+	ssize_t rc;
+
+	result = NULL;
+	f = open(filename, O_RDONLY);
+	if (f < 0) {
+		fprintf(stderr, "Can't open file: %s\n", filename);
+		exit(1);
+	}
+
+	fstat(f, &s);
+	size = (s.st_mode & S_IFMT) == S_IFREG ? (size_t)s.st_size : BLOCKSIZE;
+	pos = 0;
+	result = malloc(size + 1);
+	do {
+		if (result == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		rc = read(f, &result[pos], (size - pos) + 1);
+		if (rc < 0) {
+			fprintf(stderr, "Error while reading %s\n", filename);
+			exit(1);
+		}
+		if (rc > 0) {
+			pos += (size_t)rc;
+			if (pos > size) {
+				size = pos + BLOCKSIZE;
+				ptr = realloc(result, size + 1);
+				if (!ptr)
+					free(result);
+				result = ptr;
+			}
+		}
+	} while(rc > 0);
+
+	close(f);
+	*length = pos;
+	result[pos] = 0;
+	return result;
+}
+
+int main(int ac, char **av)
+{
+	struct json_object *o;
+	struct mustach_compiled *compiled;
+	char *t, *ri, *rc;
+	size_t length, si, sc;
+	int s, i;
+
+	(void)ac; /* unused */
+	if (*++av) {
+		o = json_object_from_file(av[0]);
+		if (o == NULL) {
+			fprintf(stderr, "Aborted: null json (file %s)\n", av[0]);
+			exit(1);
+		}
+		while(*++av) {
+			t = readfile(*av, &length);
+			s = mustach_compile(t, length, Mustach_With_AllExtensions, &compiled);
+			if (s != 0)
+				fprintf(stderr, "Compile error %d\n", s);
+			else {
+				s = mustach_json_c_mem(t, length, o, Mustach_With_AllExtensions, &ri, &si);
+				if (s != 0)
+					fprintf(stderr, "Template error %d\n", s);
+				free(t);
+				/* renders twice to check reuse of compiled templates */
+				for (i = 0 ; i < 2 ; i++) {
+					s = mustach_json_c_compiled_mem(compiled, o, &rc, &sc);
+					if (s != 0)
+						fprintf(stderr, "Compiled template error %d\n", s);
+					else {
+						printf("%s: %s\n", *av, si == sc && !memcmp(ri, rc, si) ? "same" : "DIFFERS");
+						fwrite(rc, 1, sc, stdout);
+						free(rc);
+					}
+				}
+				free(ri);
+				mustach_compiled_free(compiled);
+			}
+		}
+		json_object_put(o);
+	}
+	return 0;
+}
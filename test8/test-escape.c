@@ -0,0 +1,195 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mustach.h"
+
+struct out {
+	char *buffer;
+	size_t size;
+	size_t alloc;
+	unsigned calls;
+	unsigned fail_at;
+};
+
+static int collect(void *closure, const char *buffer, size_t size)
+{
+	struct out *out = closure;
+
+	if (++out->calls == out->fail_at)
+		return MUSTACH_ERROR_USER(1);
+	if (out->size + size > out->alloc) {
+		out->alloc = 2 * (out->size + size);
+		out->buffer = realloc(out->buffer, out->alloc);
+		if (out->buffer == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+	}
+	memcpy(&out->buffer[out->size], buffer, size);
+	out->size += size;
+	return MUSTACH_OK;
+}
+
+/* the escaping as it was done before the shared kernel */
+static int escape_legacy(const char *buffer, size_t size, FILE *file)
+{
+	size_t i, j, r;
+
+	r = i = 0;
+	while (i < size) {
+		j = i;
+		while (j < size && buffer[j] != '<' && buffer[j] != '>' && buffer[j] != '&' && buffer[j] != '"')
+			j++;
+		if (j != i && fwrite(&buffer[i], j - i, 1, file) != 1)
+			return MUSTACH_ERROR_SYSTEM;
+		if (j < size) {
+			switch(buffer[j++]) {
+			case '<': r = fwrite("&lt;", 4, 1, file); break;
+			case '>': r = fwrite("&gt;", 4, 1, file); break;
+			case '&': r = fwrite("&amp;", 5, 1, file); break;
+			case '"': r = fwrite("&quot;", 6, 1, file); break;
+			}
+			if (r != 1)
+				return MUSTACH_ERROR_SYSTEM;
+		}
+		i = j;
+	}
+	return MUSTACH_OK;
+}
+
+static void fill(char *buffer, size_t size, unsigned special, unsigned *seed)
+{
+	static const char specials[] = "<>&\"";
+	size_t i;
+
+	for (i = 0 ; i < size ; i++) {
+		*seed = *seed * 1103515245 + 12345;
+		buffer[i] = (*seed >> 16) % 100 < special
+			? specials[(*seed >> 8) & 3]
+			: (char)('a' + (*seed >> 20) % 26);
+	}
+}
+
+static int check(const char *buffer, size_t size)
+{
+	struct out out = { 0 };
+	FILE *file;
+	char *mem;
+	size_t msz;
+	int rc;
+
+	file = open_memstream(&mem, &msz);
+	escape_legacy(buffer, size, file);
+	fclose(file);
+	rc = mustach_escape_html(buffer, size, collect, &out);
+	rc = rc == MUSTACH_OK && out.size == msz && (msz == 0 || !memcmp(out.buffer, mem, msz));
+	free(mem);
+	free(out.buffer);
+	return rc;
+}
+
+static int test(void)
+{
+	static const unsigned specials[] = { 0, 1, 10, 50, 100 };
+	static const size_t sizes[] = { 0, 1, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1023, 1024, 1025, 5000, 100000 };
+	unsigned seed = 1, is, iz, off, ok = 0, ko = 0;
+	char *buffer = malloc(100000 + 64);
+	struct out out = { 0 };
+	int rc;
+
+	for (is = 0 ; is < sizeof specials / sizeof *specials ; is++)
+		for (iz = 0 ; iz < sizeof sizes / sizeof *sizes ; iz++)
+			for (off = 0 ; off < 32 ; off += 7) {
+				fill(&buffer[off], sizes[iz], specials[is], &seed);
+				if (check(&buffer[off], sizes[iz]))
+					ok++;
+				else {
+					ko++;
+					printf("DIFFERS: size %u, special %u%%, offset %u\n",
+						(unsigned)sizes[iz], specials[is], off);
+				}
+			}
+	printf("escaping: %u ok, %u differs\n", ok, ko);
+
+	/* errors of the writer are reported */
+	fill(buffer, 100000, 10, &seed);
+	out.fail_at = 2;
+	rc = mustach_escape_html(buffer, 100000, collect, &out);
+	printf("error reported: %s\n", rc == MUSTACH_ERROR_USER(1) ? "yes" : "no");
+	free(out.buffer);
+
+	free(buffer);
+	return ko != 0;
+}
+
+static int fwrite_cb(void *closure, const char *buffer, size_t size)
+{
+	return fwrite(buffer, 1, size, (FILE*)closure) == size ? MUSTACH_OK : MUSTACH_ERROR_SYSTEM;
+}
+
+static int count_cb(void *closure, const char *buffer, size_t size)
+{
+	(void)buffer;
+	(void)size;
+	++*(unsigned long*)closure;
+	return MUSTACH_OK;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static void bench(void)
+{
+	static const struct { const char *name; unsigned special; } kinds[] = {
+		{ "clean", 0 }, { "mixed", 5 }, { "mostly-special", 80 }
+	};
+	enum { SIZE = 1 << 20, ROUNDS = 200 };
+	char *buffer = malloc(SIZE);
+	unsigned seed = 1, i, k;
+	unsigned long calls;
+	FILE *file = fopen("/dev/null", "w");
+	double t0, t1, t2;
+
+	for (k = 0 ; k < sizeof kinds / sizeof *kinds ; k++) {
+		fill(buffer, SIZE, kinds[k].special, &seed);
+		t0 = now();
+		for (i = 0 ; i < ROUNDS ; i++)
+			escape_legacy(buffer, SIZE, file);
+		t1 = now();
+		for (i = 0 ; i < ROUNDS ; i++)
+			mustach_escape_html(buffer, SIZE, fwrite_cb, file);
+		t2 = now();
+		calls = 0;
+		mustach_escape_html(buffer, SIZE, count_cb, &calls);
+		printf("%-15s legacy %8.1f MB/s   kernel %8.1f MB/s   (%lu writes per MB)\n",
+			kinds[k].name,
+			ROUNDS * (SIZE / 1e6) / (t1 - t0),
+			ROUNDS * (SIZE / 1e6) / (t2 - t1),
+			calls);
+	}
+	fclose(file);
+	free(buffer);
+}
+
+int main(int ac, char **av)
+{
+	if (ac > 1 && !strcmp(av[1], "bench")) {
+		bench();
+		return 0;
+	}
+	return test();
+}
@@ -0,0 +1,108 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "../mustach-json-c.h"
+
+static const char template[] =
+	"<ul>\n"
+	"{{#items}}\n"
+	"  <li id=\"{{id}}\">{{name}}</li>\n"
+	"{{/items}}\n"
+	"</ul>\n";
+
+struct reader {
+	int fd;
+	char *buffer;
+	size_t size;
+};
+
+static void *reader(void *closure)
+{
+	struct reader *r = closure;
+	size_t alloc = 0;
+	ssize_t rc;
+
+	for (;;) {
+		if (r->size + 4096 > alloc) {
+			alloc = 2 * (r->size + 4096);
+			r->buffer = realloc(r->buffer, alloc);
+		}
+		/* read slowly to fill the pipe */
+		usleep(100);
+		rc = read(r->fd, &r->buffer[r->size], 4096);
+		if (rc <= 0)
+			return NULL;
+		r->size += (size_t)rc;
+	}
+}
+
+int main(int ac, char **av)
+{
+	struct json_object *root;
+	struct mustach_compiled *compiled;
+	struct reader rd;
+	pthread_t thread;
+	char *json, *pos, *expected;
+	size_t size, count;
+	int fds[2], rc1, rc2, rc3, i;
+
+	/* data */
+	count = ac > 1 ? (size_t)atoi(av[1]) : 5000;
+	pos = json = malloc(64 * count + 32);
+	pos += sprintf(pos, "{\"items\":[");
+	for (i = 0 ; i < (int)count ; i++)
+		pos += sprintf(pos, "%s{\"id\":%d,\"name\":\"item <%d> & co\"}", i ? "," : "", i, i);
+	sprintf(pos, "]}");
+	root = json_tokener_parse(json);
+	free(json);
+	mustach_json_c_mem(template, 0, root, Mustach_With_AllExtensions, &expected, &size);
+
+	/* non blocking pipe read slowly */
+	if (pipe(fds) < 0)
+		return 1;
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	rd.fd = fds[0];
+	rd.buffer = NULL;
+	rd.size = 0;
+	pthread_create(&thread, NULL, reader, &rd);
+
+	/* render twice, interpreted and compiled */
+	rc1 = mustach_json_c_fd(template, 0, root, Mustach_With_AllExtensions, fds[1]);
+	mustach_compile(template, 0, Mustach_With_AllExtensions, &compiled);
+	rc2 = mustach_json_c_compiled_fd(compiled, root, fds[1]);
+	mustach_compiled_free(compiled);
+
+	/* the descriptor is still open */
+	rc3 = (int)write(fds[1], "END\n", 4);
+	close(fds[1]);
+	pthread_join(thread, NULL);
+	close(fds[0]);
+
+	printf("render interpreted: %d\n", rc1);
+	printf("render compiled: %d\n", rc2);
+	printf("descriptor kept open: %s\n", rc3 == 4 ? "yes" : "no");
+	printf("size: %s\n", rd.size == 2 * size + 4 ? "ok" : "bad");
+	printf("output: %s\n", rd.size == 2 * size + 4
+			&& !memcmp(rd.buffer, expected, size)
+			&& !memcmp(&rd.buffer[size], expected, size)
+			&& !memcmp(&rd.buffer[2 * size], "END\n", 4) ? "same" : "DIFFERS");
+
+	free(rd.buffer);
+	free(expected);
+	json_object_put(root);
+	return 0;
+}